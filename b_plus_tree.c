@@ -2,9 +2,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 #include "Linked-List/linked_list.h"
 #include "b_plus_tree.h"
 
+/*
+ * The debug messages and dumps are written by printf(). Define BPT_QUIET
+ * to compile them out, as the benchmark build does.
+ */
+#ifdef BPT_QUIET
+#define printf(...) ((void) 0)
+#endif
+
 /* Macros for B+ tree node */
 #define HAVE_SAME_PARENT(n1, n2) \
     (n1 && n2 && n1->parent == n2->parent)
@@ -20,12 +30,106 @@
 #define GET_MIN_CHILDREN_NUM(max_keys)				\
     ((max_keys % 2 == 0) ? (max_keys / 2) : (max_keys / 2 + 1))
 
+/* Macros for operation counters. See bpt_counters_snapshot() */
+#ifdef BPT_COUNTERS
+#define BPT_COUNT(bpt, counter, n)				\
+    (bpt_ref_thread_counters(bpt)->counter += (n))
+#else
+#define BPT_COUNT(bpt, counter, n) ((void) 0)
+#endif
+
+/* Macros for latency histograms. See bpt_latency_snapshot() */
+#ifdef BPT_LATENCY
+#define BPT_TIMESTAMP(name) uint64_t name = bpt_clock_ns()
+#define BPT_RECORD_LATENCY(bpt, op, start, searched, done, restructured) \
+    bpt_record_latency(bpt, op, start, searched, done, restructured)
+#else
+#define BPT_TIMESTAMP(name)
+#define BPT_RECORD_LATENCY(bpt, op, start, searched, done, restructured) \
+    ((void) 0)
+#endif
+
+/*
+ * Macro for the prefetch hints of the search and the leaf-chain walks.
+ * Define BPT_NO_PREFETCH to compile them out for comparison. See
+ * bpt_search_internal() and bpt_begin_leaf_walk()
+ */
+#if defined(__GNUC__) && !defined(BPT_NO_PREFETCH)
+#define BPT_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define BPT_PREFETCH(addr) ((void) (addr))
+#endif
+
 /* Macros for iteration */
 #define ITER_BPT_KEY(node)			\
     ll_get_iter_data(node->keys)
 #define ITER_BPT_CHILD(node)				\
     ((bpt_node *) ll_get_iter_data(node->children))
 
+/*
+ * Macro for the packed keys. Set 'index' to the index of the delta equal
+ * to 't', or -1, counting the smaller deltas. The loop has no early exit
+ * so that the compiler can vectorize it. See bpt_search_packed_keys()
+ */
+#define BPT_SEARCH_DELTAS(type, deltas, n, t, index)			\
+    do {								\
+	type *_d = (type *) (deltas), _t = (type) (t);			\
+	int _i, _smaller = 0;						\
+	for (_i = 0; _i < (n); _i++)					\
+	    _smaller += _d[_i] < _t;					\
+	(index) = _smaller < (n) && _d[_smaller] == _t ? _smaller : -1; \
+    } while(0)
+
+#ifdef BPT_COUNTERS
+/*
+ * Thread number to choose the counter slot. Assigned on the first count
+ * by each thread.
+ */
+static uint32_t bpt_thread_num;
+static __thread int bpt_thread_slot = -1;
+
+/*
+ * Return the counters of this thread's slot.
+ */
+static inline bpt_counters *
+bpt_ref_thread_counters(bpt_tree *bpt){
+    if (bpt_thread_slot < 0)
+	bpt_thread_slot = __atomic_fetch_add(&bpt_thread_num, 1,
+					     __ATOMIC_RELAXED) % BPT_COUNTER_SLOTS;
+
+    return &bpt->counters[bpt_thread_slot].counters;
+}
+#endif
+
+#ifdef BPT_LATENCY
+/*
+ * Return the monotonic clock in nanoseconds.
+ */
+static inline uint64_t
+bpt_clock_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Record the latency of each phase of one operation.
+ */
+static void
+bpt_record_latency(bpt_tree *bpt, bpt_op op, uint64_t start,
+		   uint64_t searched, uint64_t done, bool restructured){
+    bpt_histogram *histograms = bpt->latency->histograms[op];
+
+    bpt_histogram_record(&histograms[BPT_PHASE_TOTAL], done - start);
+    bpt_histogram_record(&histograms[BPT_PHASE_DESCENT], searched - start);
+    if (restructured)
+	bpt_histogram_record(&histograms[BPT_PHASE_RESTRUCTURE],
+			     done - searched);
+}
+#endif
+
 /*
  * Necessary function prototype for the cross reference
  * bpt_delete_internal() and bpt_borrowed_key_from_sibling().
@@ -34,6 +138,24 @@ static void
 bpt_delete_internal(bpt_tree *bpt, bpt_node *curr,
 		    void *removed_key, void **record);
 
+/*
+ * Necessary function prototype for bpt_delete() in the relaxed mode,
+ * which depends on the helpers for structural changes defined later.
+ */
+static void
+bpt_lazy_delete_internal(bpt_tree *bpt, bpt_node *leaf,
+			 void *removed_key, void **record);
+static void
+bpt_move_cursors_off_key(bpt_tree *bpt, bpt_node *leaf, void *removed_key);
+
+/*
+ * Necessary function prototype for bpt_insert(), which searches for the
+ * leaf without recording the latency of bpt_search().
+ */
+static bool
+bpt_lookup(bpt_tree *bpt, void* new_key, bpt_node **leaf_node,
+	   void **record);
+
 /*
  * Return the bpt_node * child from the node by specified index
  * value.
@@ -111,14 +233,332 @@ bpt_malloc(size_t size){
     return p;
 }
 
+/*
+ * Round 'size' up to a multiple of 'alignment', a power of two.
+ */
+static size_t
+bpt_aligned_size(size_t alignment, size_t size){
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/*
+ * Allocate 'size' bytes at an address aligned to 'alignment', a power of
+ * two. The size is rounded up to a multiple of 'alignment' as
+ * aligned_alloc() requires. Freed by free().
+ */
+static void*
+bpt_malloc_aligned(size_t alignment, size_t size){
+    void *p;
+
+    size = bpt_aligned_size(alignment, size);
+    if ((p = aligned_alloc(alignment, size)) == NULL){
+	perror("aligned_alloc");
+	exit(-1);
+    }
+
+    return p;
+}
+
+/*
+ * Return the allocated size of the packed keys of one leaf, or zero
+ * without them.
+ */
+static uintptr_t
+bpt_packed_footprint(bpt_tree *bpt, bpt_packed_keys *packed){
+    if (packed == NULL)
+	return 0;
+
+    return bpt_aligned_size(BPT_CACHE_LINE_SIZE,
+			    sizeof(bpt_packed_keys) +
+			    packed->capacity * (bpt->max_keys + 1));
+}
+
+/*
+ * Count the keys of the leaves, the nodes and the memory of the packed
+ * keys in the whole tree.
+ */
+static void
+bpt_count_subtree(bpt_tree *bpt, uintptr_t *keys, uintptr_t *leaves,
+		  uintptr_t *internals, uintptr_t *packed_bytes){
+    bpt_node *curr, *leftmost;
+
+    *keys = *leaves = *internals = *packed_bytes = 0;
+
+    for (curr = bpt->root; curr != NULL; curr = leftmost){
+	leftmost = curr->is_leaf ? NULL : bpt_ref_index_child(curr, 0);
+	for (; curr != NULL; curr = curr->next){
+	    if (curr->is_leaf){
+		*keys += KEY_LEN(curr);
+		(*leaves)++;
+		*packed_bytes += bpt_packed_footprint(bpt, curr->packed);
+	    }else
+		(*internals)++;
+	}
+    }
+}
+
+/*
+ * Recount the counters of bpt_stats_fast() by walking the tree, if
+ * bpt_split_at() has left them stale.
+ */
+static void
+bpt_settle_counts(bpt_tree *bpt){
+    if (!bpt->counts_stale)
+	return;
+
+    bpt_count_subtree(bpt, &bpt->key_count, &bpt->leaf_count,
+		      &bpt->internal_count, &bpt->packed_bytes);
+    bpt->counts_stale = false;
+}
+
+/*
+ * Count the node in or out of the tree's node counters. See bpt_stats().
+ */
+static void
+bpt_count_node(bpt_tree *bpt, bpt_node *node, bool add){
+    uintptr_t *counter = node->is_leaf ? &bpt->leaf_count : &bpt->internal_count;
+
+    if (add)
+	(*counter)++;
+    else
+	(*counter)--;
+}
+
+/*
+ * Turn the emptied internal root into an empty leaf.
+ */
+static void
+bpt_turn_into_leaf(bpt_tree *bpt, bpt_node *node){
+    if (node->is_leaf)
+	return;
+
+    bpt_count_node(bpt, node, false);
+    node->is_leaf = true;
+    bpt_count_node(bpt, node, true);
+}
+
+/*
+ * Return the zero-cleared counter slots, or NULL if the counters are
+ * compiled out.
+ */
+static bpt_counter_slot *
+bpt_gen_counters(void){
+#ifdef BPT_COUNTERS
+    bpt_counter_slot *slots;
+    size_t size = sizeof(bpt_counter_slot) * BPT_COUNTER_SLOTS;
+
+    if ((slots = aligned_alloc(BPT_CACHE_LINE_SIZE, size)) == NULL){
+	perror("aligned_alloc");
+	exit(-1);
+    }
+    memset(slots, 0, size);
+
+    return slots;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Return the zero-cleared latency histograms, or NULL if the latency
+ * recording is compiled out.
+ */
+static bpt_latency *
+bpt_gen_latency(void){
+#ifdef BPT_LATENCY
+    bpt_latency *latency = bpt_malloc(sizeof(bpt_latency));
+
+    memset(latency, 0, sizeof(bpt_latency));
+
+    return latency;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Source of the abbreviation epochs. Shared by all the trees, so that a
+ * node moved to another tree by bpt_split_at() or bpt_concat() never
+ * meets the epoch of its cache again.
+ */
+static uintptr_t bpt_abbrev_epochs;
+
+/*
+ * Invalidate all the abbreviations cached in the tree's nodes.
+ *
+ * Call this whenever many keys can leave the tree at once. The
+ * application may free them and allocate new keys at the same addresses,
+ * which the caches can't tell from the old ones. A single deleted key is
+ * dropped by bpt_forget_abbrev() instead.
+ */
+static void
+bpt_renew_abbrev_epoch(bpt_tree *bpt){
+    bpt->abbrev_epoch = __atomic_add_fetch(&bpt_abbrev_epochs, 1,
+					   __ATOMIC_RELAXED);
+}
+
+/*
+ * Drop the abbreviations cached for a key which leaves the tree. Only the
+ * leaf holding the key and its ancestors, where the key can be a
+ * separator, can have cached it, so the other nodes keep their caches.
+ */
+static void
+bpt_forget_abbrev(bpt_node *leaf, void *key){
+    bpt_abbrev_cache *cache;
+    bpt_node *curr;
+    uintptr_t i;
+
+    for (curr = leaf; curr != NULL; curr = curr->parent){
+	if ((cache = curr->abbrevs) == NULL)
+	    continue;
+
+	for (i = 0; i < cache->capacity; i++)
+	    if (cache->keys[i] == key)
+		cache->keys[i] = NULL;
+
+	/* Recompute the common prefix if the key bounded it */
+	if (cache->first == key || cache->last == key)
+	    cache->first = cache->last = NULL;
+    }
+}
+
+/*
+ * Append one pointer to an array which doubles when it's full.
+ */
+static void
+bpt_push_pointer(void ***array, uintptr_t *num, uintptr_t *size, void *p){
+    void **grown;
+
+    if (*num == *size){
+	*size = *size == 0 ? 16 : *size * 2;
+	grown = (void **) bpt_malloc(sizeof(void *) * *size);
+	if (*num > 0)
+	    memcpy(grown, *array, sizeof(void *) * *num);
+	free(*array);
+	*array = grown;
+    }
+
+    (*array)[(*num)++] = p;
+}
+
+/*
+ * Keep one replaced page or removed out-of-line record until the next
+ * update of the tree. See bpt_release_retired().
+ */
+static void
+bpt_retire(bpt_tree *bpt, void *p){
+    bpt_push_pointer(&bpt->retired, &bpt->retired_num,
+		     &bpt->retired_size, p);
+}
+
+/*
+ * Free the retired memory. Called at the head of every update, after
+ * which no record returned before is referred to any longer.
+ */
+static void
+bpt_release_retired(bpt_tree *bpt){
+    uintptr_t i;
+
+    for (i = 0; i < bpt->retired_num; i++)
+	free(bpt->retired[i]);
+    bpt->retired_num = 0;
+}
+
+/*
+ * Retire one record removed from the tree if it's out of line, which the
+ * tree has copied at insertion.
+ */
+static void
+bpt_drop_record(bpt_tree *bpt, void *record){
+    if (bpt->record_length != NULL &&
+	bpt->record_length(record) > bpt->inline_limit)
+	bpt_retire(bpt, record);
+}
+
+/*
+ * Take one node out of the arena, reusing a freed one first.
+ */
+static bpt_node *
+bpt_arena_alloc(bpt_node_arena *arena){
+    bpt_node *node, **slabs;
+
+    if ((node = arena->free_nodes) != NULL){
+	arena->free_nodes = node->next;
+	return node;
+    }
+
+    if (arena->used == arena->slabs_num * BPT_ARENA_SLAB_NODES){
+	if (arena->slabs_num == arena->slabs_size){
+	    arena->slabs_size = arena->slabs_size == 0 ?
+		16 : arena->slabs_size * 2;
+	    slabs = (bpt_node **) bpt_malloc(sizeof(bpt_node *) *
+					     arena->slabs_size);
+	    if (arena->slabs_num > 0)
+		memcpy(slabs, arena->slabs,
+		       sizeof(bpt_node *) * arena->slabs_num);
+	    free(arena->slabs);
+	    arena->slabs = slabs;
+	}
+	arena->slabs[arena->slabs_num++] =
+	    (bpt_node *) bpt_malloc_aligned(BPT_SLAB_ALIGN,
+					    sizeof(bpt_node) *
+					    BPT_ARENA_SLAB_NODES);
+    }
+
+    node = &arena->slabs[arena->used / BPT_ARENA_SLAB_NODES]
+	[arena->used % BPT_ARENA_SLAB_NODES];
+    arena->used++;
+
+    return node;
+}
+
+/*
+ * Drop one reference to the arena and free it with the last one. All
+ * the nodes must have been freed already.
+ */
+static void
+bpt_arena_release(bpt_node_arena *arena){
+    uintptr_t i;
+
+    if (arena == NULL || --arena->refs > 0)
+	return;
+
+    for (i = 0; i < arena->slabs_num; i++)
+	free(arena->slabs[i]);
+    free(arena->slabs);
+    free(arena);
+}
+
+/*
+ * Free the memory of one node, which goes back to the arena if the tree
+ * has one.
+ */
+static void
+bpt_dispose_node(bpt_tree *bpt, bpt_node *node){
+    if (bpt->arena == NULL){
+	free(node);
+	return;
+    }
+
+    node->next = bpt->arena->free_nodes;
+    bpt->arena->free_nodes = node;
+}
+
 static void
-bpt_free_node(bpt_node *node){
+bpt_free_node(bpt_tree *bpt, bpt_node *node){
     if (node != NULL){
+	bpt_count_node(bpt, node, false);
 	ll_destroy(node->keys);
 	ll_destroy(node->children);
+	free(node->abbrevs);
+	free(node->aggregate);
+	bpt->packed_bytes -= bpt_packed_footprint(bpt, node->packed);
+	free(node->packed);
+	if (node->page != NULL)
+	    bpt_retire(bpt, node->page);
 
 	printf("debug : free node = %p\n", node);
-	free(node);
+	bpt_dispose_node(bpt, node);
     }
 }
 
@@ -166,6 +606,20 @@ bpt_dump_children_keys(char *prefix, bpt_node *curr){
     ll_end_iter(curr->children);
 }
 
+/*
+ * Nullify all the members of the node.
+ */
+static void
+bpt_clear_node(bpt_node *node){
+    node->is_root = node->is_leaf = false;
+    node->keys = node->children = NULL;
+    node->parent = node->prev = node->next = NULL;
+    node->abbrevs = NULL;
+    node->packed = NULL;
+    node->page = NULL;
+    node->aggregate = NULL;
+}
+
 /*
  * Return empty and nullified node.
  *
@@ -175,10 +629,25 @@ bpt_node *
 bpt_gen_node(void){
     bpt_node *node;
 
-    node = (bpt_node *) bpt_malloc(sizeof(bpt_node));
-    node->is_root = node->is_leaf = false;
-    node->keys = node->children = NULL;
-    node->parent = node->prev = node->next = NULL;
+    node = (bpt_node *) bpt_malloc_aligned(BPT_CACHE_LINE_SIZE,
+					   sizeof(bpt_node));
+    bpt_clear_node(node);
+
+    return node;
+}
+
+/*
+ * Return empty and nullified node from the tree's arena if it has one.
+ */
+static bpt_node *
+bpt_alloc_node(bpt_tree *bpt){
+    bpt_node *node;
+
+    if (bpt->arena == NULL)
+	return bpt_gen_node();
+
+    node = bpt_arena_alloc(bpt->arena);
+    bpt_clear_node(node);
 
     return node;
 }
@@ -193,7 +662,7 @@ bpt_node *
 bpt_gen_root_callbacks_node(bpt_tree *bpt){
     bpt_node *n;
 
-    n = bpt_gen_node();
+    n = bpt_alloc_node(bpt);
 
     n->keys = ll_init(bpt->root->keys->key_access_cb,
 		      bpt->root->keys->key_compare_cb,
@@ -209,74 +678,676 @@ bpt_gen_root_callbacks_node(bpt_tree *bpt){
 }
 
 /*
- * Create a new bpt_tree * object.
+ * Space of one record in the leaf page.
  */
-bpt_tree *
-bpt_init(bpt_key_compare_cb keys_key_compare,
-	 bpt_free_cb keys_key_free,
-	 bpt_free_cb records_record_free,
-	 uint16_t max_keys,
-	 composite_key_store *keys_compare_metadata){
-    bpt_tree *tree;
+static uintptr_t
+bpt_page_record_space(bpt_tree *bpt, uintptr_t length){
+    if (length > bpt->inline_limit)
+	return sizeof(bpt_page_overflow);
 
-    if(max_keys < 2){
-	fprintf(stderr,
-		"the number of max keys should be larger than or equal to two\n");
-	return NULL;
-    }
+    return (length + BPT_PAGE_ALIGN - 1) & ~((uintptr_t) BPT_PAGE_ALIGN - 1);
+}
 
-    if (keys_key_compare == NULL){
-	fprintf(stderr,
-		"NULL 'keys_key_compare' callback is invalid\n");
-	return NULL;
+/*
+ * Store one record at 'offset' in the leaf page for the 'index'-th slot.
+ * Return what the leaf's children should point to, which is the copy in
+ * the page or the out-of-line record.
+ */
+static void *
+bpt_page_store(bpt_tree *bpt, void *page, int index, uintptr_t offset,
+	       void *record, uintptr_t length){
+    bpt_page_slot *slot = (bpt_page_slot *) ((bpt_page_header *) page + 1) +
+	index;
+    bpt_page_overflow *overflow;
+
+    slot->offset = offset;
+    if (length > bpt->inline_limit){
+	slot->length = BPT_PAGE_OVERFLOW;
+	overflow = (bpt_page_overflow *) ((char *) page + offset);
+	overflow->record = record;
+	overflow->length = length;
+	return record;
     }
 
-    tree = (bpt_tree *) bpt_malloc(sizeof(bpt_tree));
-    tree->max_keys = max_keys;
+    slot->length = length;
+    memcpy((char *) page + offset, record, length);
 
-    /*
-     * Set up the initial empty node with empty lists.
-     *
-     * Application must define 'keys_key_compare' and
-     * 'records_record_free'
-     */
-    tree->root = bpt_gen_node();
-    tree->root->is_root = tree->root->is_leaf = true;
-    tree->root->keys = ll_init(NULL,
-			       keys_key_compare,
-			       keys_key_free,
-			       (void *) keys_compare_metadata);
+    return (char *) page + offset;
+}
 
-    /*
-     * Manipulation of children like insert should be
-     * designed independently from application-defined
-     * keys callbacks.
-     *
-     * This idea allows insertion of a new record to omit
-     * unnecessary duplicate computation or comparison of
-     * key value in record.
-     *
-     * For instance, if after the insertion of a new key,
-     * it's necessary to extract key value from the sequence
-     * of record data again and compare it with other
-     * existing records, then the insertion leads to the key
-     * comparisons twice for the new key and for the record.
-     * This should be avoided.
-     *
-     * Therefore, any manipulation of children should depend
-     * on some basic APIs without key access and compare
-     * callbacks.
-     */
-    tree->root->children = ll_init(NULL, NULL,
-				   records_record_free, NULL);
+/*
+ * Lay out the records of one leaf in a new page and let the leaf's
+ * children point to the copies. The old page is retired, since the
+ * records being copied may be in it.
+ */
+static void
+bpt_page_rebuild(bpt_tree *bpt, bpt_node *leaf){
+    bpt_page_header *header;
+    uintptr_t length, offset, total = 0;
+    void *page, *record;
+    int i, records_num = CHILDREN_LEN(leaf);
+
+    assert(records_num <= bpt->max_keys + 1);
+
+    for (i = 0; i < records_num; i++)
+	total += bpt_page_record_space(bpt,
+				       bpt->record_length(ll_ref_index_data(leaf->children, i)));
+
+    page = bpt_malloc_aligned(BPT_CACHE_LINE_SIZE, bpt->page_size);
+    memset(page, 0, bpt->page_size);
+    header = (bpt_page_header *) page;
+    offset = bpt->page_size - total;
+    assert(sizeof(bpt_page_header) +
+	   sizeof(bpt_page_slot) * records_num <= offset);
+    header->slots_num = records_num;
+    header->heap_offset = offset;
+
+    /* Rotate the list so that each record is replaced in the key order */
+    for (i = 0; i < records_num; i++){
+	record = ll_remove_first_data(leaf->children);
+	length = bpt->record_length(record);
+	record = bpt_page_store(bpt, page, i, offset, record, length);
+	offset += bpt_page_record_space(bpt, length);
+	ll_tail_insert(leaf->children, record);
+    }
 
-    return tree;
+    if (leaf->page != NULL)
+	bpt_retire(bpt, leaf->page);
+    leaf->page = page;
 }
 
 /*
- * Return the right half node by ll_split().
+ * Apply one inserted or removed record of the leaf to its page in place.
+ * Return false when the children have changed otherwise, or the new
+ * record doesn't fit in the free space, to rebuild the page instead.
  *
- * ll_split() returns the *left* half, so swap the return value within
+ * The new record goes just below the heap, and the slots after it shift
+ * by one. A removed record is left in the heap as it is, so that it stays
+ * readable until the next update. Its space is reclaimed by the next
+ * rebuild.
+ */
+static bool
+bpt_page_update(bpt_tree *bpt, bpt_node *leaf){
+    void *page = leaf->page;
+    bpt_page_header *header = (bpt_page_header *) page;
+    bpt_page_slot *slots = (bpt_page_slot *) (header + 1);
+    uintptr_t length, space;
+    void *record;
+    int i, changed = -1, shift = CHILDREN_LEN(leaf) - header->slots_num;
+
+    if (shift < -1 || shift > 1)
+	return false;
+
+    /* Match the children with the slots, skipping the changed one */
+    ll_begin_iter(leaf->children);
+    for (i = 0; (record = ll_get_iter_data(leaf->children)) != NULL; i++){
+	if (changed < 0 && bpt_page_ref_record(page, i, NULL) == record)
+	    continue;
+	if (changed < 0 && shift != 0){
+	    changed = i;
+	    if (shift > 0)
+		continue;
+	}
+	if (changed < 0 ||
+	    bpt_page_ref_record(page, i - shift, NULL) != record){
+	    ll_end_iter(leaf->children);
+	    return false;
+	}
+    }
+    ll_end_iter(leaf->children);
+
+    if (shift == 0)
+	return true;
+
+    if (shift < 0){
+	/* The last slot is the removed one when all the others match */
+	if (changed < 0)
+	    changed = header->slots_num - 1;
+	memmove(&slots[changed], &slots[changed + 1],
+		sizeof(bpt_page_slot) * (header->slots_num - changed - 1));
+	header->slots_num--;
+	return true;
+    }
+
+    record = ll_ref_index_data(leaf->children, changed);
+    length = bpt->record_length(record);
+    space = bpt_page_record_space(bpt, length);
+    if (header->heap_offset < space ||
+	header->heap_offset - space < sizeof(bpt_page_header) +
+	sizeof(bpt_page_slot) * (header->slots_num + 1))
+	return false;
+
+    memmove(&slots[changed + 1], &slots[changed],
+	    sizeof(bpt_page_slot) * (header->slots_num - changed));
+    header->slots_num++;
+    header->heap_offset -= space;
+    record = bpt_page_store(bpt, page, changed, header->heap_offset,
+			    record, length);
+    (void) ll_index_remove(leaf->children, changed);
+    ll_index_insert(leaf->children, record, changed);
+
+    return true;
+}
+
+/*
+ * Number of the records in the array of one leaf, which is kept after
+ * the room for 'max_keys + 1' records. See bpt_set_record_size().
+ */
+static uint32_t
+bpt_fixed_records_num(bpt_tree *bpt, void *page){
+    uint32_t num;
+
+    memcpy(&num, (char *) page + bpt->record_size * (bpt->max_keys + 1),
+	   sizeof(uint32_t));
+
+    return num;
+}
+
+static void
+bpt_set_fixed_records_num(bpt_tree *bpt, void *page, uint32_t num){
+    memcpy((char *) page + bpt->record_size * (bpt->max_keys + 1), &num,
+	   sizeof(uint32_t));
+}
+
+/*
+ * Copy the fixed-size records of one leaf into a new array parallel to
+ * its keys. See bpt_set_record_size().
+ */
+static void
+bpt_page_rebuild_fixed(bpt_tree *bpt, bpt_node *leaf){
+    void *page, *record;
+    int i, records_num = CHILDREN_LEN(leaf);
+
+    assert(records_num <= bpt->max_keys + 1);
+
+    page = bpt_malloc_aligned(BPT_CACHE_LINE_SIZE, bpt->page_size);
+    for (i = 0; i < records_num; i++){
+	record = (char *) page + i * bpt->record_size;
+	memcpy(record, ll_remove_first_data(leaf->children), bpt->record_size);
+	ll_tail_insert(leaf->children, record);
+    }
+    bpt_set_fixed_records_num(bpt, page, records_num);
+
+    if (leaf->page != NULL)
+	bpt_retire(bpt, leaf->page);
+    leaf->page = page;
+}
+
+/*
+ * Apply the changes of the leaf's records to its array in place. Return
+ * false to rebuild the array instead.
+ *
+ * Dropping the last records moves nothing. One inserted record or one
+ * removed record in the middle shifts the records after it. The records
+ * taken by the sibling leaves are copied by their own refreshes, which
+ * may come after this one. So the array is rebuilt when the first record
+ * is removed, rather than shift the others over it. The dropped last
+ * records stay where they are.
+ */
+static bool
+bpt_page_update_fixed(bpt_tree *bpt, bpt_node *leaf){
+    node *np;
+    char *page = (char *) leaf->page, *record;
+    uintptr_t size = bpt->record_size;
+    int i, changed = -1, records_num = CHILDREN_LEN(leaf),
+	shift = records_num - (int) bpt_fixed_records_num(bpt, page);
+    bool inserted = false;
+
+    /* Match the children with the array, skipping the changed one */
+    for (np = leaf->children->head, i = 0; np != NULL; np = np->next, i++){
+	record = (char *) np->data;
+	if (changed < 0 && record == page + i * size)
+	    continue;
+	if (changed < 0 && shift >= -1 && shift <= 1 && shift != 0){
+	    changed = i;
+	    inserted = shift > 0;
+	    if (inserted)
+		continue;
+	}
+	if (changed < 0 || record != page + (i - shift) * size)
+	    return false;
+    }
+
+    if (changed < 0){
+	/* An inserted record must be in the children */
+	if (shift > 0)
+	    return false;
+    }else if (!inserted){
+	if (changed == 0)
+	    return false;
+	memmove(page + changed * size, page + (changed + 1) * size,
+		(records_num - changed) * size);
+    }else{
+	record = (char *) ll_ref_index_data(leaf->children, changed);
+	if (record >= page && record < page + bpt->page_size)
+	    return false;
+	memmove(page + (changed + 1) * size, page + changed * size,
+		(records_num - changed - 1) * size);
+	memcpy(page + changed * size, record, size);
+    }
+    bpt_set_fixed_records_num(bpt, page, records_num);
+
+    /* Let the children from the changed one point to their new places */
+    if (changed >= 0)
+	for (np = leaf->children->head, i = 0; np != NULL;
+	     np = np->next, i++)
+	    if (i >= changed)
+		np->data = page + i * size;
+
+    return true;
+}
+
+/*
+ * Return the record just removed from a leaf, which is readable until the
+ * next update. An inline record is copied out of the leaf's array, which
+ * is shifted over the original in place.
+ */
+static void *
+bpt_keep_removed_record(bpt_tree *bpt, void *record){
+    void *copy;
+
+    if (bpt->record_size == 0)
+	return record;
+
+    copy = bpt_malloc(bpt->record_size);
+    memcpy(copy, record, bpt->record_size);
+    bpt_retire(bpt, copy);
+
+    return copy;
+}
+
+/*
+ * Pack the keys of one leaf as the deltas from its first key in the
+ * narrowest width. See bpt_set_key_packing().
+ */
+static void
+bpt_pack_leaf_keys(bpt_tree *bpt, bpt_node *leaf){
+    bpt_packed_keys *packed = leaf->packed;
+    void *deltas, *key, *metadata = leaf->keys->keys_compare_metadata;
+    uint64_t base = 0, range = 0, delta;
+    int i, keys_num = KEY_LEN(leaf);
+    uint8_t width;
+
+    if (keys_num > 0){
+	base = bpt->key_integer(ll_ref_index_data(leaf->keys, 0), metadata);
+	range = bpt->key_integer(ll_ref_index_data(leaf->keys, keys_num - 1),
+				 metadata) - base;
+    }
+    width = range <= UINT8_MAX ? 1 :
+	range <= UINT16_MAX ? 2 : range <= UINT32_MAX ? 4 : 8;
+
+    if (packed == NULL || packed->capacity < width){
+	bpt->packed_bytes -= bpt_packed_footprint(bpt, packed);
+	free(packed);
+	packed = (bpt_packed_keys *)
+	    bpt_malloc_aligned(BPT_CACHE_LINE_SIZE,
+			       sizeof(bpt_packed_keys) +
+			       width * (bpt->max_keys + 1));
+	packed->capacity = width;
+	leaf->packed = packed;
+	bpt->packed_bytes += bpt_packed_footprint(bpt, packed);
+    }
+    packed->base = base;
+    packed->keys_num = keys_num;
+    packed->width = width;
+    deltas = packed + 1;
+
+    ll_begin_iter(leaf->keys);
+    for (i = 0; (key = ITER_BPT_KEY(leaf)) != NULL; i++){
+	delta = bpt->key_integer(key, metadata) - base;
+	switch(width){
+	    case 1:
+		((uint8_t *) deltas)[i] = delta;
+		break;
+	    case 2:
+		((uint16_t *) deltas)[i] = delta;
+		break;
+	    case 4:
+		((uint32_t *) deltas)[i] = delta;
+		break;
+	    default:
+		((uint64_t *) deltas)[i] = delta;
+		break;
+	}
+    }
+    ll_end_iter(leaf->keys);
+}
+
+/*
+ * Return the index of 'key' in the packed keys of the leaf, or -1.
+ */
+static int
+bpt_search_packed_keys(bpt_tree *bpt, bpt_node *leaf, void *key){
+    bpt_packed_keys *packed = leaf->packed;
+    uint64_t target, delta;
+    int index;
+
+    target = bpt->key_integer(key, leaf->keys->keys_compare_metadata);
+    if (packed->keys_num == 0 || target < packed->base)
+	return -1;
+
+    delta = target - packed->base;
+    if (packed->width < 8 && (delta >> (packed->width * 8)) != 0)
+	return -1;
+
+    switch(packed->width){
+	case 1:
+	    BPT_SEARCH_DELTAS(uint8_t, packed + 1, packed->keys_num, delta,
+			      index);
+	    break;
+	case 2:
+	    BPT_SEARCH_DELTAS(uint16_t, packed + 1, packed->keys_num, delta,
+			      index);
+	    break;
+	case 4:
+	    BPT_SEARCH_DELTAS(uint32_t, packed + 1, packed->keys_num, delta,
+			      index);
+	    break;
+	default:
+	    BPT_SEARCH_DELTAS(uint64_t, packed + 1, packed->keys_num, delta,
+			      index);
+	    break;
+    }
+
+    return index;
+}
+
+/*
+ * Drop the cached abbreviations of the keys which are no longer at their
+ * indexes in the node, so that every cached key is still in the node.
+ * Then a key leaving the tree can be cached only where it is now.
+ */
+static void
+bpt_sync_abbrev_cache(bpt_node *curr){
+    bpt_abbrev_cache *cache = curr->abbrevs;
+    void *key, *first = NULL, *last = NULL;
+    uintptr_t i = 0;
+
+    ll_begin_iter(curr->keys);
+    while((key = ITER_BPT_KEY(curr)) != NULL){
+	if (i < cache->capacity && cache->keys[i] != key)
+	    cache->keys[i] = NULL;
+	if (i++ == 0)
+	    first = key;
+	last = key;
+    }
+    ll_end_iter(curr->keys);
+
+    for (; i < cache->capacity; i++)
+	cache->keys[i] = NULL;
+
+    if (cache->first != first || cache->last != last)
+	cache->first = cache->last = NULL;
+}
+
+/*
+ * Recompute what is derived from the entries of one node : the page and
+ * the packed keys of a leaf, and the aggregate of its records or its
+ * children's cached aggregates. No-op without leaf pages, key packing
+ * and aggregate callbacks.
+ *
+ * The children's aggregates must be up to date already.
+ */
+static void
+bpt_refresh_node(bpt_tree *bpt, bpt_node *curr){
+    bpt_node *child;
+    void *record;
+
+    if (curr->abbrevs != NULL)
+	bpt_sync_abbrev_cache(curr);
+
+    if (bpt->agg_combine == NULL &&
+	(!curr->is_leaf || (bpt->key_integer == NULL && bpt->page_size == 0)))
+	return;
+
+    if (curr->is_leaf && bpt->key_integer != NULL)
+	bpt_pack_leaf_keys(bpt, curr);
+
+    if (curr->is_leaf && bpt->record_size > 0){
+	if (curr->page == NULL || !bpt_page_update_fixed(bpt, curr))
+	    bpt_page_rebuild_fixed(bpt, curr);
+    }else if (curr->is_leaf && bpt->page_size > 0){
+	if (curr->page == NULL || !bpt_page_update(bpt, curr))
+	    bpt_page_rebuild(bpt, curr);
+    }
+
+    if (bpt->agg_combine == NULL)
+	return;
+
+    if (curr->aggregate == NULL)
+	curr->aggregate = bpt_malloc(bpt->aggregate_size);
+
+    bpt->agg_identity(curr->aggregate);
+
+    ll_begin_iter(curr->children);
+    if (curr->is_leaf){
+	while((record = ll_get_iter_data(curr->children)) != NULL)
+	    bpt->agg_record(curr->aggregate, record);
+    }else{
+	while((child = ITER_BPT_CHILD(curr)) != NULL)
+	    bpt->agg_combine(curr->aggregate, child->aggregate);
+    }
+    ll_end_iter(curr->children);
+}
+
+/*
+ * Recompute the leaf's derived state and the aggregates from one node up
+ * to the root.
+ */
+static void
+bpt_refresh_upward(bpt_tree *bpt, bpt_node *curr){
+    if (bpt->agg_combine == NULL && bpt->page_size == 0 &&
+	bpt->key_integer == NULL)
+	return;
+
+    for (; curr != NULL; curr = curr->parent)
+	bpt_refresh_node(bpt, curr);
+}
+
+/*
+ * Recompute the aggregates of the whole subtree bottom-up.
+ */
+static void
+bpt_refresh_subtree(bpt_tree *bpt, bpt_node *curr){
+    bpt_node *child;
+
+    if (!curr->is_leaf){
+	ll_begin_iter(curr->children);
+	while((child = ITER_BPT_CHILD(curr)) != NULL)
+	    bpt_refresh_subtree(bpt, child);
+	ll_end_iter(curr->children);
+    }
+
+    bpt_refresh_node(bpt, curr);
+}
+
+/*
+ * Create a new bpt_tree * object.
+ *
+ * When 'keys_key_compare' is NULL, the composite keys described by
+ * 'keys_compare_metadata' are compared by bkh_composite_key_compare().
+ */
+bpt_tree *
+bpt_init(bpt_key_compare_cb keys_key_compare,
+	 bpt_free_cb keys_key_free,
+	 bpt_free_cb records_record_free,
+	 uint16_t max_keys,
+	 composite_key_store *keys_compare_metadata){
+    bpt_tree *tree;
+
+    if(max_keys < 2){
+	fprintf(stderr,
+		"the number of max keys should be larger than or equal to two\n");
+	return NULL;
+    }
+
+    if (keys_key_compare == NULL){
+	if (keys_compare_metadata == NULL){
+	    fprintf(stderr,
+		    "NULL 'keys_key_compare' callback requires composite key metadata\n");
+	    return NULL;
+	}
+	if (!bkh_prepare_compare(keys_compare_metadata))
+	    return NULL;
+	keys_key_compare = bkh_composite_key_compare;
+    }
+
+    tree = (bpt_tree *) bpt_malloc(sizeof(bpt_tree));
+    tree->max_keys = max_keys;
+
+    /* Eager deletion by default. See bpt_set_lazy_delete() */
+    tree->lazy_delete = false;
+    tree->lazy_pending = 0;
+    tree->compact_key = NULL;
+    tree->fill_key = NULL;
+
+    /* One empty leaf root. See bpt_stats() */
+    tree->key_count = 0;
+    tree->leaf_count = 1;
+    tree->internal_count = 0;
+    tree->packed_bytes = 0;
+    tree->counts_stale = false;
+
+    tree->counters = bpt_gen_counters();
+    tree->latency = bpt_gen_latency();
+
+    /* No aggregate until bpt_set_aggregate() */
+    tree->aggregate_size = 0;
+    tree->agg_identity = NULL;
+    tree->agg_record = NULL;
+    tree->agg_combine = NULL;
+
+    /*
+     * The built-in comparison of memcmp() comparable composite keys
+     * abbreviates the keys by their bytes after the common prefix
+     */
+    tree->key_abbrev = NULL;
+    tree->key_prefix = NULL;
+    if (keys_key_compare == bkh_composite_key_compare &&
+	bkh_is_ordered_store(keys_compare_metadata)){
+	tree->key_abbrev = bkh_ordered_key_abbrev;
+	tree->key_prefix = bkh_ordered_key_prefix;
+    }
+    bpt_renew_abbrev_epoch(tree);
+
+    /* No key packing until bpt_set_key_packing() */
+    tree->key_integer = NULL;
+
+    tree->scan_prefetch = BPT_SCAN_PREFETCH_DEFAULT;
+
+    /* No suffix truncation until bpt_set_key_separator() */
+    tree->key_separator = NULL;
+    tree->separator_free = NULL;
+    tree->separators = NULL;
+
+    /* Records stay where the application put them until bpt_set_leaf_pages() */
+    tree->page_size = tree->inline_limit = tree->record_size = 0;
+    tree->record_length = NULL;
+    tree->retired = NULL;
+    tree->retired_num = tree->retired_size = 0;
+
+    /* Nodes are allocated one by one until bpt_set_node_arena() */
+    tree->arena = NULL;
+
+    /*
+     * Set up the initial empty node with empty lists.
+     *
+     * Application must define 'keys_key_compare' and
+     * 'records_record_free'
+     */
+    tree->root = bpt_gen_node();
+    tree->root->is_root = tree->root->is_leaf = true;
+    tree->root->keys = ll_init(NULL,
+			       keys_key_compare,
+			       keys_key_free,
+			       (void *) keys_compare_metadata);
+
+    /*
+     * Manipulation of children like insert should be
+     * designed independently from application-defined
+     * keys callbacks.
+     *
+     * This idea allows insertion of a new record to omit
+     * unnecessary duplicate computation or comparison of
+     * key value in record.
+     *
+     * For instance, if after the insertion of a new key,
+     * it's necessary to extract key value from the sequence
+     * of record data again and compare it with other
+     * existing records, then the insertion leads to the key
+     * comparisons twice for the new key and for the record.
+     * This should be avoided.
+     *
+     * Therefore, any manipulation of children should depend
+     * on some basic APIs without key access and compare
+     * callbacks.
+     */
+    tree->root->children = ll_init(NULL, NULL,
+				   records_record_free, NULL);
+
+    return tree;
+}
+
+/*
+ * Return the largest max_keys whose full node fits in 'node_size' bytes,
+ * or zero if not even two keys fit.
+ *
+ * A full node of 'm' keys is the bpt_node, its two lists, the list
+ * entries of 'm' keys and 'm + 1' children, and the 'm' keys of
+ * 'key_size' bytes each, which the search reads through the entries.
+ * The records, the abbreviations and the packed keys aren't counted.
+ *
+ * The result is an estimate. The lists, their entries and the keys are
+ * separate allocations, so malloc() adds its own overhead to each of
+ * them, and they aren't next to each other in memory.
+ */
+uint16_t
+bpt_max_keys_for_node_size(uintptr_t node_size, uintptr_t key_size){
+    uintptr_t fixed, per_key, max_keys;
+
+    fixed = sizeof(bpt_node) + 2 * sizeof(linked_list) + sizeof(node);
+    per_key = 2 * sizeof(node) + key_size;
+
+    max_keys = node_size > fixed ? (node_size - fixed) / per_key : 0;
+    if (max_keys < 2){
+	fprintf(stderr,
+		"node size %lu is too small for two keys of %lu bytes\n",
+		(unsigned long) node_size, (unsigned long) key_size);
+	return 0;
+    }
+
+    return max_keys > UINT16_MAX ? UINT16_MAX : max_keys;
+}
+
+/*
+ * Create a new bpt_tree * object whose nodes fit in 'node_size' bytes,
+ * such as a few cache lines or one page, instead of a given max_keys. See
+ * bpt_max_keys_for_node_size().
+ *
+ * 'key_size' zero means the full key size of 'keys_compare_metadata'.
+ */
+bpt_tree *
+bpt_init_by_node_size(bpt_key_compare_cb keys_key_compare,
+		      bpt_free_cb keys_key_free,
+		      bpt_free_cb records_record_free,
+		      uintptr_t node_size, uintptr_t key_size,
+		      composite_key_store *keys_compare_metadata){
+    uint16_t max_keys;
+
+    if (key_size == 0 && keys_compare_metadata != NULL)
+	key_size = keys_compare_metadata->full_key_size;
+
+    if ((max_keys = bpt_max_keys_for_node_size(node_size, key_size)) == 0)
+	return NULL;
+
+    return bpt_init(keys_key_compare, keys_key_free, records_record_free,
+		    max_keys, keys_compare_metadata);
+}
+
+/*
+ * Return the right half node by ll_split().
+ *
+ * ll_split() returns the *left* half, so swap the return value within
  * this function.
  *
  * This is required to connect the split nodes with other existing nodes
@@ -296,7 +1367,8 @@ bpt_node_split(bpt_tree *bpt, bpt_node *curr){
     assert(bpt->max_keys + 1 == KEY_LEN(curr));
 
     /* Create an empty node with null keys and children */
-    half = bpt_gen_node();
+    half = bpt_alloc_node(bpt);
+    BPT_COUNT(bpt, splits, 1);
 
     /* Move the internal data of node */
     half->keys = ll_split(curr->keys, node_num);
@@ -319,6 +1391,7 @@ bpt_node_split(bpt_tree *bpt, bpt_node *curr){
     half->is_root = curr->is_root;
     half->is_leaf = curr->is_leaf;
     half->parent = curr->parent;
+    bpt_count_node(bpt, half, true);
 
     /*
      * Swap the two nodes to return the right half. At this moment, the 'half'
@@ -336,24 +1409,224 @@ bpt_node_split(bpt_tree *bpt, bpt_node *curr){
     return half;
 }
 
+static int
+bpt_address_compare(const void *p1, const void *p2){
+    uintptr_t a1 = (uintptr_t) *(void * const *) p1,
+	a2 = (uintptr_t) *(void * const *) p2;
+
+    return a1 < a2 ? -1 : (a1 == a2 ? 0 : 1);
+}
+
 /*
- * Insert a new pair of key and data, propagating keys towards
- * the top of tree recursively, when required.
- *
- * The first 'new_key' is a key user indicated. Meanwhile, recursive
- * call sets it to 'copied_up_key', since it needs to propagate one
- * of keys, from the leaf to upper nodes.
- *
- * The 'new_child' is the pointer of newly genereated child by split,
- * which points to the node which has the 'copied_up_key'. Similarly,
- * 'new_child_index' is the index where 'new_child' should be inserted.
- * Those two parameters are set by recursive call only.
- *
- * Note that on the leaf nodes, the new key-value pair is inserted
- * at aligned index position.
+ * Mark the separators which are found in the internal nodes of the tree.
+ * 'separators' must be sorted by address.
  */
 static void
-bpt_insert_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
+bpt_mark_separators(bpt_tree *bpt, void **separators, uintptr_t num,
+		    bool *live){
+    bpt_node *leftmost, *curr;
+    void *key, **found;
+
+    for (leftmost = bpt->root; leftmost != NULL && !leftmost->is_leaf;
+	 leftmost = bpt_ref_index_child(leftmost, 0)){
+	for (curr = leftmost; curr != NULL; curr = curr->next){
+	    ll_begin_iter(curr->keys);
+	    while((key = ITER_BPT_KEY(curr)) != NULL){
+		found = bsearch(&key, separators, num, sizeof(void *),
+				bpt_address_compare);
+		if (found != NULL)
+		    live[found - separators] = true;
+	    }
+	    ll_end_iter(curr->keys);
+	}
+    }
+}
+
+static void
+bpt_free_separator(bpt_tree *bpt, void *separator){
+    if (bpt->separator_free != NULL)
+	bpt->separator_free(separator);
+    else
+	free(separator);
+}
+
+/*
+ * Free the registered separators which are no longer in the internal
+ * nodes of any tree sharing the registry. They are left behind by merge,
+ * borrow, delete or compaction, which replace the separators with the
+ * minimum keys of the leaves.
+ */
+static void
+bpt_collect_separators(bpt_tree *bpt){
+    bpt_separator_registry *registry = bpt->separators;
+    bool *live, freed = false;
+    uintptr_t i, kept = 0, num;
+
+    if (registry == NULL || registry->separators_num == 0)
+	return;
+
+    num = registry->separators_num;
+    qsort(registry->separators, num, sizeof(void *), bpt_address_compare);
+
+    live = (bool *) bpt_malloc(sizeof(bool) * num);
+    memset(live, 0, sizeof(bool) * num);
+    for (i = 0; i < registry->trees_num; i++)
+	bpt_mark_separators(registry->trees[i], registry->separators,
+			    num, live);
+
+    for (i = 0; i < num; i++){
+	if (live[i])
+	    registry->separators[kept++] = registry->separators[i];
+	else{
+	    bpt_free_separator(bpt, registry->separators[i]);
+	    freed = true;
+	}
+    }
+    registry->separators_num = kept;
+
+    free(live);
+
+    /* The freed addresses can come back as new keys of any tree */
+    if (freed)
+	for (i = 0; i < registry->trees_num; i++)
+	    bpt_renew_abbrev_epoch(registry->trees[i]);
+}
+
+/*
+ * Return true if any registered separator is in the internal nodes of
+ * the tree.
+ */
+static bool
+bpt_uses_separators(bpt_tree *bpt){
+    bpt_separator_registry *registry = bpt->separators;
+    bool *live, used = false;
+    uintptr_t i, num;
+
+    if (registry == NULL || registry->separators_num == 0)
+	return false;
+
+    num = registry->separators_num;
+    qsort(registry->separators, num, sizeof(void *), bpt_address_compare);
+
+    live = (bool *) bpt_malloc(sizeof(bool) * num);
+    memset(live, 0, sizeof(bool) * num);
+    bpt_mark_separators(bpt, registry->separators, num, live);
+    for (i = 0; i < num && !used; i++)
+	used = live[i];
+    free(live);
+
+    return used;
+}
+
+/*
+ * Add one tree to the trees sharing the registry.
+ */
+static void
+bpt_join_separators(bpt_tree *bpt, bpt_separator_registry *registry){
+    bpt->separators = registry;
+    bpt_push_pointer((void ***) &registry->trees, &registry->trees_num,
+		     &registry->trees_size, bpt);
+}
+
+/*
+ * Remove the tree from the trees sharing its registry. The last one
+ * frees the registry with all the separators left in it.
+ */
+static void
+bpt_leave_separators(bpt_tree *bpt){
+    bpt_separator_registry *registry = bpt->separators;
+    uintptr_t i;
+
+    if (registry == NULL)
+	return;
+
+    bpt->separators = NULL;
+    for (i = 0; registry->trees[i] != bpt; i++)
+	;
+    registry->trees[i] = registry->trees[--registry->trees_num];
+    if (registry->trees_num > 0)
+	return;
+
+    for (i = 0; i < registry->separators_num; i++)
+	bpt_free_separator(bpt, registry->separators[i]);
+    free(registry->separators);
+    free(registry->trees);
+    free(registry);
+}
+
+/*
+ * Record one separator the tree has made.
+ *
+ * The internal nodes hold 'leaf_count - 1' keys at most. Collect the
+ * unused ones before the array grows beyond twice of the leaves of all
+ * the trees sharing it, so that the cost of collection is amortized over
+ * the splits.
+ */
+static void
+bpt_own_separator(bpt_tree *bpt, void *separator){
+    bpt_separator_registry *registry = bpt->separators;
+    uintptr_t i, leaf_count = 0;
+
+    if (registry == NULL){
+	registry = (bpt_separator_registry *)
+	    bpt_malloc(sizeof(bpt_separator_registry));
+	memset(registry, 0, sizeof(bpt_separator_registry));
+	bpt_join_separators(bpt, registry);
+    }
+
+    if (registry->separators_num == registry->separators_size){
+	for (i = 0; i < registry->trees_num; i++){
+	    bpt_settle_counts(registry->trees[i]);
+	    leaf_count += registry->trees[i]->leaf_count;
+	}
+	if (registry->separators_num >= 2 * leaf_count + 16)
+	    bpt_collect_separators(bpt);
+    }
+
+    bpt_push_pointer(&registry->separators, &registry->separators_num,
+		     &registry->separators_size, separator);
+}
+
+/*
+ * Return the separator to push up from the split leaves. It's the
+ * first key of the right leaf, or a shorter key made by 'key_separator'.
+ */
+static void *
+bpt_make_separator(bpt_tree *bpt, bpt_node *left, bpt_node *right){
+    linked_list *keys = left->keys;
+    void *separator, *right_min = ll_ref_index_data(right->keys, 0);
+
+    if (bpt->key_separator == NULL)
+	return right_min;
+
+    separator = bpt->key_separator(ll_ref_index_data(keys, KEY_LEN(left) - 1),
+				   right_min, keys->keys_compare_metadata);
+    if (separator == NULL)
+	return right_min;
+
+    bpt_own_separator(bpt, separator);
+
+    return separator;
+}
+
+/*
+ * Insert a new pair of key and data, propagating keys towards
+ * the top of tree recursively, when required.
+ *
+ * The first 'new_key' is a key user indicated. Meanwhile, recursive
+ * call sets it to 'copied_up_key', since it needs to propagate one
+ * of keys, from the leaf to upper nodes.
+ *
+ * The 'new_child' is the pointer of newly genereated child by split,
+ * which points to the node which has the 'copied_up_key'. Similarly,
+ * 'new_child_index' is the index where 'new_child' should be inserted.
+ * Those two parameters are set by recursive call only.
+ *
+ * Note that on the leaf nodes, the new key-value pair is inserted
+ * at aligned index position.
+ */
+static void
+bpt_insert_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
 		    void *new_value, int new_child_index, void *new_child){
     assert(bpt != NULL);
     assert(curr != NULL);
@@ -368,11 +1641,16 @@ bpt_insert_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
     /* Does this node have room to store a new key ? */
     if (KEY_LEN(curr) < bpt->max_keys){
 	if (curr->is_leaf){
-	    /* Store the pair of key and record */
+	    int key_idx;
+
+	    /*
+	     * Store the pair of key and record. The record must be placed
+	     * at the same index as the key, not at the tail.
+	     */
 	    printf("debug : add key = %lu to node (%p)\n",
 		   (uintptr_t) new_key, curr);
-	    ll_asc_insert(curr->keys, new_key);
-	    ll_tail_insert(curr->children, new_value);
+	    key_idx = ll_asc_insert(curr->keys, new_key);
+	    ll_index_insert(curr->children, new_value, key_idx);
 
 	    /* Verify the node property */
 	    bpt_node_validity(curr);
@@ -386,6 +1664,9 @@ bpt_insert_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
 	    /* Verify the node property */
 	    bpt_node_validity(curr);
 	}
+
+	/* No more split. Update the aggregates up to the root */
+	bpt_refresh_upward(bpt, curr);
     }else{
 	/*
 	 * We have the maximum number of children in this node already. So,
@@ -418,8 +1699,14 @@ bpt_insert_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
 	bpt_dump_list("dump info about the split right node",
 		      right_half->keys);
 
-	/* Get the key that will go up and/or will be deleted */
-	copied_up_key = ll_ref_index_data(right_half->keys, 0);
+	/*
+	 * Get the key that will go up and/or will be deleted. The split
+	 * leaves can push up a shorter separator
+	 */
+	if (curr->is_leaf)
+	    copied_up_key = bpt_make_separator(bpt, curr, right_half);
+	else
+	    copied_up_key = ll_ref_index_data(right_half->keys, 0);
 
 	/*
 	 * Connect split nodes at the same depth. When there is other node
@@ -454,6 +1741,10 @@ bpt_insert_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
 				   right_half);
 	}
 
+	/* Both halves have their final children now */
+	bpt_refresh_node(bpt, curr);
+	bpt_refresh_node(bpt, right_half);
+
 	if (!curr->parent){
 	    /* Create a new root */
 	    bpt_node *new_top;
@@ -465,6 +1756,8 @@ bpt_insert_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
 	    new_top = bpt_gen_root_callbacks_node(bpt);
 	    new_top->is_root = true;
 	    new_top->is_leaf = curr->is_root = right_half->is_root = false;
+	    bpt_count_node(bpt, new_top, true);
+	    BPT_COUNT(bpt, root_splits, 1);
 	    curr->parent = right_half->parent = bpt->root = new_top;
 
 	    ll_asc_insert(new_top->keys, copied_up_key);
@@ -477,6 +1770,8 @@ bpt_insert_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
 
 	    /* Verify the node property */
 	    bpt_node_validity(new_top);
+
+	    bpt_refresh_node(bpt, new_top);
 	}else{
 	    /*
 	     * Propagate the key insertion to the upper node. Notify the
@@ -510,14 +1805,34 @@ bool
 bpt_insert(bpt_tree *bpt, void *new_key, void *new_data){
     bpt_node *leaf_node;
     bool found_same_key = false;
+    uintptr_t length;
+    void *copy;
+    BPT_TIMESTAMP(start);
+
+    bpt_release_retired(bpt);
 
-    found_same_key = bpt_search(bpt, new_key, &leaf_node, NULL);
+    found_same_key = bpt_lookup(bpt, new_key, &leaf_node, NULL);
+    BPT_TIMESTAMP(searched);
 
     /* Prohibit duplicate keys */
-    if (found_same_key)
+    if (found_same_key){
+	BPT_RECORD_LATENCY(bpt, BPT_OP_INSERT, start, searched, searched,
+			   false);
 	return false;
-    else{
+    }else{
+	/* A record too long for the leaf page goes out of line as a copy */
+	if (bpt->record_length != NULL &&
+	    (length = bpt->record_length(new_data)) > bpt->inline_limit){
+	    copy = bpt_malloc(length);
+	    memcpy(copy, new_data, length);
+	    new_data = copy;
+	}
+
 	bpt_insert_internal(bpt, leaf_node, new_key, new_data, 0, NULL);
+	bpt->key_count++;
+
+	BPT_TIMESTAMP(done);
+	BPT_RECORD_LATENCY(bpt, BPT_OP_INSERT, start, searched, done, true);
 
 	return true;
     }
@@ -560,18 +1875,133 @@ bpt_get_key_value_from_leaf(bpt_node *leaf, bool exec_delete, void *search_key){
     return record;
 }
 
+/*
+ * Return the abbreviation cache of the node for the key search and set
+ * the abbreviation of 'new_key' to 'new_prefix'. Return NULL if the tree
+ * doesn't abbreviate keys.
+ *
+ * Cached abbreviations of an old epoch or of an old common prefix are
+ * dropped here. The common prefix is recomputed only when the first or
+ * the last key of the node has changed by insert, delete, split, merge
+ * or borrow.
+ */
+static bpt_abbrev_cache *
+bpt_ref_abbrev_cache(bpt_tree *bpt, bpt_node *curr, void *new_key,
+		     uint64_t *new_prefix){
+    linked_list *keys = curr->keys;
+    bpt_abbrev_cache *cache;
+    void *first, *last;
+    uintptr_t offset, capacity;
+
+    if (bpt->key_abbrev == NULL)
+	return NULL;
+
+    if ((cache = curr->abbrevs) == NULL){
+	capacity = GET_MAX_CHILDREN_NUM(bpt->max_keys);
+	cache = (bpt_abbrev_cache *)
+	    bpt_malloc_aligned(BPT_CACHE_LINE_SIZE,
+			       sizeof(bpt_abbrev_cache) +
+			       (sizeof(uint64_t) + sizeof(void *)) * capacity);
+	cache->capacity = capacity;
+	cache->prefixes = (uint64_t *) (cache + 1);
+	cache->keys = (void **) (cache->prefixes + capacity);
+	cache->epoch = bpt->abbrev_epoch - 1;
+	curr->abbrevs = cache;
+    }
+
+    if (cache->epoch != bpt->abbrev_epoch){
+	memset(cache->keys, 0, sizeof(void *) * cache->capacity);
+	cache->first = cache->last = NULL;
+	cache->offset = 0;
+	cache->epoch = bpt->abbrev_epoch;
+    }
+
+    if (bpt->key_prefix != NULL){
+	first = ll_ref_index_data(keys, 0);
+	last = ll_ref_index_data(keys, KEY_LEN(curr) - 1);
+
+	if (cache->first != first || cache->last != last){
+	    offset = bpt->key_prefix(first, last, keys->keys_compare_metadata);
+	    if (cache->offset != offset){
+		memset(cache->keys, 0, sizeof(void *) * cache->capacity);
+		cache->offset = offset;
+	    }
+	    cache->first = first;
+	    cache->last = last;
+	}
+
+	/*
+	 * A key of other prefix is smaller or larger than all the keys.
+	 * Give it the smallest or the largest abbreviation
+	 */
+	if (cache->offset > 0 &&
+	    bpt->key_prefix(first, new_key,
+			    keys->keys_compare_metadata) < cache->offset){
+	    if (keys->key_compare_cb(first, new_key,
+				     keys->keys_compare_metadata) == 1)
+		*new_prefix = 0;
+	    else
+		*new_prefix = UINT64_MAX;
+
+	    return cache;
+	}
+    }
+
+    *new_prefix = bpt->key_abbrev(new_key, cache->offset,
+				  keys->keys_compare_metadata);
+
+    return cache;
+}
+
+/*
+ * Compare the abbreviation of the index-th key of the node with the one
+ * of the search key. The cached abbreviation is used as long as the key
+ * at the index is the same pointer. Return 0 when the full comparison is
+ * required.
+ */
+static int
+bpt_abbrev_compare(bpt_tree *bpt, bpt_abbrev_cache *cache, int index,
+		   void *key, uint64_t new_prefix, void *key_metadata){
+    uint64_t prefix;
+
+    if (index >= cache->capacity)
+	return 0;
+
+    if (cache->keys[index] != key){
+	cache->keys[index] = key;
+	cache->prefixes[index] = bpt->key_abbrev(key, cache->offset,
+						 key_metadata);
+    }
+
+    prefix = cache->prefixes[index];
+
+    if (prefix < new_prefix)
+	return -1;
+    else if (prefix > new_prefix)
+	return 1;
+    else
+	return 0;
+}
+
 /*
  * The main internal processing of B+ tree search.
  */
 static bool
-bpt_search_internal(bpt_node *curr, void *new_key, bpt_node **leaf_node,
-		    void **record){
+bpt_search_internal(bpt_tree *bpt, bpt_node *curr, void *new_key,
+		    bpt_node **leaf_node, void **record){
     linked_list *keys;
-    int diff, children_index;
+    bpt_abbrev_cache *cache;
+    void *child = NULL;
+    uint64_t new_prefix = 0;
+    void *key;
+    int diff = -1, children_index;
+    bool walk_children;
 
     printf("debug : bpt_search() for key = %lu in node '%p'\n",
 	   (uintptr_t) new_key, curr);
 
+    BPT_COUNT(bpt, nodes_visited, 1);
+
     /* Set the last searched node first. This call can be last */
     if (leaf_node != NULL)
 	*leaf_node = curr;
@@ -593,20 +2023,76 @@ bpt_search_internal(bpt_node *curr, void *new_key, bpt_node **leaf_node,
      * This is an empty node. This code path gets hit when one tries to
      * search tree's root with no data. Need to address since any initial
      * insert depends on the search of the root without data.
+     *
+     * In the relaxed deletion mode, an internal node can be left with one
+     * child and no key until the compaction. Just go down to the child.
      */
-    if (KEY_LEN(curr) == 0)
-	return false;
+    if (KEY_LEN(curr) == 0){
+	if (curr->is_leaf)
+	    return false;
+	else
+	    return bpt_search_internal(bpt, bpt_ref_index_child(curr, 0),
+				       new_key, leaf_node, record);
+    }
+
+    /* The packed keys of a leaf locate the key without the comparisons */
+    if (curr->is_leaf && curr->packed != NULL){
+	children_index = bpt_search_packed_keys(bpt, curr, new_key);
+	if (children_index < 0)
+	    return false;
+
+	if (record != NULL)
+	    *record = ll_ref_index_data(curr->children, children_index);
+
+	return true;
+    }
+
+    /*
+     * With the key abbreviation, most keys are decided by the cached
+     * abbreviations without touching the keys. Only the ties go to the
+     * comparison callback.
+     */
+    cache = bpt_ref_abbrev_cache(bpt, curr, new_key, &new_prefix);
+
+    /*
+     * Walk the children along the keys, so that the child to go down is
+     * known without another walk, and prefetch each candidate child while
+     * its key is compared. A leaf walks its records only for the caller
+     * who wants one.
+     */
+    walk_children = !curr->is_leaf || record != NULL;
+    if (walk_children)
+	ll_begin_iter(curr->children);
 
     ll_begin_iter(keys);
     for (children_index = 0; children_index < KEY_LEN(curr); children_index++){
-	diff = keys->key_compare_cb(ll_get_iter_data(keys),
-				    new_key,
-				    keys->keys_compare_metadata);
+	key = ll_get_iter_data(keys);
+	if (walk_children){
+	    child = ll_get_iter_data(curr->children);
+	    if (!curr->is_leaf)
+		BPT_PREFETCH(child);
+	}
+	diff = 0;
+	if (cache != NULL)
+	    diff = bpt_abbrev_compare(bpt, cache, children_index, key,
+				      new_prefix, keys->keys_compare_metadata);
+	if (diff == 0)
+	    diff = keys->key_compare_cb(key, new_key,
+					keys->keys_compare_metadata);
 	if (diff == 0 || diff == 1)
 	    break;
     }
     ll_end_iter(keys);
 
+    /* The right child of the matched key, or the rightmost child */
+    if (!curr->is_leaf && diff != 1)
+	child = ll_get_iter_data(curr->children);
+    if (walk_children)
+	ll_end_iter(curr->children);
+
+    BPT_COUNT(bpt, comparisons,
+	      children_index < KEY_LEN(curr) ? children_index + 1 : children_index);
+
     if (diff == 0){
 	/* Exact key match */
 	if (curr->is_leaf){
@@ -614,12 +2100,12 @@ bpt_search_internal(bpt_node *curr, void *new_key, bpt_node **leaf_node,
 
 	    /* When the pointer to the record is required, set it for user */
 	    if (record != NULL)
-		*record = bpt_get_key_value_from_leaf(curr, false, new_key);
+		*record = child;
 
 	    return true;
 	}else{
 	    /* Search for the right child */
-	    return bpt_search_internal(bpt_ref_index_child(curr, children_index + 1),
+	    return bpt_search_internal(bpt, (bpt_node *) child,
 				       new_key, leaf_node, record);
 	}
     }else if (diff == 1){
@@ -632,7 +2118,7 @@ bpt_search_internal(bpt_node *curr, void *new_key, bpt_node **leaf_node,
 	    return false;
 	else{
 	    /* Search for the left child */
-	    return bpt_search_internal(bpt_ref_index_child(curr, children_index),
+	    return bpt_search_internal(bpt, (bpt_node *) child,
 				       new_key, leaf_node, record);
 	}
     }else{
@@ -641,8 +2127,7 @@ bpt_search_internal(bpt_node *curr, void *new_key, bpt_node **leaf_node,
 	    return false;
 	else{
 	    /* Search for the rightmost child */
-	    return bpt_search_internal(bpt_ref_index_child(curr,
-							   CHILDREN_LEN(curr) - 1),
+	    return bpt_search_internal(bpt, (bpt_node *) child,
 				       new_key, leaf_node, record);
 	}
     }
@@ -654,15 +2139,35 @@ bpt_search_internal(bpt_node *curr, void *new_key, bpt_node **leaf_node,
  * Allow 'leaf_node' and 'record' to be null, when user doesn't need to
  * interact with the leaf node or its value.
  */
-bool
-bpt_search(bpt_tree *bpt, void* new_key, bpt_node **leaf_node,
+static bool
+bpt_lookup(bpt_tree *bpt, void* new_key, bpt_node **leaf_node,
 	   void **record){
     if (bpt != NULL && bpt->root != NULL && new_key != NULL)
-	return bpt_search_internal(bpt->root, new_key, leaf_node, record);
+	return bpt_search_internal(bpt, bpt->root, new_key, leaf_node, record);
 
     return false;
 }
 
+/*
+ * Exported search, which records its latency unlike the search by insert
+ * and delete.
+ */
+bool
+bpt_search(bpt_tree *bpt, void* new_key, bpt_node **leaf_node,
+	   void **record){
+    bool found;
+    BPT_TIMESTAMP(start);
+
+    found = bpt_lookup(bpt, new_key, leaf_node, record);
+
+    if (bpt != NULL){
+	BPT_TIMESTAMP(done);
+	BPT_RECORD_LATENCY(bpt, BPT_OP_SEARCH, start, done, done, false);
+    }
+
+    return found;
+}
+
 /*
  * Return the minimum key from one subtree.
  *
@@ -729,13 +2234,15 @@ bpt_ref_right_child_by_key(bpt_node *node, void *key){
  * Update the parent's keys and children according to the merge.
  */
 static void *
-bpt_merge_nodes(bpt_node *curr, bool with_right){
+bpt_merge_nodes(bpt_tree *bpt, bpt_node *curr, bool with_right){
     linked_list *merged_keys, *merged_children;
     bpt_node *curr_child, *removed_child = NULL;
     node *np;
     void *deleted_key;
     int index = 0;
 
+    BPT_COUNT(bpt, merges, 1);
+
     if (with_right){
 	/* Merge keys */
 	merged_keys = ll_merge(curr->keys, curr->next->keys);
@@ -813,7 +2320,7 @@ bpt_merge_nodes(bpt_node *curr, bool with_right){
     }
 
     /* Free the child */
-    bpt_free_node(removed_child);
+    bpt_free_node(bpt, removed_child);
 
     return deleted_key;
 }
@@ -923,7 +2430,7 @@ bpt_root_promoted(bpt_tree *bpt, bpt_node *curr){
 	bpt->root = child;
 
 	/* Free the unnecessary node */
-	bpt_free_node(curr);
+	bpt_free_node(bpt, curr);
 
 	printf("debug : completed root promotion\n");
 
@@ -943,8 +2450,12 @@ bpt_root_promoted(bpt_tree *bpt, bpt_node *curr){
 	 * children of this current node and deleted one last index within this
 	 * node. Besides, the current node's parent is root and it has one left
 	 * key only.
+	 *
+	 * The sibling receives one more key. If it is full, then it has
+	 * enough keys to lend instead. Leave it to the borrow.
 	 */
-	if (HAVE_SAME_PARENT(curr->prev, curr)){
+	if (HAVE_SAME_PARENT(curr->prev, curr) &&
+	    KEY_LEN(curr->prev) < bpt->max_keys){
 	    bpt_node *child;
 	    void *min_key;
 
@@ -993,16 +2504,18 @@ bpt_root_promoted(bpt_tree *bpt, bpt_node *curr){
 	    curr->prev->is_root = true;
 	    curr->prev->next = NULL;
 	    curr->prev->parent = NULL;
+	    bpt_refresh_node(bpt, curr->prev);
 
 	    /* Free the current root and the current node */
-	    bpt_free_node(curr->parent);
-	    bpt_free_node(curr);
+	    bpt_free_node(bpt, curr->parent);
+	    bpt_free_node(bpt, curr);
 
 	    /* Done with the key deletion */
 	    return true;
 	}
 
-	if (HAVE_SAME_PARENT(curr, curr->next)){
+	if (HAVE_SAME_PARENT(curr, curr->next) &&
+	    KEY_LEN(curr->next) < bpt->max_keys){
 	    void *key;
 	    bpt_node *child;
 
@@ -1040,10 +2553,11 @@ bpt_root_promoted(bpt_tree *bpt, bpt_node *curr){
 	    curr->next->is_root = true;
 	    curr->next->prev = NULL;
 	    curr->next->parent = NULL;
+	    bpt_refresh_node(bpt, curr->next);
 
 	    /* Free the current root and the current node */
-	    bpt_free_node(curr->parent);
-	    bpt_free_node(curr);
+	    bpt_free_node(bpt, curr->parent);
+	    bpt_free_node(bpt, curr);
 
 	    /* Done with the key deletion */
 	    return true;
@@ -1087,6 +2601,9 @@ bpt_borrowed_key_from_sibling(bpt_tree *bpt, bpt_node *curr,
 		/* Verify the node property */
 		bpt_node_validity(curr);
 
+		bpt_refresh_node(bpt, curr->prev);
+		bpt_refresh_node(bpt, curr);
+
 		/* Continue to update the indexes. Go up by recursive call */
 		if (!curr->is_root)
 		    bpt_delete_internal(bpt, curr->parent, removed_key, record);
@@ -1126,6 +2643,9 @@ bpt_borrowed_key_from_sibling(bpt_tree *bpt, bpt_node *curr,
 		/* Verify the node property */
 		bpt_node_validity(curr);
 
+		bpt_refresh_node(bpt, curr->prev);
+		bpt_refresh_node(bpt, curr);
+
 		return true;
 	    }
 	}
@@ -1155,6 +2675,9 @@ bpt_borrowed_key_from_sibling(bpt_tree *bpt, bpt_node *curr,
 		/* Verify the node property */
 		bpt_node_validity(curr);
 
+		bpt_refresh_node(bpt, curr->next);
+		bpt_refresh_node(bpt, curr);
+
 		/* Continue to update the indexes. Go up by recursive call */
 		if (!curr->is_root)
 		    bpt_delete_internal(bpt, curr->parent, removed_key, record);
@@ -1190,6 +2713,9 @@ bpt_borrowed_key_from_sibling(bpt_tree *bpt, bpt_node *curr,
 		/* Verify the node property */
 		bpt_node_validity(curr);
 
+		bpt_refresh_node(bpt, curr->next);
+		bpt_refresh_node(bpt, curr);
+
 		return true;
 	    }
 	}
@@ -1220,245 +2746,2322 @@ bpt_merged_and_rebalanced_nodes(bpt_tree *bpt, bpt_node *curr,
 	void *deleted_key;
 	bpt_node *prev = curr->prev;
 
-	printf("debug : bpt_merge_nodes() with left node\n");
+	printf("debug : bpt_merge_nodes() with left node\n");
+
+	/* The current node gets merged with the previous one */
+	deleted_key = bpt_merge_nodes(bpt, curr, false);
+	printf("debug : this merge decrements the number of parent's keys to '%d'\n",
+	       KEY_LEN(prev->parent));
+
+	/*
+	 * Incorporate the split key from parent to the current node,
+	 * if this is an internal node.
+	 */
+	if (prev->is_leaf == false){
+	    ll_asc_insert(prev->keys, deleted_key);
+	    printf("debug : incorporate the split key = %lu from parent to child\n",
+		   (uintptr_t) deleted_key);
+	}
+
+	/* Verify the node property */
+	bpt_node_validity(prev);
+
+	/* The merged node took over all records or children */
+	bpt_refresh_node(bpt, prev);
+
+	/*
+	 * Go up by using the saved reference of previous sibling.
+	 * Avoid the call of the bpt_delete_internal() that uses
+	 * current node below.
+	 */
+	if (prev->parent)
+	    bpt_delete_internal(bpt, prev->parent, removed_key, record);
+
+	return true;
+
+    }else if (HAVE_SAME_PARENT(curr, curr->next)){
+	/*
+	 * This path merges the current node with the next node.
+	 * Any left data in the next node will be moved to the current
+	 * node. Thus, after the bpt_merge_nodes(), attributes of the
+	 * current node are available.
+	 */
+	void *deleted_key;
+
+	printf("debug : bpt_merge_nodes() with right node\n");
+
+	deleted_key = bpt_merge_nodes(bpt, curr, true);
+	printf("debug : this merge decrements the number of parent's keys to '%d'\n",
+	       KEY_LEN(curr->parent));
+
+	/*
+	 * Incorporate the split key from parent to the current node,
+	 * if this is an internal node.
+	 */
+	if (curr->is_leaf == false){
+	    ll_asc_insert(curr->keys, deleted_key);
+	    printf("debug : incorporate the split key = %lu from parent to child\n",
+		   (uintptr_t) deleted_key);
+	}
+
+	/* Verify the node property */
+	bpt_node_validity(curr);
+
+	/* The merged node took over all records or children */
+	bpt_refresh_node(bpt, curr);
+
+	/* Go up */
+	if (curr->parent)
+	    bpt_delete_internal(bpt, curr->parent, removed_key, record);
+
+	return true;
+    }
+
+    return false;
+}
+
+/*
+ * Remove the key (or index) from the current node.
+ *
+ * If the key is one of the indexes, then replace it with the minimum key
+ * that could be fetched from the key's right child.
+ */
+static void
+bpt_remove_key_from_node(bpt_tree *bpt, bpt_node *curr, void *removed_key,
+			 void **record){
+    if (curr->is_leaf){
+	/*
+	 * The call of bpt_search() before the first call of
+	 * bpt_delete_internal() already proves that the key exists.
+	 * So, this leaf node must contain the removed key.
+	 */
+	if (record == NULL){
+	    /*
+	     * Discard the corresponding record when user indicates
+	     * the record is not necessary.
+	     */
+	    (void) bpt_get_key_value_from_leaf(curr, true,
+					       removed_key);
+	}else{
+	    *record = bpt_get_key_value_from_leaf(curr, true,
+						  removed_key);
+	    *record = bpt_keep_removed_record(bpt, *record);
+	}
+
+	printf("debug : removed key = '%lu' on the leaf node\n",
+	       (uintptr_t) removed_key);
+
+	/* Verify the node property */
+	bpt_node_validity(curr);
+    }else{
+	/*
+	 * This internal node might or might not have the index.
+	 * If the indexes contain the key, then remove and replace
+	 * it with its right child's minimum key.
+	 */
+	if (ll_has_key(curr->keys, removed_key)){
+	    void *key;
+	    bpt_node *right_child;
+
+	    right_child = bpt_ref_right_child_by_key(curr, removed_key);
+	    ll_remove_by_key(curr->keys, removed_key);
+	    assert((key = bpt_ref_subtree_minimum_key(right_child)) != NULL);
+	    ll_asc_insert(curr->keys, key);
+
+	    printf("debug : removed %lu and inserted %lu as the min key\n",
+		   (uintptr_t) removed_key, (uintptr_t) key);
+
+	    /* Verify the node property */
+	    bpt_node_validity(curr);
+	}
+    }
+}
+
+/*
+ * The main internal processing of B+ tree deletion.
+ */
+static void
+bpt_delete_internal(bpt_tree *bpt, bpt_node *curr, void *removed_key,
+		    void **record){
+    assert(bpt != NULL);
+    assert(curr != NULL);
+    assert(removed_key != NULL);
+
+    printf("debug : bpt_delete_internal() for %p\n"
+           "debug : current node = %s and %s, the number of keys = %d, the number of children = %d\n",
+	   curr,
+	   curr->is_root ? "root" : "non-root",
+	   curr->is_leaf ? "leaf" : "non-leaf",
+	   KEY_LEN(curr), CHILDREN_LEN(curr));
+
+    /*
+     * If the root promotion happens, then we have reached
+     * to the top of the tree and done with all the necessary
+     * steps to keep the B+ tree properties.
+     *
+     * Return and close this key deletion process.
+     */
+    if (bpt_root_promoted(bpt, curr)){
+	BPT_COUNT(bpt, root_promotions, 1);
+	return;
+    }
+
+    /*
+     * --------------------------------------
+     * The main part of deletion process
+     * --------------------------------------
+     */
+    bpt_remove_key_from_node(bpt, curr, removed_key, record);
+
+    /*
+     * Either a record or some child's aggregate has changed below.
+     * Any borrow or merge below refreshes the nodes it touches again.
+     */
+    bpt_refresh_node(bpt, curr);
+
+    /*
+     * Execute the following steps to keep the b+ tree property.
+     */
+    if (KEY_LEN(curr) >= GET_MIN_KEY_NUM(bpt->max_keys)){
+
+	/* The current node has sufficient keys. Go up if possible */
+	if (!curr->is_root)
+	    bpt_delete_internal(bpt, curr->parent, removed_key, record);
+
+	return;
+
+    }else{
+
+	/* Could borrow a key from either sibling ? */
+	if (bpt_borrowed_key_from_sibling(bpt, curr, removed_key, record)){
+	    BPT_COUNT(bpt, borrows, 1);
+
+	    /* Go up to update index if we have an upper node */
+	    if (!curr->is_root)
+		bpt_delete_internal(bpt, curr->parent, removed_key, record);
+
+	    return;
+	}
+
+	printf("debug : borrowing a key didn't happen\n");
+
+	/*
+	 * Merge nodes if possible.
+	 *
+	 * After the bpt_merged_and_rebalanced_nodes(), all of
+	 * the steps to keep this entire B+ Tree property are
+	 * done, including updates of upper nodes.
+	 *
+	 * This is because the function internally calls
+	 * bpt_delete_internal() and updates the upper layers.
+	 *
+	 * Return and close this deletion process if it returns
+	 * true.
+	 */
+	if (bpt_merged_and_rebalanced_nodes(bpt, curr,
+					    removed_key, record))
+	    return;
+
+	printf("debug : merging nodes didn't happen either\n");
+    }
+}
+
+/*
+ * Wrapper function of bpt_delete_internal().
+ */
+bool
+bpt_delete(bpt_tree *bpt, void *key, void **record){
+    bpt_node *leaf_node;
+    bool found_same_key = false;
+    void *removed = NULL;
+    BPT_TIMESTAMP(start);
+
+    bpt_release_retired(bpt);
+
+    printf("debug : bpt_delete() for root = %p with key = %p\n", bpt->root, key);
+
+    found_same_key = bpt_lookup(bpt, key, &leaf_node, NULL);
+    BPT_TIMESTAMP(searched);
+
+    /* Remove the found key */
+    if (found_same_key){
+	bpt->key_count--;
+
+	/* The caller may free the key and reuse its address */
+	bpt_forget_abbrev(leaf_node, key);
+
+	if (bpt->lazy_delete)
+	    bpt_lazy_delete_internal(bpt, leaf_node, key, &removed);
+	else{
+	    /* The compaction can't resume from the key the caller will free */
+	    bpt_move_cursors_off_key(bpt, leaf_node, key);
+
+	    printf("debug : call bpt_delete_internal() with leaf node = %p\n", leaf_node);
+
+	    bpt_delete_internal(bpt, leaf_node, key, &removed);
+	}
+
+	/* Readable until the next update. See bpt_release_retired() */
+	bpt_drop_record(bpt, removed);
+	if (record != NULL)
+	    *record = removed;
+
+	BPT_TIMESTAMP(done);
+	BPT_RECORD_LATENCY(bpt, BPT_OP_DELETE, start, searched, done, true);
+
+	return true;
+    }else{
+	printf("debug : the key to be removed was not found\n");
+
+	BPT_RECORD_LATENCY(bpt, BPT_OP_DELETE, start, searched, searched,
+			   false);
+
+	return false;
+    }
+}
+
+/*
+ * Return the index of 'child' in the parent's children.
+ */
+static int
+bpt_child_index(bpt_node *parent, bpt_node *child){
+    bpt_node *iter;
+    int index = 0;
+
+    ll_begin_iter(parent->children);
+    while((iter = ITER_BPT_CHILD(parent)) != NULL){
+	if (iter == child)
+	    break;
+	index++;
+    }
+    ll_end_iter(parent->children);
+
+    assert(iter == child);
+
+    return index;
+}
+
+/*
+ * Overwrite the key at 'index' of the node without key comparison.
+ */
+static void
+bpt_replace_key_at(bpt_node *curr, int index, void *key){
+    (void) ll_index_remove(curr->keys, index);
+    ll_index_insert(curr->keys, key, index);
+
+    /* The replaced key can leave the tree without refreshing this node */
+    if (curr->abbrevs != NULL)
+	bpt_sync_abbrev_cache(curr);
+}
+
+/*
+ * Detach the node from the doubly linked list of its level.
+ */
+static void
+bpt_unlink_from_level(bpt_node *curr){
+    if (curr->prev != NULL)
+	curr->prev->next = curr->next;
+    if (curr->next != NULL)
+	curr->next->prev = curr->prev;
+    curr->prev = curr->next = NULL;
+}
+
+/*
+ * Free one whole subtree and return the number of removed records.
+ *
+ * Every node is detached from its level before free. Keys belong to
+ * the application. Records are freed by the records' free callback
+ * only when 'free_records' is true.
+ */
+static uintptr_t
+bpt_free_subtree(bpt_tree *bpt, bpt_node *curr, bool free_records){
+    uintptr_t removed = 0;
+    void *data;
+
+    while(CHILDREN_LEN(curr) > 0){
+	data = ll_remove_first_data(curr->children);
+	if (!curr->is_leaf)
+	    removed += bpt_free_subtree(bpt, (bpt_node *) data, free_records);
+	else{
+	    if (free_records && curr->children->free_cb != NULL)
+		curr->children->free_cb(data);
+	    bpt_drop_record(bpt, data);
+	    removed++;
+	}
+    }
+    while(KEY_LEN(curr) > 0)
+	(void) ll_remove_first_data(curr->keys);
+
+    bpt_unlink_from_level(curr);
+    bpt_free_node(bpt, curr);
+
+    return removed;
+}
+
+/*
+ * Replace the root while it is an internal node with one child only.
+ */
+static void
+bpt_collapse_root(bpt_tree *bpt){
+    bpt_node *old_root;
+
+    while(!bpt->root->is_leaf && CHILDREN_LEN(bpt->root) == 1){
+	old_root = bpt->root;
+	bpt->root = (bpt_node *) ll_remove_first_data(old_root->children);
+	bpt->root->is_root = true;
+	bpt->root->parent = NULL;
+	assert(bpt->root->prev == NULL && bpt->root->next == NULL);
+
+	while(KEY_LEN(old_root) > 0)
+	    (void) ll_remove_first_data(old_root->keys);
+	bpt_free_node(bpt, old_root);
+	BPT_COUNT(bpt, root_promotions, 1);
+
+	printf("debug : collapsed the root with one child\n");
+    }
+}
+
+/*
+ * Return true if the non-root node has fewer keys than the tree allows.
+ *
+ * A non-root node without any key is always regarded as underflow,
+ * even when 'max_keys' makes the minimum number of keys zero.
+ */
+static bool
+bpt_node_underflow(bpt_tree *bpt, bpt_node *curr){
+    return KEY_LEN(curr) < GET_MIN_KEY_NUM(bpt->max_keys) ||
+	KEY_LEN(curr) == 0;
+}
+
+/*
+ * Rebalance two adjacent siblings with the same parent.
+ *
+ * If all the entries fit in one node, merge the right node into the left
+ * one and return the left node. Otherwise, redistribute the entries evenly
+ * and return NULL.
+ *
+ * Every separator written to the parent or moved down into an internal
+ * node is taken from the minimum key of its right subtree. This keeps
+ * the separators pointing to the live keys, even when the old parent's
+ * key has been deleted already.
+ */
+static bpt_node *
+bpt_rebalance_pair(bpt_tree *bpt, bpt_node *left, bpt_node *right){
+    bpt_node *parent = left->parent, *child;
+    int index, target;
+
+    assert(HAVE_SAME_PARENT(left, right));
+    assert(left->next == right);
+
+    index = bpt_child_index(parent, left);
+
+    if (left->is_leaf){
+	if (KEY_LEN(left) + KEY_LEN(right) <= bpt->max_keys){
+	    while(KEY_LEN(right) > 0){
+		ll_tail_insert(left->keys, ll_remove_first_data(right->keys));
+		ll_tail_insert(left->children,
+			       ll_remove_first_data(right->children));
+	    }
+	}else{
+	    target = (KEY_LEN(left) + KEY_LEN(right)) / 2;
+	    while(KEY_LEN(left) < target){
+		ll_tail_insert(left->keys, ll_remove_first_data(right->keys));
+		ll_tail_insert(left->children,
+			       ll_remove_first_data(right->children));
+	    }
+	    while(KEY_LEN(left) > target){
+		ll_insert(right->keys, ll_tail_remove(left->keys));
+		ll_insert(right->children, ll_tail_remove(left->children));
+	    }
+	    bpt_replace_key_at(parent, index,
+			       ll_ref_index_data(right->keys, 0));
+	}
+    }else{
+	if (KEY_LEN(left) + KEY_LEN(right) + 1 <= bpt->max_keys){
+	    ll_tail_insert(left->keys, bpt_ref_subtree_minimum_key(right));
+	    while(KEY_LEN(right) > 0)
+		ll_tail_insert(left->keys, ll_remove_first_data(right->keys));
+	    while(CHILDREN_LEN(right) > 0){
+		child = (bpt_node *) ll_remove_first_data(right->children);
+		child->parent = left;
+		ll_tail_insert(left->children, child);
+	    }
+	}else{
+	    /* Rotate the children one by one through the parent */
+	    target = (KEY_LEN(left) + KEY_LEN(right)) / 2;
+	    while(KEY_LEN(left) < target){
+		child = (bpt_node *) ll_remove_first_data(right->children);
+		(void) ll_remove_first_data(right->keys);
+		child->parent = left;
+		ll_tail_insert(left->keys, bpt_ref_subtree_minimum_key(child));
+		ll_tail_insert(left->children, child);
+	    }
+	    while(KEY_LEN(left) > target){
+		child = (bpt_node *) ll_tail_remove(left->children);
+		(void) ll_tail_remove(left->keys);
+		child->parent = right;
+		ll_insert(right->keys, bpt_ref_subtree_minimum_key(right));
+		ll_insert(right->children, child);
+	    }
+	    bpt_replace_key_at(parent, index,
+			       bpt_ref_subtree_minimum_key(right));
+	}
+    }
+
+    if (KEY_LEN(right) > 0){
+	bpt_node_validity(left);
+	bpt_node_validity(right);
+	bpt_refresh_node(bpt, left);
+	bpt_refresh_node(bpt, right);
+	printf("debug : redistributed entries between %p and %p\n", left, right);
+	BPT_COUNT(bpt, borrows, 1);
+
+	return NULL;
+    }
+
+    BPT_COUNT(bpt, merges, 1);
+
+    /* The right node has become empty. Remove it from the parent */
+    (void) ll_index_remove(parent->keys, index);
+    (void) ll_index_remove(parent->children, index + 1);
+    bpt_unlink_from_level(right);
+    bpt_free_node(bpt, right);
+
+    bpt_node_validity(left);
+    bpt_refresh_node(bpt, left);
+    printf("debug : merged the right sibling into %p\n", left);
+
+    return left;
+}
+
+/*
+ * Restore the minimum number of keys from the node up to the root.
+ *
+ * Unlike bpt_delete_internal(), this doesn't depend on the removed key
+ * and can fix nodes which lost many keys at once. When the parent has
+ * this node as its only child, fix the parent first so that the node
+ * gets siblings to borrow from or merge with.
+ */
+static void
+bpt_fix_underflow(bpt_tree *bpt, bpt_node *curr){
+    bpt_node *merged;
+
+    while(curr != NULL){
+	if (curr->is_root){
+	    bpt_collapse_root(bpt);
+	    bpt_refresh_node(bpt, bpt->root);
+	    return;
+	}
+
+	while(bpt_node_underflow(bpt, curr)){
+	    if (CHILDREN_LEN(curr->parent) == 1){
+		bpt_fix_underflow(bpt, curr->parent);
+		if (curr->is_root)
+		    return;
+		continue;
+	    }
+
+	    if (HAVE_SAME_PARENT(curr->prev, curr))
+		merged = bpt_rebalance_pair(bpt, curr->prev, curr);
+	    else
+		merged = bpt_rebalance_pair(bpt, curr, curr->next);
+
+	    /* Redistribution always satisfies the minimum */
+	    if (merged == NULL)
+		break;
+	    curr = merged;
+	}
+
+	bpt_refresh_node(bpt, curr);
+	curr = curr->parent;
+    }
+}
+
+/*
+ * Return the leaf node whose key range covers the key.
+ *
+ * Unlike bpt_search_internal(), go down through internal nodes which
+ * have only one child without any key.
+ */
+static bpt_node *
+bpt_ref_leaf_by_key(bpt_tree *bpt, void *key){
+    bpt_node *curr = bpt->root;
+    linked_list *keys;
+    int index;
+
+    while(!curr->is_leaf){
+	keys = curr->keys;
+	ll_begin_iter(keys);
+	for (index = 0; index < KEY_LEN(curr); index++)
+	    if (keys->key_compare_cb(ll_get_iter_data(keys), key,
+				     keys->keys_compare_metadata) == 1)
+		break;
+	ll_end_iter(keys);
+	curr = bpt_ref_index_child(curr, index);
+    }
+
+    return curr;
+}
+
+/*
+ * Remove every entry between 'lo' and 'hi' under the node.
+ *
+ * The 'above_lo' and 'below_hi' flags have the same meaning as
+ * bpt_aggregate_range_internal(). Fully covered children are freed
+ * as a whole subtree with their separators. Partially covered children
+ * are trimmed recursively and dropped when they become empty. Return
+ * true if the node itself has become empty.
+ *
+ * The separator before a trimmed child is rewritten with the child's
+ * new minimum key, since the old one might have been removed.
+ */
+static bool
+bpt_delete_range_internal(bpt_tree *bpt, bpt_node *curr, void *lo, void *hi,
+			  bool above_lo, bool below_hi, bool free_records,
+			  uintptr_t *removed){
+    linked_list *keys = curr->keys;
+    bpt_node *child;
+    void *key, *prev_key, *record;
+    bool child_above_lo, child_below_hi;
+    int index = 0;
+
+    if (curr->is_leaf){
+	while(index < KEY_LEN(curr)){
+	    key = ll_ref_index_data(keys, index);
+	    if (!above_lo &&
+		keys->key_compare_cb(key, lo, keys->keys_compare_metadata) == -1){
+		index++;
+		continue;
+	    }
+	    if (!below_hi &&
+		keys->key_compare_cb(key, hi, keys->keys_compare_metadata) == 1)
+		break;
+
+	    (void) ll_index_remove(keys, index);
+	    record = ll_index_remove(curr->children, index);
+	    if (free_records && curr->children->free_cb != NULL)
+		curr->children->free_cb(record);
+	    bpt_drop_record(bpt, record);
+	    (*removed)++;
+	}
+
+	bpt_refresh_node(bpt, curr);
+
+	return KEY_LEN(curr) == 0;
+    }
+
+    while(index < CHILDREN_LEN(curr)){
+	child = bpt_ref_index_child(curr, index);
+	prev_key = index > 0 ? ll_ref_index_data(keys, index - 1) : NULL;
+	key = index < KEY_LEN(curr) ? ll_ref_index_data(keys, index) : NULL;
+
+	/* All keys of this child are smaller than 'lo' */
+	if (!above_lo && key != NULL &&
+	    keys->key_compare_cb(key, lo, keys->keys_compare_metadata) != 1){
+	    index++;
+	    continue;
+	}
+
+	/* All keys of this and the rest children are bigger than 'hi' */
+	if (!below_hi && prev_key != NULL &&
+	    keys->key_compare_cb(prev_key, hi, keys->keys_compare_metadata) == 1)
+	    break;
+
+	child_above_lo = above_lo || (prev_key != NULL &&
+				      keys->key_compare_cb(prev_key, lo,
+							   keys->keys_compare_metadata) != -1);
+	child_below_hi = below_hi || (key != NULL &&
+				      keys->key_compare_cb(key, hi,
+							   keys->keys_compare_metadata) != 1);
+
+	if (child_above_lo && child_below_hi){
+	    /* Drop the whole subtree in one step */
+	    *removed += bpt_free_subtree(bpt, child, free_records);
+	}else if (bpt_delete_range_internal(bpt, child, lo, hi,
+					    child_above_lo, child_below_hi,
+					    free_records, removed)){
+	    /* The trimmed child has become empty */
+	    while(KEY_LEN(child) > 0)
+		(void) ll_remove_first_data(child->keys);
+	    bpt_unlink_from_level(child);
+	    bpt_free_node(bpt, child);
+	}else{
+	    if (index > 0)
+		bpt_replace_key_at(curr, index - 1,
+				   bpt_ref_subtree_minimum_key(child));
+	    index++;
+	    continue;
+	}
+
+	/*
+	 * Detach the freed child with the separator on its left side. The
+	 * first child doesn't have it, so remove the one on its right.
+	 */
+	(void) ll_index_remove(curr->children, index);
+	if (KEY_LEN(curr) > 0)
+	    (void) ll_index_remove(keys, index > 0 ? index - 1 : 0);
+    }
+
+    bpt_refresh_node(bpt, curr);
+
+    return CHILDREN_LEN(curr) == 0;
+}
+
+/*
+ * Delete all the keys between 'lo' and 'hi' (inclusive) and return the
+ * number of deleted keys.
+ *
+ * Subtrees fully covered by the range are freed in one step without
+ * per-key deletion. Then, only the two boundary paths are rebalanced.
+ * The records are freed by the records' free callback if 'free_records'
+ * is true. Otherwise, the application keeps their ownership.
+ */
+uintptr_t
+bpt_delete_range(bpt_tree *bpt, void *lo, void *hi, bool free_records){
+    linked_list *keys;
+    bpt_node *leaf;
+    uintptr_t removed = 0;
+
+    if (bpt == NULL || bpt->root == NULL || lo == NULL || hi == NULL)
+	return 0;
+
+    keys = bpt->root->keys;
+    if (keys->key_compare_cb(lo, hi, keys->keys_compare_metadata) == 1)
+	return 0;
+
+    printf("debug : bpt_delete_range() for root = %p\n", bpt->root);
+
+    /* The compaction keys might be deleted. Start over next time */
+    bpt->compact_key = bpt->fill_key = NULL;
+
+    bpt_release_retired(bpt);
+    bpt_renew_abbrev_epoch(bpt);
+
+    if (bpt_delete_range_internal(bpt, bpt->root, lo, hi, false, false,
+				  free_records, &removed)){
+	/* Everything has gone. Make the root an empty leaf again */
+	bpt_turn_into_leaf(bpt, bpt->root);
+	bpt_refresh_node(bpt, bpt->root);
+    }
+    bpt_collapse_root(bpt);
+
+    /*
+     * Rebalance the left and right boundary paths.
+     *
+     * After the removal, the leaf for 'lo' has the keys before the range.
+     * If it has no key after the range, the leaf with those keys is the
+     * next one, since all the leaves in between have gone.
+     */
+    leaf = bpt_ref_leaf_by_key(bpt, lo);
+    bpt_fix_underflow(bpt, leaf);
+
+    leaf = bpt_ref_leaf_by_key(bpt, lo);
+    keys = leaf->keys;
+    if (KEY_LEN(leaf) > 0 &&
+	keys->key_compare_cb(ll_ref_index_data(keys, KEY_LEN(leaf) - 1), hi,
+			     keys->keys_compare_metadata) != 1 &&
+	leaf->next != NULL)
+	leaf = leaf->next;
+    bpt_fix_underflow(bpt, leaf);
+
+    printf("debug : bpt_delete_range() removed %lu keys\n", removed);
+
+    bpt->key_count -= removed;
+
+    return removed;
+}
+
+/*
+ * Return the number of edges from the node to its leaf nodes.
+ */
+static int
+bpt_subtree_height(bpt_node *curr){
+    int height = 0;
+
+    while(!curr->is_leaf){
+	curr = bpt_ref_index_child(curr, 0);
+	height++;
+    }
+
+    return height;
+}
+
+/*
+ * Return the rightmost leaf node under the node.
+ */
+static bpt_node *
+bpt_ref_subtree_rightmost_leaf(bpt_node *curr){
+    while(!curr->is_leaf)
+	curr = bpt_ref_index_child(curr, CHILDREN_LEN(curr) - 1);
+
+    return curr;
+}
+
+/*
+ * Return true if the node has neither keys for leaf nor children for
+ * internal node.
+ */
+static bool
+bpt_node_is_empty(bpt_node *curr){
+    return curr->is_leaf ? KEY_LEN(curr) == 0 : CHILDREN_LEN(curr) == 0;
+}
+
+/*
+ * Free an emptied node after detaching it from its level.
+ */
+static void
+bpt_free_empty_node(bpt_tree *bpt, bpt_node *curr){
+    while(KEY_LEN(curr) > 0)
+	(void) ll_remove_first_data(curr->keys);
+    bpt_unlink_from_level(curr);
+    bpt_free_node(bpt, curr);
+}
+
+/*
+ * Split the subtree along the search path of 'key'.
+ *
+ * The current node keeps the entries smaller than 'key' and the returned
+ * new node gets the rest. The link between the two nodes at the same level
+ * is cut, so that each half becomes the rightmost or leftmost node of its
+ * own tree. Either half can become empty, which the caller drops.
+ */
+static bpt_node *
+bpt_split_subtree(bpt_tree *bpt, bpt_node *curr, void *key){
+    linked_list *keys = curr->keys;
+    bpt_node *right, *child, *right_child;
+    int index;
+
+    right = bpt_gen_root_callbacks_node(bpt);
+    right->is_leaf = curr->is_leaf;
+    right->parent = curr->parent;
+    bpt_count_node(bpt, right, true);
+
+    /* Cut the level */
+    right->next = curr->next;
+    if (right->next != NULL)
+	right->next->prev = right;
+    curr->next = NULL;
+
+    if (curr->is_leaf){
+	while(KEY_LEN(curr) > 0 &&
+	      keys->key_compare_cb(ll_ref_index_data(keys, KEY_LEN(curr) - 1),
+				   key, keys->keys_compare_metadata) != -1){
+	    ll_insert(right->keys, ll_tail_remove(keys));
+	    ll_insert(right->children, ll_tail_remove(curr->children));
+	}
+    }else{
+	/* The same child selection as bpt_search_internal() */
+	ll_begin_iter(keys);
+	for (index = 0; index < KEY_LEN(curr); index++)
+	    if (keys->key_compare_cb(ll_get_iter_data(keys), key,
+				     keys->keys_compare_metadata) == 1)
+		break;
+	ll_end_iter(keys);
+
+	/* Move the children after the split child and their separators */
+	while(CHILDREN_LEN(curr) > index + 1){
+	    child = (bpt_node *) ll_tail_remove(curr->children);
+	    child->parent = right;
+	    ll_insert(right->children, child);
+	}
+	while(KEY_LEN(curr) > index)
+	    ll_insert(right->keys, ll_tail_remove(keys));
+
+	child = bpt_ref_index_child(curr, index);
+	right_child = bpt_split_subtree(bpt, child, key);
+	right_child->parent = right;
+	ll_insert(right->children, right_child);
+
+	/* Drop the empty halves together with their separators */
+	if (bpt_node_is_empty(child)){
+	    (void) ll_tail_remove(curr->children);
+	    if (KEY_LEN(curr) > 0)
+		(void) ll_tail_remove(keys);
+	    bpt_free_empty_node(bpt, child);
+	}
+	if (bpt_node_is_empty(right_child)){
+	    (void) ll_remove_first_data(right->children);
+	    if (KEY_LEN(right) > 0)
+		(void) ll_remove_first_data(right->keys);
+	    bpt_free_empty_node(bpt, right_child);
+	}
+    }
+
+    bpt_refresh_node(bpt, curr);
+    bpt_refresh_node(bpt, right);
+
+    return right;
+}
+
+/*
+ * Make the node the root of the tree. An empty internal node becomes
+ * an empty leaf root as bpt_init() makes.
+ */
+static void
+bpt_set_new_root(bpt_tree *bpt, bpt_node *curr){
+    curr->is_root = true;
+    curr->parent = NULL;
+    if (bpt_node_is_empty(curr))
+	bpt_turn_into_leaf(bpt, curr);
+    bpt->root = curr;
+    bpt_collapse_root(bpt);
+}
+
+/*
+ * Move all the keys equal to or bigger than 'key' to a new tree, which
+ * is returned by 'right_tree'.
+ *
+ * Only the nodes on the search path of 'key' are split. The other nodes
+ * move to either tree as they are. Then, the rightmost path of the left
+ * tree and the leftmost path of the right tree are rebalanced. The new
+ * tree shares all the callbacks with the original one, as well as the
+ * node arena and the registry of separators.
+ */
+bool
+bpt_split_at(bpt_tree *bpt, void *key, bpt_tree **right_tree){
+    bpt_tree *right;
+    bpt_node *right_root;
+
+    if (bpt == NULL || bpt->root == NULL || key == NULL ||
+	right_tree == NULL)
+	return false;
+
+    printf("debug : bpt_split_at() for root = %p\n", bpt->root);
+
+    bpt_release_retired(bpt);
+
+    right_root = bpt_split_subtree(bpt, bpt->root, key);
+
+    right = (bpt_tree *) bpt_malloc(sizeof(bpt_tree));
+    *right = *bpt;
+    bpt->compact_key = right->compact_key = NULL;
+    bpt->fill_key = right->fill_key = NULL;
+
+    /* Let the new tree count only the changes below */
+    right->key_count = right->leaf_count = right->internal_count = 0;
+    right->packed_bytes = 0;
+    if (right->separators != NULL)
+	bpt_join_separators(right, right->separators);
+    right->retired = NULL;
+    right->retired_num = right->retired_size = 0;
+    if (right->arena != NULL)
+	right->arena->refs++;
+    right->counters = bpt_gen_counters();
+    right->latency = bpt_gen_latency();
+
+    bpt_set_new_root(right, right_root);
+    bpt_set_new_root(bpt, bpt->root);
+
+    bpt_fix_underflow(bpt, bpt_ref_subtree_rightmost_leaf(bpt->root));
+    bpt_fix_underflow(right, bpt_ref_leftmost_leaf_node(right));
+
+    /*
+     * The number of entries moved with the untouched subtrees is unknown.
+     * Leave the counters to the next reader rather than walk the trees
+     * here, which keeps the split logarithmic.
+     */
+    bpt->counts_stale = right->counts_stale = true;
+
+    /*
+     * Some nodes have moved to the other tree with their separators. The
+     * shared registry keeps them, so the split doesn't look for them.
+     */
+    bpt_renew_abbrev_epoch(bpt);
+    bpt_renew_abbrev_epoch(right);
+
+    *right_tree = right;
+
+    return true;
+}
+
+/*
+ * Connect the rightmost nodes of the left subtree with the leftmost
+ * nodes of the right subtree at each level, from the given nodes with
+ * the same height down to the leaves.
+ */
+static void
+bpt_link_levels(bpt_node *left, bpt_node *right){
+    while(true){
+	assert(left->next == NULL && right->prev == NULL);
+	left->next = right;
+	right->prev = left;
+
+	if (left->is_leaf)
+	    break;
+
+	left = bpt_ref_index_child(left, CHILDREN_LEN(left) - 1);
+	right = bpt_ref_index_child(right, 0);
+    }
+}
+
+/*
+ * Add the counters of the tree to be merged into 'left'.
+ */
+static void
+bpt_take_over_counters(bpt_tree *left, bpt_tree *right){
+    left->counts_stale = left->counts_stale || right->counts_stale;
+    left->key_count += right->key_count;
+    left->leaf_count += right->leaf_count;
+    left->internal_count += right->internal_count;
+    left->packed_bytes += right->packed_bytes;
+}
+
+/*
+ * Let 'left' take over the separators of 'right'. The separators of two
+ * different registries go into one, which all the trees sharing either
+ * of them share.
+ */
+static void
+bpt_merge_separators(bpt_tree *left, bpt_tree *right){
+    bpt_separator_registry *from = right->separators;
+    uintptr_t i;
+
+    if (from == NULL || from == left->separators){
+	bpt_leave_separators(right);
+	return;
+    }
+
+    if (left->separators == NULL){
+	bpt_join_separators(left, from);
+	bpt_leave_separators(right);
+	return;
+    }
+
+    for (i = 0; i < from->trees_num; i++)
+	bpt_join_separators(from->trees[i], left->separators);
+    for (i = 0; i < from->separators_num; i++)
+	bpt_push_pointer(&left->separators->separators,
+			 &left->separators->separators_num,
+			 &left->separators->separators_size,
+			 from->separators[i]);
+    free(from->separators);
+    free(from->trees);
+    free(from);
+
+    bpt_leave_separators(right);
+}
+
+/*
+ * Add the operation counters of 'right' into 'left' and free 'right'
+ * without its nodes and separators, which 'left' has taken over.
+ */
+static void
+bpt_free_merged_tree(bpt_tree *left, bpt_tree *right){
+    uintptr_t i;
+#ifdef BPT_COUNTERS
+    bpt_counters snapshot;
+
+    (void) bpt_counters_snapshot(right, &snapshot);
+    bpt_ref_thread_counters(left)->comparisons += snapshot.comparisons;
+    bpt_ref_thread_counters(left)->nodes_visited += snapshot.nodes_visited;
+    bpt_ref_thread_counters(left)->splits += snapshot.splits;
+    bpt_ref_thread_counters(left)->root_splits += snapshot.root_splits;
+    bpt_ref_thread_counters(left)->merges += snapshot.merges;
+    bpt_ref_thread_counters(left)->borrows += snapshot.borrows;
+    bpt_ref_thread_counters(left)->root_promotions += snapshot.root_promotions;
+#endif
+    if (left->latency != NULL && right->latency != NULL){
+	int op, phase;
+
+	for (op = 0; op < BPT_OP_NUM; op++)
+	    for (phase = 0; phase < BPT_PHASE_NUM; phase++)
+		bpt_histogram_merge(&left->latency->histograms[op][phase],
+				    &right->latency->histograms[op][phase]);
+    }
+    bpt_merge_separators(left, right);
+    for (i = 0; i < right->retired_num; i++)
+	bpt_retire(left, right->retired[i]);
+    free(right->retired);
+    bpt_arena_release(right->arena);
+
+    free(right->latency);
+    free(right->counters);
+    free(right);
+}
+
+/*
+ * Concatenate two trees. All the keys of 'left' must be smaller than
+ * the keys of 'right'.
+ *
+ * The root of the lower tree is attached to the spine of the higher tree
+ * as a new child at the same height, which may split its ancestors just
+ * like insert. Then, only the attached node is rebalanced. On success,
+ * 'left' has all the entries and 'right' is freed. Return false without
+ * any change, if two trees are incompatible or unordered.
+ */
+bool
+bpt_concat(bpt_tree *left, bpt_tree *right){
+    linked_list *keys;
+    bpt_tree *higher;
+    bpt_node *spine, *attached;
+    int left_height, right_height, depth;
+    bool left_empty, right_empty;
+
+    if (left == NULL || right == NULL || left->root == NULL ||
+	right->root == NULL || left == right)
+	return false;
+
+    if (left->max_keys != right->max_keys ||
+	left->agg_combine != right->agg_combine ||
+	left->key_separator != right->key_separator ||
+	left->separator_free != right->separator_free ||
+	left->page_size != right->page_size ||
+	left->record_size != right->record_size ||
+	left->arena != right->arena ||
+	left->key_integer != right->key_integer ||
+	left->record_length != right->record_length){
+	fprintf(stderr, "trees with different configurations can't be concatenated\n");
+	return false;
+    }
+
+    /* Check the order before any change, unless either tree is empty */
+    left_empty = KEY_LEN(left->root) == 0 && left->root->is_leaf;
+    right_empty = KEY_LEN(right->root) == 0 && right->root->is_leaf;
+    keys = left->root->keys;
+    if (!left_empty && !right_empty &&
+	keys->key_compare_cb(ll_ref_index_data(bpt_ref_subtree_rightmost_leaf(left->root)->keys,
+					       KEY_LEN(bpt_ref_subtree_rightmost_leaf(left->root)) - 1),
+			     bpt_ref_subtree_minimum_key(right->root),
+			     keys->keys_compare_metadata) != -1){
+	fprintf(stderr, "the left tree has keys not smaller than the right tree\n");
+	return false;
+    }
+
+    printf("debug : bpt_concat() for root = %p and %p\n",
+	   left->root, right->root);
+
+    /* Any pending compaction of both trees starts over */
+    left->compact_key = left->fill_key = NULL;
+    left->lazy_pending += right->lazy_pending;
+
+    bpt_release_retired(left);
+    bpt_release_retired(right);
+
+    /* The nodes of 'right' bring the abbreviations of its epoch */
+    bpt_renew_abbrev_epoch(left);
+
+    /* Either tree is empty */
+    if (right_empty){
+	bpt_free_node(right, right->root);
+	bpt_free_merged_tree(left, right);
+	return true;
+    }
+    if (left_empty){
+	bpt_free_node(left, left->root);
+	left->root = right->root;
+	bpt_take_over_counters(left, right);
+	bpt_free_merged_tree(left, right);
+	return true;
+    }
+
+    /* The changes below are counted by 'left' */
+    bpt_take_over_counters(left, right);
+
+    left_height = bpt_subtree_height(left->root);
+    right_height = bpt_subtree_height(right->root);
+
+    if (left_height == right_height){
+	/* Create a new root over the two roots */
+	bpt_node *new_top, *left_root = left->root, *right_root = right->root;
+
+	new_top = bpt_gen_root_callbacks_node(left);
+	new_top->is_root = true;
+	bpt_count_node(left, new_top, true);
+	ll_tail_insert(new_top->keys, bpt_ref_subtree_minimum_key(right_root));
+	ll_tail_insert(new_top->children, left_root);
+	ll_tail_insert(new_top->children, right_root);
+	left_root->is_root = right_root->is_root = false;
+	left_root->parent = right_root->parent = new_top;
+	bpt_link_levels(left_root, right_root);
+	left->root = new_top;
+	bpt_free_merged_tree(left, right);
+
+	/* The right one first, since merge frees the right node */
+	bpt_fix_underflow(left, right_root);
+	bpt_fix_underflow(left, left_root);
+
+	return true;
+    }
+
+    if (left_height > right_height){
+	higher = left;
+	attached = right->root;
+	spine = left->root;
+	for (depth = left_height - right_height; depth > 0; depth--)
+	    spine = bpt_ref_index_child(spine, CHILDREN_LEN(spine) - 1);
+	bpt_link_levels(spine, attached);
+    }else{
+	higher = right;
+	attached = left->root;
+	spine = right->root;
+	for (depth = right_height - left_height; depth > 0; depth--)
+	    spine = bpt_ref_index_child(spine, 0);
+	bpt_link_levels(attached, spine);
+    }
+
+    attached->is_root = false;
+    attached->parent = spine->parent;
+
+    /*
+     * Insert the attached root as a child next to the spine node. The
+     * split nodes are counted by 'left', which takes over the root.
+     */
+    left->root = higher->root;
+    if (higher == left)
+	bpt_insert_internal(left, spine->parent,
+			    bpt_ref_subtree_minimum_key(attached), NULL,
+			    CHILDREN_LEN(spine->parent), attached);
+    else
+	bpt_insert_internal(left, spine->parent,
+			    bpt_ref_subtree_minimum_key(spine), NULL,
+			    0, attached);
+    bpt_free_merged_tree(left, right);
+
+    bpt_fix_underflow(left, attached);
+
+    return true;
+}
+
+/*
+ * Return the key which follows the removed key in the leaf chain, or
+ * NULL if the removed key is the last one.
+ */
+static void *
+bpt_ref_key_after(bpt_node *leaf, void *removed_key){
+    linked_list *keys = leaf->keys;
+    void *key;
+    int index;
+
+    ll_begin_iter(keys);
+    for (index = 0; index < KEY_LEN(leaf); index++){
+	key = ll_get_iter_data(keys);
+	if (keys->key_compare_cb(key, removed_key,
+				 keys->keys_compare_metadata) == 0)
+	    break;
+    }
+    ll_end_iter(keys);
+
+    if (index + 1 < KEY_LEN(leaf))
+	return ll_ref_index_data(keys, index + 1);
+    else if (leaf->next != NULL && KEY_LEN(leaf->next) > 0)
+	return ll_ref_index_data(leaf->next->keys, 0);
+    else
+	return NULL;
+}
+
+/*
+ * The compaction cursors are keys in the tree. Before the key is removed
+ * from the leaf, move any cursor on it to the next key, so that the cursor
+ * never refers to the key the application might free.
+ */
+static void
+bpt_move_cursors_off_key(bpt_tree *bpt, bpt_node *leaf, void *removed_key){
+    linked_list *keys = leaf->keys;
+
+    if (bpt->compact_key != NULL &&
+	keys->key_compare_cb(bpt->compact_key, removed_key,
+			     keys->keys_compare_metadata) == 0)
+	bpt->compact_key = bpt_ref_key_after(leaf, removed_key);
+
+    if (bpt->fill_key != NULL &&
+	keys->key_compare_cb(bpt->fill_key, removed_key,
+			     keys->keys_compare_metadata) == 0)
+	bpt->fill_key = bpt_ref_key_after(leaf, removed_key);
+}
+
+/*
+ * Detach the empty node from its parent and free it. Repeat it for the
+ * parent which has lost its last child. Return the lowest node left.
+ *
+ * No other rebalance is done here. This is a part of the relaxed deletion.
+ */
+static bpt_node *
+bpt_remove_empty_node(bpt_tree *bpt, bpt_node *curr){
+    bpt_node *parent;
+    int index;
+
+    while(!curr->is_root && bpt_node_is_empty(curr)){
+	parent = curr->parent;
+	index = bpt_child_index(parent, curr);
+
+	(void) ll_index_remove(parent->children, index);
+	if (KEY_LEN(parent) > 0)
+	    (void) ll_index_remove(parent->keys, index > 0 ? index - 1 : 0);
+	if (parent->abbrevs != NULL)
+	    bpt_sync_abbrev_cache(parent);
+	bpt_free_empty_node(bpt, curr);
+
+	printf("debug : removed the empty node from the parent %p\n", parent);
+
+	curr = parent;
+    }
+
+    /* Everything has gone. The root becomes an empty leaf again */
+    if (curr->is_root && bpt_node_is_empty(curr))
+	bpt_turn_into_leaf(bpt, curr);
+
+    bpt_refresh_upward(bpt, curr);
+
+    return curr;
+}
+
+/*
+ * Remove the key and record from the leaf in the relaxed deletion mode.
+ *
+ * Unlike bpt_delete_internal(), don't borrow or merge for the underflow
+ * and don't replace the separators in the upper nodes. Only the emptied
+ * leaf is detached. bpt_lazy_compact() restores them later.
+ */
+static void
+bpt_lazy_delete_internal(bpt_tree *bpt, bpt_node *leaf, void *removed_key,
+			 void **record){
+    void *removed_record;
+
+    /* Keep the compaction cursors on the live keys */
+    bpt_move_cursors_off_key(bpt, leaf, removed_key);
+
+    removed_record = bpt_get_key_value_from_leaf(leaf, true, removed_key);
+    if (record != NULL)
+	*record = bpt_keep_removed_record(bpt, removed_record);
+
+    printf("debug : lazily removed key = '%lu' on the leaf node\n",
+	   (uintptr_t) removed_key);
+
+    bpt->lazy_pending++;
+
+    if (bpt_node_is_empty(leaf))
+	(void) bpt_remove_empty_node(bpt, leaf);
+    else
+	bpt_refresh_upward(bpt, leaf);
+}
+
+/*
+ * Restore the B+ tree properties around one leaf for the compaction and
+ * return the next leaf to visit.
+ *
+ * First, rewrite the separator which bounds the leaf from the left side
+ * with the leaf's minimum key. Every separator is the left bound of
+ * exactly one leaf, so one pass over the leaves fixes all separators
+ * left by the relaxed deletion.
+ *
+ * Then, fix the underflow of the leaf and the upper nodes whose leftmost
+ * leaf is this one. This checks each internal node once per pass.
+ */
+static bpt_node *
+bpt_lazy_compact_leaf(bpt_tree *bpt, bpt_node *leaf){
+    bpt_node *curr;
+    void *next_key = NULL;
+    int index;
+
+    if (leaf->is_root)
+	return NULL;
+
+    for (curr = leaf; !curr->is_root; curr = curr->parent){
+	if ((index = bpt_child_index(curr->parent, curr)) > 0){
+	    bpt_replace_key_at(curr->parent, index - 1,
+			       ll_ref_index_data(leaf->keys, 0));
+	    break;
+	}
+    }
+
+    for (curr = leaf; !curr->is_root; curr = curr->parent){
+	if (bpt_node_underflow(bpt, curr)){
+	    /*
+	     * The leaf and its next leaf can be merged or freed. Find the
+	     * next leaf by the key after the fix.
+	     */
+	    if (leaf->next != NULL)
+		next_key = ll_ref_index_data(leaf->next->keys, 0);
+
+	    bpt_fix_underflow(bpt, curr);
+
+	    return next_key != NULL ? bpt_ref_leaf_by_key(bpt, next_key) : NULL;
+	}
+
+	if (bpt_child_index(curr->parent, curr) > 0)
+	    break;
+    }
+
+    return leaf->next;
+}
+
+/*
+ * Incrementally restore the B+ tree properties after relaxed deletions.
+ *
+ * Visit at most 'budget' leaves from where the previous call stopped.
+ * Return true when a whole pass has completed without any new relaxed
+ * deletion since the pass started. Otherwise, return false and resume
+ * from the same position next time.
+ */
+bool
+bpt_lazy_compact(bpt_tree *bpt, uintptr_t budget){
+    bpt_node *leaf;
+
+    if (bpt == NULL || bpt->root == NULL)
+	return true;
+
+    if (bpt->compact_key == NULL){
+	/* Nothing has been deleted lazily since the last pass */
+	if (bpt->lazy_pending == 0)
+	    return true;
+
+	bpt->lazy_pending = 0;
+	leaf = bpt_ref_leftmost_leaf_node(bpt);
+    }else
+	leaf = bpt_ref_leaf_by_key(bpt, bpt->compact_key);
+
+    printf("debug : bpt_lazy_compact() from leaf = %p\n", leaf);
+
+    bpt_release_retired(bpt);
+
+    for (; leaf != NULL && budget > 0; budget--)
+	leaf = bpt_lazy_compact_leaf(bpt, leaf);
+
+    if (leaf != NULL){
+	bpt->compact_key = ll_ref_index_data(leaf->keys, 0);
+	return false;
+    }
+
+    /* Done with one pass */
+    bpt->compact_key = NULL;
+    bpt_collapse_root(bpt);
+    bpt_refresh_node(bpt, bpt->root);
+
+    return bpt->lazy_pending == 0;
+}
+
+/*
+ * Switch between the eager and relaxed deletion modes.
+ *
+ * In the relaxed mode, bpt_delete() only removes the leaf entry and
+ * frees the leaf when it becomes empty. The removed key can stay as a
+ * separator of upper nodes, so the application must keep the key alive
+ * until bpt_lazy_compact() completes a pass. Switching back to the eager
+ * mode completes the compaction at once.
+ */
+void
+bpt_set_lazy_delete(bpt_tree *bpt, bool lazy_delete){
+    if (bpt == NULL)
+	return;
+
+    if (bpt->lazy_delete && !lazy_delete)
+	while(!bpt_lazy_compact(bpt, UINTPTR_MAX))
+	    ;
+
+    bpt->lazy_delete = lazy_delete;
+}
+
+/*
+ * Return the number of keys per leaf for the fill factor.
+ *
+ * Never go below the minimum number of keys of the tree.
+ */
+static int
+bpt_fill_target(bpt_tree *bpt, double target_fill){
+    int target = (int) (target_fill * bpt->max_keys + 0.5);
+
+    if (target < GET_MIN_KEY_NUM(bpt->max_keys))
+	target = GET_MIN_KEY_NUM(bpt->max_keys);
+    if (target < 1)
+	target = 1;
+    if (target > bpt->max_keys)
+	target = bpt->max_keys;
+
+    return target;
+}
+
+/*
+ * Rewrite the separator which bounds the leaf from the left side with
+ * the leaf's current minimum key.
+ */
+static void
+bpt_update_left_separator(bpt_node *leaf){
+    bpt_node *curr;
+    int index;
+
+    for (curr = leaf; !curr->is_root; curr = curr->parent){
+	if ((index = bpt_child_index(curr->parent, curr)) > 0){
+	    bpt_replace_key_at(curr->parent, index - 1,
+			       ll_ref_index_data(leaf->keys, 0));
+	    break;
+	}
+    }
+}
+
+/*
+ * Fill one leaf up to 'target' keys with the entries of the next leaves
+ * and return the next leaf to visit.
+ *
+ * The next leaf can have another parent. Its separator is rewritten with
+ * its new minimum key. When it becomes empty, it's freed together with
+ * the emptied upper nodes and the underflow of the parent is fixed.
+ */
+static bpt_node *
+bpt_fill_leaf(bpt_tree *bpt, bpt_node *leaf, int target){
+    bpt_node *next, *parent;
+
+    while(KEY_LEN(leaf) < target && (next = leaf->next) != NULL){
+	while(KEY_LEN(leaf) < target && KEY_LEN(next) > 0){
+	    ll_tail_insert(leaf->keys, ll_remove_first_data(next->keys));
+	    ll_tail_insert(leaf->children,
+			   ll_remove_first_data(next->children));
+	}
+	bpt_refresh_upward(bpt, leaf);
+
+	if (KEY_LEN(next) > 0){
+	    bpt_update_left_separator(next);
+	    bpt_refresh_upward(bpt, next);
+	    break;
+	}
+
+	printf("debug : freed the leaf %p drained by compaction\n", next);
+
+	parent = bpt_remove_empty_node(bpt, next);
+	if (leaf->next != NULL)
+	    bpt_update_left_separator(leaf->next);
+	if (!parent->is_root && bpt_node_underflow(bpt, parent))
+	    bpt_fix_underflow(bpt, parent);
+    }
+
+    bpt_node_validity(leaf);
+
+    return leaf->next;
+}
+
+/*
+ * Defragment the leaves to 'target_fill' of 'max_keys' incrementally.
+ *
+ * Each call fills at most 'budget' leaves along the leaf chain by moving
+ * entries from the next leaves, freeing drained nodes and fixing their
+ * separators. The next call resumes from where this one stopped. Return
+ * true when the pass reached the last leaf.
+ *
+ * See bpt_compact_reclaimable() to decide when this is worthwhile.
+ */
+bool
+bpt_compact(bpt_tree *bpt, double target_fill, uintptr_t budget){
+    bpt_node *leaf;
+    int target;
+
+    if (bpt == NULL || bpt->root == NULL)
+	return true;
+
+    if (target_fill <= 0.0 || target_fill > 1.0){
+	fprintf(stderr, "target fill factor should be in the range of (0, 1]\n");
+	return true;
+    }
+
+    /* The relaxed deletion leaves separators to be fixed first */
+    if (bpt->lazy_delete && !bpt_lazy_compact(bpt, budget))
+	return false;
+
+    target = bpt_fill_target(bpt, target_fill);
+
+    if (bpt->fill_key == NULL)
+	leaf = bpt_ref_leftmost_leaf_node(bpt);
+    else
+	leaf = bpt_ref_leaf_by_key(bpt, bpt->fill_key);
+
+    printf("debug : bpt_compact() from leaf = %p with %d keys per leaf\n",
+	   leaf, target);
+
+    bpt_release_retired(bpt);
+
+    for (; leaf != NULL && budget > 0; budget--)
+	leaf = bpt_fill_leaf(bpt, leaf, target);
+
+    if (leaf != NULL){
+	bpt->fill_key = ll_ref_index_data(leaf->keys, 0);
+	return false;
+    }
+
+    /* Done with one pass. The last leaf may have too few keys */
+    bpt->fill_key = NULL;
+    leaf = bpt_ref_subtree_rightmost_leaf(bpt->root);
+    if (!leaf->is_root && bpt_node_underflow(bpt, leaf))
+	bpt_fix_underflow(bpt, leaf);
+    bpt_collapse_root(bpt);
+    bpt_refresh_node(bpt, bpt->root);
+
+    return true;
+}
+
+/*
+ * Return the number of leaves that bpt_compact() with 'target_fill'
+ * would free, from the counters of bpt_stats_fast().
+ */
+uintptr_t
+bpt_compact_reclaimable(bpt_tree *bpt, double target_fill){
+    uintptr_t needed;
+    int target;
+
+    if (bpt == NULL || bpt->root == NULL ||
+	target_fill <= 0.0 || target_fill > 1.0)
+	return 0;
+
+    target = bpt_fill_target(bpt, target_fill);
+
+    bpt_settle_counts(bpt);
+    needed = (bpt->key_count + target - 1) / target;
+    if (needed == 0)
+	needed = 1;
+
+    return bpt->leaf_count > needed ? bpt->leaf_count - needed : 0;
+}
+
+/*
+ * Register the subtree aggregate callbacks.
+ *
+ * Every node caches the aggregate of its records or children, which is
+ * maintained on insert, delete, split, merge and borrow. Call this right
+ * after bpt_init(). If the tree has some data already, all the aggregates
+ * are computed here once.
+ */
+bool
+bpt_set_aggregate(bpt_tree *bpt, uintptr_t aggregate_size,
+		  bpt_agg_identity_cb agg_identity,
+		  bpt_agg_record_cb agg_record,
+		  bpt_agg_combine_cb agg_combine){
+    if (bpt == NULL || bpt->root == NULL)
+	return false;
+
+    if (aggregate_size == 0 || agg_identity == NULL ||
+	agg_record == NULL || agg_combine == NULL){
+	fprintf(stderr,
+		"aggregate size and all aggregate callbacks are required\n");
+	return false;
+    }
+
+    if (bpt->agg_combine != NULL){
+	fprintf(stderr, "aggregate callbacks are registered already\n");
+	return false;
+    }
+
+    bpt->aggregate_size = aggregate_size;
+    bpt->agg_identity = agg_identity;
+    bpt->agg_record = agg_record;
+    bpt->agg_combine = agg_combine;
+
+    bpt_refresh_subtree(bpt, bpt->root);
+
+    return true;
+}
+
+/*
+ * Register the key abbreviation for the key search, or disable it with
+ * NULL.
+ *
+ * Each node caches the abbreviations of its keys, so that most keys are
+ * compared as integers without accessing them. The comparison callback
+ * is called only when the abbreviations are equal. With 'key_prefix',
+ * each node also keeps the length of the prefix common to its keys and
+ * abbreviates only the rest, which is the part to tell the keys apart.
+ * This isn't prefix compression. The keys are application-owned and
+ * stay stored in full, so neither the key memory nor the fanout change.
+ *
+ * bpt_init() registers bkh_ordered_key_abbrev() and
+ * bkh_ordered_key_prefix() for the built-in comparison of memcmp()
+ * comparable composite keys.
+ */
+void
+bpt_set_key_abbrev(bpt_tree *bpt, bpt_key_abbrev_cb key_abbrev,
+		   bpt_key_prefix_cb key_prefix){
+    if (bpt == NULL)
+	return;
+
+    bpt->key_abbrev = key_abbrev;
+    bpt->key_prefix = key_abbrev != NULL ? key_prefix : NULL;
+    bpt_renew_abbrev_epoch(bpt);
+}
+
+/*
+ * Register the suffix truncation of separators, or disable it with NULL.
+ *
+ * When a leaf splits, 'key_separator' makes the shortest key between the
+ * two leaves, which goes up to the parent instead of the first key of the
+ * right leaf. Such separators are owned by the tree and freed by
+ * 'separator_free', or free() if it's NULL, once they are no longer used.
+ * They also keep the internal nodes from pointing to the application's
+ * keys. bkh_ordered_key_separator() is the callback for memcmp()
+ * comparable composite keys.
+ *
+ * The callbacks can't be switched while the tree owns some separators.
+ */
+bool
+bpt_set_key_separator(bpt_tree *bpt, bpt_key_separator_cb key_separator,
+		      bpt_free_cb separator_free){
+    if (bpt == NULL || bpt->root == NULL)
+	return false;
+
+    if (bpt_uses_separators(bpt)){
+	fprintf(stderr, "separators are in use by the tree already\n");
+	return false;
+    }
+
+    /* The separators left are unused, or belong to the other trees */
+    bpt_leave_separators(bpt);
+    bpt_renew_abbrev_epoch(bpt);
+
+    bpt->key_separator = key_separator;
+    bpt->separator_free = key_separator != NULL ? separator_free : NULL;
+
+    return true;
+}
+
+/*
+ * Leaf pages are switched only while the tree is empty.
+ */
+static bool
+bpt_leaf_pages_settable(bpt_tree *bpt){
+    if (bpt == NULL || bpt->root == NULL)
+	return false;
+
+    if (KEY_LEN(bpt->root) > 0 || !bpt->root->is_leaf){
+	fprintf(stderr, "leaf pages can be set up only for an empty tree\n");
+	return false;
+    }
+
+    return true;
+}
+
+/*
+ * Lay out the empty root leaf again in the new page configuration.
+ */
+static void
+bpt_reset_leaf_pages(bpt_tree *bpt){
+    bpt_release_retired(bpt);
+    if (bpt->root->page != NULL){
+	bpt_retire(bpt, bpt->root->page);
+	bpt->root->page = NULL;
+    }
+    bpt_refresh_node(bpt, bpt->root);
+}
+
+/*
+ * Store the records in one page of 'page_size' bytes per leaf, or stop
+ * it with zero. See bpt_page_header for the layout.
+ *
+ * 'record_length' returns the bytes of one record. The records up to the
+ * inline limit, which 'max_keys + 1' records can fill a page with, are
+ * copied into the pages, and bpt_search() and bpt_delete() return the
+ * copies. Longer ones are copied once by bpt_insert() and kept out of
+ * line. In either case, the application can free its record after the
+ * insertion, and the returned records are valid only until the next
+ * update of the tree. The records' free callback gets such copies, so it
+ * must free only what the records refer to.
+ *
+ * Only for an empty tree. Replaces bpt_set_record_size().
+ */
+bool
+bpt_set_leaf_pages(bpt_tree *bpt, uintptr_t page_size,
+		   bpt_record_length_cb record_length){
+    uintptr_t slots_num, inline_limit = 0;
+
+    if (!bpt_leaf_pages_settable(bpt))
+	return false;
+
+    if (page_size > 0){
+	if (record_length == NULL){
+	    fprintf(stderr, "leaf pages require the record length callback\n");
+	    return false;
+	}
+
+	if (page_size > BPT_PAGE_MAX_SIZE || page_size % BPT_PAGE_ALIGN != 0){
+	    fprintf(stderr,
+		    "page size should be a multiple of %d up to %d\n",
+		    BPT_PAGE_ALIGN, BPT_PAGE_MAX_SIZE);
+	    return false;
+	}
+
+	slots_num = bpt->max_keys + 1;
+	if (page_size > sizeof(bpt_page_header) +
+	    slots_num * sizeof(bpt_page_slot))
+	    inline_limit = (page_size - sizeof(bpt_page_header) -
+			    slots_num * sizeof(bpt_page_slot)) / slots_num;
+	inline_limit &= ~((uintptr_t) BPT_PAGE_ALIGN - 1);
+
+	/* Every slot must have the space for an out-of-line record at least */
+	if (inline_limit < sizeof(bpt_page_overflow)){
+	    fprintf(stderr, "page size is too small for %u records\n",
+		    (unsigned) slots_num);
+	    return false;
+	}
+    }
+
+    bpt->page_size = page_size;
+    bpt->inline_limit = inline_limit;
+    bpt->record_length = page_size > 0 ? record_length : NULL;
+    bpt->record_size = 0;
+    bpt_reset_leaf_pages(bpt);
+
+    return true;
+}
+
+/*
+ * Store the records of 'record_size' bytes inline in the leaves, or stop
+ * it with zero.
+ *
+ * Each leaf has one array of 'max_keys + 1' records parallel to its
+ * keys, followed by the number of its records. bpt_insert() copies the
+ * record into it and shifts the following ones. bpt_search() returns
+ * the pointers into the array, valid only until the next update of the
+ * tree, so a lookup doesn't visit another allocation. bpt_delete()
+ * returns a copy valid for as long.
+ * The records' free callback gets such copies, so it must free only what
+ * the records refer to.
+ *
+ * Only for an empty tree. Replaces bpt_set_leaf_pages().
+ */
+bool
+bpt_set_record_size(bpt_tree *bpt, uintptr_t record_size){
+    if (!bpt_leaf_pages_settable(bpt))
+	return false;
+
+    /* Zero stops the inline records as bpt_set_leaf_pages() stops pages */
+    bpt->page_size = record_size > 0 ?
+	record_size * (bpt->max_keys + 1) + sizeof(uint32_t) : 0;
+    bpt->inline_limit = record_size;
+    bpt->record_length = NULL;
+    bpt->record_size = record_size;
+    bpt_reset_leaf_pages(bpt);
+
+    return true;
+}
+
+/*
+ * Return the 'index'-th record in one leaf page and its length, or NULL
+ * for no such slot. The out-of-line record is returned for its stub.
+ * Only for the pages of bpt_set_leaf_pages().
+ */
+void *
+bpt_page_ref_record(void *page, int index, uintptr_t *length){
+    bpt_page_header *header = (bpt_page_header *) page;
+    bpt_page_slot *slot;
+    bpt_page_overflow *overflow;
+
+    if (page == NULL || index < 0 || index >= header->slots_num)
+	return NULL;
+
+    slot = (bpt_page_slot *) (header + 1) + index;
+    if (slot->length == BPT_PAGE_OVERFLOW){
+	overflow = (bpt_page_overflow *) ((char *) page + slot->offset);
+	if (length != NULL)
+	    *length = overflow->length;
+	return overflow->record;
+    }
+
+    if (length != NULL)
+	*length = slot->length;
+
+    return (char *) page + slot->offset;
+}
+
+/*
+ * Allocate the nodes from an arena of slabs, or go back to one allocation
+ * per node with false.
+ *
+ * The arena packs the nodes next to each other without the overhead of
+ * malloc() per node. The nodes still refer to each other by pointers.
+ * The freed nodes stay in the arena for reuse until the tree is
+ * destroyed. The trees cut off by bpt_split_at() share the arena, so they
+ * must not be updated concurrently. Only the trees of one arena can be
+ * concatenated.
+ *
+ * Only for an empty tree.
+ */
+bool
+bpt_set_node_arena(bpt_tree *bpt, bool arena){
+    bpt_node_arena *old;
+    bpt_node *root;
+
+    if (bpt == NULL || bpt->root == NULL)
+	return false;
+
+    if (KEY_LEN(bpt->root) > 0 || !bpt->root->is_leaf){
+	fprintf(stderr, "node arena can be set up only for an empty tree\n");
+	return false;
+    }
+
+    old = bpt->arena;
+    if (arena == (old != NULL))
+	return true;
+
+    bpt->arena = NULL;
+    if (arena){
+	bpt->arena = (bpt_node_arena *) bpt_malloc(sizeof(bpt_node_arena));
+	bpt->arena->refs = 1;
+	bpt->arena->slabs = NULL;
+	bpt->arena->slabs_num = bpt->arena->slabs_size = 0;
+	bpt->arena->used = 0;
+	bpt->arena->free_nodes = NULL;
+    }
+
+    /* Move the empty root into the new allocation */
+    root = bpt_alloc_node(bpt);
+    *root = *bpt->root;
+    if (old == NULL)
+	free(bpt->root);
+    else{
+	bpt->root->next = old->free_nodes;
+	old->free_nodes = bpt->root;
+    }
+    bpt->root = root;
+
+    bpt_arena_release(old);
+
+    return true;
+}
+
+/*
+ * Pack the keys of each leaf by frame of reference for the key search,
+ * or stop it with NULL.
+ *
+ * 'key_integer' maps the keys to integers in the same order, e.g. the
+ * identity for integer keys. Each leaf keeps the deltas of its keys from
+ * its first key in the narrowest of 1, 2, 4 and 8 bytes, chosen again
+ * whenever the leaf changes. The search in a leaf then scans the deltas
+ * instead of calling the comparison for each key. Dense keys such as
+ * serial ids take one or two bytes per key in the scan.
+ *
+ * The keys themselves stay in the leaves, so the packed keys are an
+ * extra copy: they shrink what the search reads, not the memory of the
+ * tree. Each leaf adds one block of 'max_keys + 1' deltas rounded up to
+ * a cache line, counted by bpt_stats(), and every update of a leaf
+ * rewrites its deltas.
+ */
+bool
+bpt_set_key_packing(bpt_tree *bpt, bpt_key_integer_cb key_integer){
+    bpt_node *leaf;
+
+    if (bpt == NULL || bpt->root == NULL)
+	return false;
+
+    bpt->key_integer = key_integer;
+
+    for (leaf = bpt_ref_leftmost_leaf_node(bpt); leaf != NULL;
+	 leaf = leaf->next){
+	bpt->packed_bytes -= bpt_packed_footprint(bpt, leaf->packed);
+	free(leaf->packed);
+	leaf->packed = NULL;
+	if (key_integer != NULL)
+	    bpt_pack_leaf_keys(bpt, leaf);
+    }
+
+    return true;
+}
+
+/*
+ * Combine the records whose keys are between 'lo' and 'hi' (inclusive)
+ * into 'out'.
+ *
+ * The 'above_lo' and 'below_hi' flags tell whether the parent has
+ * already proved that every key of this subtree satisfies each bound.
+ * When both are true, the cached aggregate of the whole subtree is used
+ * without descending. Only the subtrees on the two boundary paths are
+ * visited.
+ */
+static void
+bpt_aggregate_range_internal(bpt_tree *bpt, bpt_node *curr, void *lo,
+			     void *hi, bool above_lo, bool below_hi,
+			     void *out){
+    linked_list *keys = curr->keys;
+    void *key, *prev_key, *record;
+    bpt_node *child;
+    bool child_above_lo, child_below_hi;
+
+    if (above_lo && below_hi){
+	bpt->agg_combine(out, curr->aggregate);
+	return;
+    }
+
+    if (curr->is_leaf){
+	ll_begin_iter(keys);
+	ll_begin_iter(curr->children);
+	while((key = ITER_BPT_KEY(curr)) != NULL){
+	    record = ll_get_iter_data(curr->children);
+	    if (!above_lo &&
+		keys->key_compare_cb(key, lo, keys->keys_compare_metadata) == -1)
+		continue;
+	    if (!below_hi &&
+		keys->key_compare_cb(key, hi, keys->keys_compare_metadata) == 1)
+		break;
+	    bpt->agg_record(out, record);
+	}
+	ll_end_iter(keys);
+	ll_end_iter(curr->children);
+
+	return;
+    }
+
+    /*
+     * The i-th child contains the keys which are equal to or bigger than
+     * the (i - 1)-th key and smaller than the i-th key.
+     */
+    prev_key = NULL;
+    ll_begin_iter(keys);
+    ll_begin_iter(curr->children);
+    while((child = ITER_BPT_CHILD(curr)) != NULL){
+	key = ITER_BPT_KEY(curr);
+
+	/* All keys of this child are smaller than 'lo' */
+	if (!above_lo && key != NULL &&
+	    keys->key_compare_cb(key, lo, keys->keys_compare_metadata) != 1){
+	    prev_key = key;
+	    continue;
+	}
+
+	/* All keys of this and the rest children are bigger than 'hi' */
+	if (!below_hi && prev_key != NULL &&
+	    keys->key_compare_cb(prev_key, hi, keys->keys_compare_metadata) == 1)
+	    break;
+
+	child_above_lo = above_lo || (prev_key != NULL &&
+				      keys->key_compare_cb(prev_key, lo,
+							   keys->keys_compare_metadata) != -1);
+	child_below_hi = below_hi || (key != NULL &&
+				      keys->key_compare_cb(key, hi,
+							   keys->keys_compare_metadata) != 1);
+
+	bpt_aggregate_range_internal(bpt, child, lo, hi,
+				     child_above_lo, child_below_hi, out);
+	prev_key = key;
+    }
+    ll_end_iter(keys);
+    ll_end_iter(curr->children);
+}
+
+/*
+ * Write the aggregate of all records whose keys are between 'lo' and
+ * 'hi' (inclusive) to 'out', which has 'aggregate_size' bytes.
+ *
+ * Return false if the tree has no aggregate callbacks.
+ */
+bool
+bpt_aggregate_range(bpt_tree *bpt, void *lo, void *hi, void *out){
+    linked_list *keys;
+
+    if (bpt == NULL || bpt->root == NULL || out == NULL ||
+	lo == NULL || hi == NULL)
+	return false;
+
+    if (bpt->agg_combine == NULL){
+	fprintf(stderr, "no aggregate callbacks are registered\n");
+	return false;
+    }
+
+    bpt->agg_identity(out);
+
+    keys = bpt->root->keys;
+    if (keys->key_compare_cb(lo, hi, keys->keys_compare_metadata) == 1)
+	return true;
+
+    bpt_aggregate_range_internal(bpt, bpt->root, lo, hi, false, false, out);
+
+    return true;
+}
+
+/*
+ * Return the size of one node and its aggregate, without the lists.
+ */
+static uintptr_t
+bpt_node_footprint(bpt_tree *bpt){
+    return sizeof(bpt_node) +
+	(bpt->agg_combine != NULL ? bpt->aggregate_size : 0);
+}
+
+/*
+ * Return the size of what one leaf has beyond bpt_node_footprint(),
+ * without the packed keys.
+ */
+static uintptr_t
+bpt_leaf_footprint(bpt_tree *bpt){
+    return bpt_aligned_size(BPT_CACHE_LINE_SIZE, bpt->page_size);
+}
+
+/*
+ * Return the size of one key if the tree uses the composite keys.
+ */
+static uintptr_t
+bpt_key_footprint(bpt_tree *bpt){
+    composite_key_store *cks = bpt->root->keys->keys_compare_metadata;
+
+    return cks != NULL ? cks->full_key_size : 0;
+}
+
+/*
+ * Return the O(1) subset of bpt_stats() from the counters.
+ *
+ * The first call after bpt_split_at() walks the tree once to settle
+ * the counters of the moved subtrees.
+ *
+ * The entries of the lists aren't counted one by one. Each non-root node
+ * is one child of an internal node, which has one key fewer than
+ * children. Each leaf has the same numbers of keys and records.
+ */
+bool
+bpt_stats_fast(bpt_tree *bpt, bpt_tree_stats *stats){
+    uintptr_t entries;
+
+    if (bpt == NULL || bpt->root == NULL || stats == NULL)
+	return false;
+
+    memset(stats, 0, sizeof(bpt_tree_stats));
+
+    bpt_settle_counts(bpt);
+    stats->keys = bpt->key_count;
+    stats->nodes = bpt->leaf_count + bpt->internal_count;
+
+    entries = 2 * bpt->key_count + 2 * (stats->nodes - 1) - bpt->internal_count;
+    stats->bytes = stats->nodes * bpt_node_footprint(bpt) +
+	bpt->leaf_count * bpt_leaf_footprint(bpt) + bpt->packed_bytes +
+	stats->nodes * 2 * sizeof(linked_list) + entries * sizeof(node) +
+	bpt->key_count * bpt_key_footprint(bpt);
+
+    return true;
+}
+
+/*
+ * Walk the whole tree level by level and return all the statistics.
+ */
+bool
+bpt_stats(bpt_tree *bpt, bpt_tree_stats *stats){
+    bpt_node *curr, *leftmost;
+    uintptr_t leaf_keys = 0, internal_keys = 0, entries = 0, packed_bytes = 0;
+    int bucket;
+
+    if (bpt == NULL || bpt->root == NULL || stats == NULL)
+	return false;
+
+    memset(stats, 0, sizeof(bpt_tree_stats));
 
-	/* The current node gets merged with the previous one */
-	deleted_key = bpt_merge_nodes(curr, false);
-	printf("debug : this merge decrements the number of parent's keys to '%d'\n",
-	       KEY_LEN(prev->parent));
+    for (curr = bpt->root; curr != NULL; curr = leftmost){
+	leftmost = curr->is_leaf ? NULL : bpt_ref_index_child(curr, 0);
+	stats->height++;
 
-	/*
-	 * Incorporate the split key from parent to the current node,
-	 * if this is an internal node.
-	 */
-	if (prev->is_leaf == false){
-	    ll_asc_insert(prev->keys, deleted_key);
-	    printf("debug : incorporate the split key = %lu from parent to child\n",
-		   (uintptr_t) deleted_key);
-	}
+	for (; curr != NULL; curr = curr->next){
+	    if (curr->is_leaf){
+		stats->leaf_nodes++;
+		leaf_keys += KEY_LEN(curr);
+		packed_bytes += bpt_packed_footprint(bpt, curr->packed);
+	    }else{
+		stats->internal_nodes++;
+		internal_keys += KEY_LEN(curr);
+	    }
+	    entries += KEY_LEN(curr) + CHILDREN_LEN(curr);
 
-	/* Verify the node property */
-	bpt_node_validity(prev);
+	    bucket = KEY_LEN(curr) * BPT_FILL_BUCKETS / bpt->max_keys;
+	    if (bucket >= BPT_FILL_BUCKETS)
+		bucket = BPT_FILL_BUCKETS - 1;
+	    stats->fill_histogram[bucket]++;
+	}
+    }
 
-	/*
-	 * Go up by using the saved reference of previous sibling.
-	 * Avoid the call of the bpt_delete_internal() that uses
-	 * current node below.
-	 */
-	if (prev->parent)
-	    bpt_delete_internal(bpt, prev->parent, removed_key, record);
+    stats->keys = leaf_keys;
+    stats->nodes = stats->leaf_nodes + stats->internal_nodes;
 
-	return true;
+    stats->leaf_fill = (double) leaf_keys /
+	(stats->leaf_nodes * bpt->max_keys);
+    if (stats->internal_nodes > 0)
+	stats->internal_fill = (double) internal_keys /
+	    (stats->internal_nodes * bpt->max_keys);
 
-    }else if (HAVE_SAME_PARENT(curr, curr->next)){
-	/*
-	 * This path merges the current node with the next node.
-	 * Any left data in the next node will be moved to the current
-	 * node. Thus, after the bpt_merge_nodes(), attributes of the
-	 * current node are available.
-	 */
-	void *deleted_key;
+    stats->node_bytes = stats->nodes * bpt_node_footprint(bpt) +
+	stats->leaf_nodes * bpt_leaf_footprint(bpt) + packed_bytes;
+    stats->list_bytes = stats->nodes * 2 * sizeof(linked_list) +
+	entries * sizeof(node);
+    stats->key_bytes = leaf_keys * bpt_key_footprint(bpt);
+    stats->bytes = stats->node_bytes + stats->list_bytes + stats->key_bytes;
 
-	printf("debug : bpt_merge_nodes() with right node\n");
+    return true;
+}
 
-	deleted_key = bpt_merge_nodes(curr, true);
-	printf("debug : this merge decrements the number of parent's keys to '%d'\n",
-	       KEY_LEN(curr->parent));
+/*
+ * Sum up the operation counters of all the threads.
+ *
+ * Return false with zero counters if the library is built without
+ * -DBPT_COUNTERS. The slots are read without synchronization, so
+ * the snapshot may miss the counts in progress.
+ */
+bool
+bpt_counters_snapshot(bpt_tree *bpt, bpt_counters *snapshot){
+    bpt_counters *slot;
+    int i;
 
-	/*
-	 * Incorporate the split key from parent to the current node,
-	 * if this is an internal node.
-	 */
-	if (curr->is_leaf == false){
-	    ll_asc_insert(curr->keys, deleted_key);
-	    printf("debug : incorporate the split key = %lu from parent to child\n",
-		   (uintptr_t) deleted_key);
-	}
+    if (snapshot == NULL)
+	return false;
 
-	/* Verify the node property */
-	bpt_node_validity(curr);
+    memset(snapshot, 0, sizeof(bpt_counters));
 
-	/* Go up */
-	if (curr->parent)
-	    bpt_delete_internal(bpt, curr->parent, removed_key, record);
+    if (bpt == NULL || bpt->counters == NULL)
+	return false;
 
-	return true;
+    for (i = 0; i < BPT_COUNTER_SLOTS; i++){
+	slot = &bpt->counters[i].counters;
+	snapshot->comparisons += slot->comparisons;
+	snapshot->nodes_visited += slot->nodes_visited;
+	snapshot->splits += slot->splits;
+	snapshot->root_splits += slot->root_splits;
+	snapshot->merges += slot->merges;
+	snapshot->borrows += slot->borrows;
+	snapshot->root_promotions += slot->root_promotions;
     }
 
-    return false;
+    return true;
 }
 
 /*
- * Remove the key (or index) from the current node.
- *
- * If the key is one of the indexes, then replace it with the minimum key
- * that could be fetched from the key's right child.
+ * Clear the operation counters of all the threads.
  */
-static void
-bpt_remove_key_from_node(bpt_tree *bpt, bpt_node *curr, void *removed_key,
-			 void **record){
-    if (curr->is_leaf){
-	/*
-	 * The call of bpt_search() before the first call of
-	 * bpt_delete_internal() already proves that the key exists.
-	 * So, this leaf node must contain the removed key.
-	 */
-	if (record == NULL){
-	    /*
-	     * Discard the corresponding record when user indicates
-	     * the record is not necessary.
-	     */
-	    (void) bpt_get_key_value_from_leaf(curr, true,
-					       removed_key);
-	}else{
-	    *record = bpt_get_key_value_from_leaf(curr, true,
-						  removed_key);
-	}
+void
+bpt_counters_reset(bpt_tree *bpt){
+    if (bpt == NULL || bpt->counters == NULL)
+	return;
 
-	printf("debug : removed key = '%lu' on the leaf node\n",
-	       (uintptr_t) removed_key);
+    memset(bpt->counters, 0, sizeof(bpt_counter_slot) * BPT_COUNTER_SLOTS);
+}
 
-	/* Verify the node property */
-	bpt_node_validity(curr);
-    }else{
-	/*
-	 * This internal node might or might not have the index.
-	 * If the indexes contain the key, then remove and replace
-	 * it with its right child's minimum key.
-	 */
-	if (ll_has_key(curr->keys, removed_key)){
-	    void *key;
-	    bpt_node *right_child;
+/*
+ * Return the bucket index of the value.
+ */
+static int
+bpt_histogram_index(uint64_t value){
+    int shift;
 
-	    right_child = bpt_ref_right_child_by_key(curr, removed_key);
-	    ll_remove_by_key(curr->keys, removed_key);
-	    assert((key = bpt_ref_subtree_minimum_key(right_child)) != NULL);
-	    ll_asc_insert(curr->keys, key);
+    if (value < (1 << BPT_HISTOGRAM_SUB_BITS))
+	return (int) value;
 
-	    printf("debug : removed %lu and inserted %lu as the min key\n",
-		   (uintptr_t) removed_key, (uintptr_t) key);
+    shift = 63 - __builtin_clzll(value) - BPT_HISTOGRAM_SUB_BITS;
 
-	    /* Verify the node property */
-	    bpt_node_validity(curr);
-	}
-    }
+    return ((shift + 1) << BPT_HISTOGRAM_SUB_BITS) +
+	(int) ((value >> shift) & ((1 << BPT_HISTOGRAM_SUB_BITS) - 1));
 }
 
 /*
- * The main internal processing of B+ tree deletion.
+ * Return the largest value that falls into the bucket.
  */
-static void
-bpt_delete_internal(bpt_tree *bpt, bpt_node *curr, void *removed_key,
-		    void **record){
-    assert(bpt != NULL);
-    assert(curr != NULL);
-    assert(removed_key != NULL);
-
-    printf("debug : bpt_delete_internal() for %p\n"
-           "debug : current node = %s and %s, the number of keys = %d, the number of children = %d\n",
-	   curr,
-	   curr->is_root ? "root" : "non-root",
-	   curr->is_leaf ? "leaf" : "non-leaf",
-	   KEY_LEN(curr), CHILDREN_LEN(curr));
+static uint64_t
+bpt_histogram_bucket_max(int index){
+    uint64_t mantissa;
+    int shift;
 
-    /*
-     * If the root promotion happens, then we have reached
-     * to the top of the tree and done with all the necessary
-     * steps to keep the B+ tree properties.
-     *
-     * Return and close this key deletion process.
-     */
-    if (bpt_root_promoted(bpt, curr))
-	return;
+    if (index < (1 << BPT_HISTOGRAM_SUB_BITS))
+	return (uint64_t) index;
 
-    /*
-     * --------------------------------------
-     * The main part of deletion process
-     * --------------------------------------
-     */
-    bpt_remove_key_from_node(bpt, curr, removed_key, record);
+    shift = (index >> BPT_HISTOGRAM_SUB_BITS) - 1;
+    mantissa = (index & ((1 << BPT_HISTOGRAM_SUB_BITS) - 1)) |
+	(1 << BPT_HISTOGRAM_SUB_BITS);
 
-    /*
-     * Execute the following steps to keep the b+ tree property.
-     */
-    if (KEY_LEN(curr) >= GET_MIN_KEY_NUM(bpt->max_keys)){
+    return (mantissa << shift) + ((uint64_t) 1 << shift) - 1;
+}
 
-	/* The current node has sufficient keys. Go up if possible */
-	if (!curr->is_root)
-	    bpt_delete_internal(bpt, curr->parent, removed_key, record);
+void
+bpt_histogram_record(bpt_histogram *histogram, uint64_t value){
+    histogram->buckets[bpt_histogram_index(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (histogram->max < value)
+	histogram->max = value;
+}
 
-	return;
+/*
+ * Add all the values recorded in 'src' to 'dst'.
+ */
+void
+bpt_histogram_merge(bpt_histogram *dst, bpt_histogram *src){
+    int i;
 
-    }else{
+    for (i = 0; i < BPT_HISTOGRAM_BUCKETS; i++)
+	dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (dst->max < src->max)
+	dst->max = src->max;
+}
 
-	/* Could borrow a key from either sibling ? */
-	if (bpt_borrowed_key_from_sibling(bpt, curr, removed_key, record)){
+void
+bpt_histogram_reset(bpt_histogram *histogram){
+    memset(histogram, 0, sizeof(bpt_histogram));
+}
 
-	    /* Go up to update index if we have an upper node */
-	    if (!curr->is_root)
-		bpt_delete_internal(bpt, curr->parent, removed_key, record);
+/*
+ * Return the value below or equal to which 'percentile' (0 - 100) of the
+ * recorded values are, by the nearest-rank method, as the largest value
+ * of its bucket. Never exceed the max value. Return zero for an empty
+ * histogram.
+ */
+uint64_t
+bpt_histogram_percentile(bpt_histogram *histogram, double percentile){
+    uint64_t rank, seen = 0, value;
+    double exact;
+    int i;
 
-	    return;
-	}
+    if (histogram->count == 0)
+	return 0;
 
-	printf("debug : borrowing a key didn't happen\n");
+    if (percentile >= 100.0)
+	return histogram->max;
 
-	/*
-	 * Merge nodes if possible.
-	 *
-	 * After the bpt_merged_and_rebalanced_nodes(), all of
-	 * the steps to keep this entire B+ Tree property are
-	 * done, including updates of upper nodes.
-	 *
-	 * This is because the function internally calls
-	 * bpt_delete_internal() and updates the upper layers.
-	 *
-	 * Return and close this deletion process if it returns
-	 * true.
-	 */
-	if (bpt_merged_and_rebalanced_nodes(bpt, curr,
-					    removed_key, record))
-	    return;
+    /* The nearest rank, rounded up */
+    exact = percentile / 100.0 * histogram->count;
+    rank = (uint64_t) exact;
+    if (rank < exact || rank < 1)
+	rank++;
 
-	printf("debug : merging nodes didn't happen either\n");
+    for (i = 0; i < BPT_HISTOGRAM_BUCKETS; i++){
+	seen += histogram->buckets[i];
+	if (seen >= rank)
+	    break;
     }
+
+    value = bpt_histogram_bucket_max(i);
+
+    return value < histogram->max ? value : histogram->max;
 }
 
 /*
- * Wrapper function of bpt_delete_internal().
+ * Copy the latency histogram of the operation and phase.
+ *
+ * Return false with an empty histogram if the library is built without
+ * -DBPT_LATENCY.
  */
 bool
-bpt_delete(bpt_tree *bpt, void *key, void **record){
-    bpt_node *leaf_node;
-    bool found_same_key = false;
+bpt_latency_snapshot(bpt_tree *bpt, bpt_op op, bpt_phase phase,
+		     bpt_histogram *snapshot){
+    if (snapshot == NULL)
+	return false;
 
-    printf("debug : bpt_delete() for root = %p with key = %p\n", bpt->root, key);
+    bpt_histogram_reset(snapshot);
 
-    found_same_key = bpt_search(bpt, key, &leaf_node, NULL);
+    if (bpt == NULL || bpt->latency == NULL ||
+	op >= BPT_OP_NUM || phase >= BPT_PHASE_NUM)
+	return false;
 
-    /* Remove the found key */
-    if (found_same_key){
-	printf("debug : call bpt_delete_internal() with leaf node = %p\n", leaf_node);
+    memcpy(snapshot, &bpt->latency->histograms[op][phase],
+	   sizeof(bpt_histogram));
 
-	bpt_delete_internal(bpt, leaf_node, key, record);
+    return true;
+}
 
-	return true;
-    }else{
-	printf("debug : the key to be removed was not found\n");
+void
+bpt_latency_reset(bpt_tree *bpt){
+    if (bpt == NULL || bpt->latency == NULL)
+	return;
 
-	return false;
-    }
+    memset(bpt->latency, 0, sizeof(bpt_latency));
 }
 
 /* Free the entire tree from the root to the bottom */
 void
 bpt_destroy(bpt_tree *bpt){
     bpt_node *leftmost, *prev, *curr;
+    uintptr_t i;
 
     if (bpt == NULL)
 	return;
 
     if (bpt->root == NULL){
+	free(bpt->latency);
+	free(bpt->counters);
 	free(bpt);
 	return;
     }
@@ -1473,7 +5076,10 @@ bpt_destroy(bpt_tree *bpt){
 	while(true){
 	    prev = curr;
 	    curr = curr->next;
-	    bpt_free_node(prev);
+	    if (prev->is_leaf)
+		for (i = 0; i < CHILDREN_LEN(prev); i++)
+		    bpt_drop_record(bpt, ll_ref_index_data(prev->children, i));
+	    bpt_free_node(bpt, prev);
 	    if (curr == NULL)
 		break;
 	}
@@ -1482,5 +5088,117 @@ bpt_destroy(bpt_tree *bpt){
 	curr = leftmost;
     }
 
+    bpt_leave_separators(bpt);
+
+    bpt_release_retired(bpt);
+    free(bpt->retired);
+
+    bpt_arena_release(bpt->arena);
+
+    free(bpt->latency);
+    free(bpt->counters);
     free(bpt);
 }
+
+/*
+ * Set how many leaves the leaf-chain walks prefetch ahead, up to
+ * BPT_SCAN_PREFETCH_MAX. Zero disables the prefetch.
+ *
+ * A walk which spends little time on each leaf needs a longer distance
+ * to hide the memory latency. Too long a distance evicts the leaves
+ * before they are read.
+ */
+bool
+bpt_set_scan_prefetch(bpt_tree *bpt, uint16_t distance){
+    if (bpt == NULL)
+	return false;
+
+    if (distance > BPT_SCAN_PREFETCH_MAX){
+	fprintf(stderr,
+		"the prefetch distance should be smaller than or equal to %d\n",
+		BPT_SCAN_PREFETCH_MAX);
+	return false;
+    }
+
+    bpt->scan_prefetch = distance;
+
+    return true;
+}
+
+/*
+ * Move the prefetch stages of the cursor one leaf forward, the list and
+ * the entry stages only if 'lists' and 'entries' respectively.
+ */
+static void
+bpt_advance_leaf_prefetch(bpt_leaf_cursor *cursor, bool lists,
+			  bool entries){
+    if (entries && cursor->entries != NULL &&
+	(cursor->entries = cursor->entries->next) != NULL){
+	BPT_PREFETCH(cursor->entries->keys->head);
+	BPT_PREFETCH(cursor->entries->children->head);
+    }
+
+    if (lists && cursor->lists != NULL &&
+	(cursor->lists = cursor->lists->next) != NULL){
+	BPT_PREFETCH(cursor->lists->keys);
+	BPT_PREFETCH(cursor->lists->children);
+    }
+
+    if (cursor->nodes != NULL &&
+	(cursor->nodes = cursor->nodes->next) != NULL)
+	BPT_PREFETCH(cursor->nodes);
+}
+
+/*
+ * Start a leaf-chain walk such as a range scan from 'leaf' with
+ * 'cursor', and return 'leaf'. bpt_next_leaf() walks to the next leaves.
+ *
+ * The walk prefetches the leaf 'scan_prefetch' leaves ahead, and about
+ * a third and two thirds of the distance later, its lists and then the
+ * first entries of the lists. So each stage has time for the previous
+ * one to arrive. Walking all the entries ahead would wait for each of
+ * them in turn, and the keys may be integers rather than addresses. The
+ * lists need a distance of two, and the entries three. Only this first
+ * call follows the chain that far. The cursor is valid until the next
+ * update of the tree.
+ */
+bpt_node *
+bpt_begin_leaf_walk(bpt_tree *bpt, bpt_leaf_cursor *cursor, bpt_node *leaf){
+    uint16_t i, lists_lag, entries_lag;
+
+    if (bpt == NULL || cursor == NULL)
+	return NULL;
+
+    cursor->leaf = cursor->nodes = cursor->lists = cursor->entries = leaf;
+#ifdef BPT_NO_PREFETCH
+    cursor->distance = 0;
+#else
+    cursor->distance = leaf != NULL ? bpt->scan_prefetch : 0;
+#endif
+
+    lists_lag = (cursor->distance + 2) / 3;
+    entries_lag = (2 * cursor->distance + 2) / 3;
+    for (i = 0; i < cursor->distance; i++)
+	bpt_advance_leaf_prefetch(cursor,
+				  cursor->distance >= 2 && i >= lists_lag,
+				  cursor->distance >= 3 && i >= entries_lag);
+
+    return leaf;
+}
+
+/*
+ * Return the leaf next to the current one of the walk, or NULL at the
+ * end, and move the prefetch one leaf further.
+ */
+bpt_node *
+bpt_next_leaf(bpt_leaf_cursor *cursor){
+    if (cursor == NULL || cursor->leaf == NULL)
+	return NULL;
+
+    cursor->leaf = cursor->leaf->next;
+    if (cursor->distance > 0)
+	bpt_advance_leaf_prefetch(cursor, cursor->distance >= 2,
+				  cursor->distance >= 3);
+
+    return cursor->leaf;
+}
@@ -9,10 +9,120 @@
 
 typedef struct bpt_tree bpt_tree;
 
+/*
+ * Alignment of the nodes, the leaf pages and the other blocks read by
+ * the search, and the size to pad the counter slots.
+ */
+#define BPT_CACHE_LINE_SIZE 64
+
+/*
+ * Leaf page. See bpt_set_leaf_pages().
+ *
+ * One buffer of 'page_size' bytes per leaf. The slot directory follows
+ * the header in the key order, and the records are in the heap at the
+ * end of the page :
+ *
+ *   | header | slot 0 | slot 1 | ... free space ... | record 1 | record 0 |
+ *
+ * Each slot has the offset of its record from the head of the page and
+ * the length. A new record goes just below the heap, and a removed one
+ * stays in the heap until the free space runs out. Then the page is
+ * rebuilt with the records packed in the key order. A record longer than
+ * the inline limit is kept out of line. Its slot has the length
+ * BPT_PAGE_OVERFLOW and refers to a bpt_page_overflow in the page
+ * instead. Every inline record starts at a multiple of BPT_PAGE_ALIGN.
+ *
+ * The page holds only the records. The keys stay in the leaf's key list,
+ * so the slots carry no key and the search never reads the page.
+ */
+#define BPT_PAGE_MAX_SIZE 32768
+#define BPT_PAGE_ALIGN 8
+#define BPT_PAGE_OVERFLOW UINT16_MAX
+
+typedef struct bpt_page_header {
+
+    uint16_t slots_num;
+
+    /* Offset of the first record */
+    uint16_t heap_offset;
+
+} bpt_page_header;
+
+typedef struct bpt_page_slot {
+
+    uint16_t offset;
+    uint16_t length;
+
+} bpt_page_slot;
+
+typedef struct bpt_page_overflow {
+
+    void *record;
+    uintptr_t length;
+
+} bpt_page_overflow;
+
+/*
+ * Keys of one leaf packed by frame of reference. See
+ * bpt_set_key_packing().
+ *
+ * 'keys_num' deltas of 'width' bytes follow the header, one per key in
+ * the key order. The i-th key is the one whose integer is 'base' plus
+ * the i-th delta. 'width' is the narrowest of 1, 2, 4 and 8 bytes for
+ * the difference between the last and the first keys.
+ *
+ * The block has room for 'max_keys + 1' deltas of 'capacity' bytes, the
+ * widest width the leaf has needed, so the deltas are rewritten in place.
+ */
+typedef struct bpt_packed_keys {
+
+    uint64_t base;
+    uint16_t keys_num;
+    uint8_t width;
+    uint8_t capacity;
+
+} bpt_packed_keys;
+
+/*
+ * Abbreviated keys cached in one node. See bpt_set_key_abbrev().
+ *
+ * 'prefixes[i]' is the abbreviation of 'keys[i]' after its first 'offset'
+ * bytes, valid only while the i-th key of the node is still 'keys[i]' and
+ * the tree's 'abbrev_epoch' is still 'epoch'.
+ *
+ * 'offset' is the length of the prefix common to all the keys of the
+ * node, computed from its first and last keys, 'first' and 'last'. The
+ * abbreviations skip the prefix so that they tell apart the keys sharing
+ * long prefixes. The keys themselves are still stored in full by the
+ * application, so the prefix saves comparisons but no key memory.
+ *
+ * Allocated in one block with both arrays following the header, so that
+ * the search reads the abbreviations next to the header.
+ */
+typedef struct bpt_abbrev_cache {
+
+    uintptr_t epoch;
+    uintptr_t capacity;
+    uint64_t *prefixes;
+    void **keys;
+
+    void *first;
+    void *last;
+    uintptr_t offset;
+
+} bpt_abbrev_cache;
+
 /*
  * B+ Tree Node
  *
  * Representation of root, internal or leaf nodes.
+ *
+ * One struct serves both kinds, since a node can change its kind in
+ * place, e.g. the root which becomes an empty leaf again. The members
+ * read by the key search come first so that the descent touches one
+ * cache line per node. The node is aligned to a cache line, and so its
+ * size is a multiple of BPT_CACHE_LINE_SIZE, in the arena as well. The
+ * node takes two cache lines, and the search reads only the first one.
  */
 typedef struct bpt_node {
 
@@ -35,6 +145,26 @@ typedef struct bpt_node {
      */
     linked_list *children;
 
+    /*
+     * Abbreviated keys for the key search. Allocated on the first search
+     * of this node when the tree has the abbreviation callback. Not
+     * counted by bpt_stats().
+     */
+    bpt_abbrev_cache *abbrevs;
+
+    /*
+     * Packed keys of this leaf for the key search, in addition to the
+     * keys. NULL unless the tree packs keys.
+     */
+    bpt_packed_keys *packed;
+
+    /*
+     * Page of the records of this leaf. NULL unless the tree has leaf
+     * pages or inline records. See bpt_set_leaf_pages() and
+     * bpt_set_record_size().
+     */
+    void *page;
+
     struct bpt_node *parent;
 
     /*
@@ -43,7 +173,64 @@ typedef struct bpt_node {
     struct bpt_node *prev;
     struct bpt_node *next;
 
-} bpt_node;
+    /*
+     * Aggregate of all records under this node.
+     *
+     * The parent combines its children's values without descending
+     * into them. Allocated only when the tree has aggregate callbacks.
+     */
+    void *aggregate;
+
+} __attribute__((aligned(BPT_CACHE_LINE_SIZE))) bpt_node;
+
+/*
+ * Nodes allocated in slabs of BPT_ARENA_SLAB_NODES nodes. See
+ * bpt_set_node_arena().
+ *
+ * The first 'used' nodes of the slabs have been handed out, and the
+ * freed nodes are chained by 'next' from 'free_nodes' for reuse. The
+ * trees cut off by bpt_split_at() share the arena, counted by 'refs'.
+ *
+ * Each slab starts at a page boundary, BPT_SLAB_ALIGN bytes, like the
+ * nodes allocated one by one start at a cache line.
+ */
+#define BPT_ARENA_SLAB_NODES 1024
+#define BPT_SLAB_ALIGN 4096
+
+typedef struct bpt_node_arena {
+
+    uintptr_t refs;
+
+    bpt_node **slabs;
+    uintptr_t slabs_num;
+    uintptr_t slabs_size;
+
+    uintptr_t used;
+    bpt_node *free_nodes;
+
+} bpt_node_arena;
+
+/*
+ * Separators made by the 'key_separator' callback. See
+ * bpt_set_key_separator().
+ *
+ * The trees cut off from one tree by bpt_split_at() share the registry.
+ * Each separator moves with its node to either tree, so the unused ones
+ * are found by looking for them in all the 'trees_num' trees, and are
+ * freed from time to time. 'separators' has 'separators_num' entries
+ * out of 'separators_size'.
+ */
+typedef struct bpt_separator_registry {
+
+    bpt_tree **trees;
+    uintptr_t trees_num;
+    uintptr_t trees_size;
+
+    void **separators;
+    uintptr_t separators_num;
+    uintptr_t separators_size;
+
+} bpt_separator_registry;
 
 /*
  * Specify how to access the key connected in the 'keys'.
@@ -56,11 +243,132 @@ typedef void *(*bpt_key_access_cb)(void *p);
 typedef int (*bpt_key_compare_cb)(void *k1, void *k2,
 				  void *key_metadata);
 
+/*
+ * Return an abbreviation of the key after its first 'offset' bytes, such
+ * as the next eight bytes in big-endian. For two keys with the same first
+ * 'offset' bytes, if a1 < a2 for their abbreviations, k1 < k2 must hold.
+ * Equal abbreviations say nothing.
+ */
+typedef uint64_t (*bpt_key_abbrev_cb)(void *key, uintptr_t offset,
+				      void *key_metadata);
+
+/*
+ * Return the length of the common prefix of two keys, in the unit of
+ * 'offset' of bpt_key_abbrev_cb.
+ */
+typedef uintptr_t (*bpt_key_prefix_cb)(void *k1, void *k2,
+				       void *key_metadata);
+
+/*
+ * Return the integer of the key. k1 < k2 if and only if i1 < i2 for
+ * their integers, and equal integers mean equal keys.
+ */
+typedef uint64_t (*bpt_key_integer_cb)(void *key, void *key_metadata);
+
+/*
+ * Return a new key k between two adjacent leaves, left < k <= right,
+ * which is as short as possible. The tree owns the returned key. Return
+ * NULL to use 'right' as it is.
+ */
+typedef void *(*bpt_key_separator_cb)(void *left, void *right,
+				      void *key_metadata);
+
+/*
+ * Return the length of one record in bytes.
+ */
+typedef uintptr_t (*bpt_record_length_cb)(void *record);
+
 /*
  * Free dynamic memory inside of the application data.
  */
 typedef void (*bpt_free_cb)(void *p);
 
+/*
+ * Subtree aggregate callbacks.
+ *
+ * The aggregate is an application-defined buffer such as a struct of
+ * sum, min and max. Reset 'agg' to the identity value, fold one
+ * record into 'agg', or combine 'other' aggregate into 'agg'.
+ */
+typedef void (*bpt_agg_identity_cb)(void *agg);
+typedef void (*bpt_agg_record_cb)(void *agg, void *record);
+typedef void (*bpt_agg_combine_cb)(void *agg, void *other);
+
+/*
+ * Operation counters.
+ *
+ * Counted only when the library is built with -DBPT_COUNTERS. Otherwise,
+ * all the counting code is compiled out. 'comparisons' and 'nodes_visited'
+ * are those of the key search from the root, which insert and delete also
+ * go through.
+ */
+typedef struct bpt_counters {
+    uint64_t comparisons;
+    uint64_t nodes_visited;
+    uint64_t splits;
+    uint64_t root_splits;
+    uint64_t merges;
+    uint64_t borrows;
+    uint64_t root_promotions;
+} bpt_counters;
+
+/*
+ * Number of counter slots per tree, each padded to BPT_CACHE_LINE_SIZE.
+ *
+ * Each thread counts on the slot chosen by its thread number, so that
+ * the threads don't share a cache line without atomic operations. More
+ * threads than the slots share some slots and may lose counts on races.
+ */
+#define BPT_COUNTER_SLOTS 16
+
+typedef struct bpt_counter_slot {
+    bpt_counters counters;
+} __attribute__((aligned(BPT_CACHE_LINE_SIZE))) bpt_counter_slot;
+
+/*
+ * Log-linear latency histogram in nanoseconds.
+ *
+ * Values below 2^BPT_HISTOGRAM_SUB_BITS have their own buckets. Above
+ * that, each power of two range is divided into 2^BPT_HISTOGRAM_SUB_BITS
+ * buckets of the same width, which bounds the relative error of any
+ * percentile by 1/2^BPT_HISTOGRAM_SUB_BITS.
+ */
+#define BPT_HISTOGRAM_SUB_BITS 4
+#define BPT_HISTOGRAM_BUCKETS \
+    ((64 - BPT_HISTOGRAM_SUB_BITS + 1) << BPT_HISTOGRAM_SUB_BITS)
+
+typedef struct bpt_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[BPT_HISTOGRAM_BUCKETS];
+} bpt_histogram;
+
+/*
+ * Operations and their phases to record the latency of.
+ *
+ * The descent is the key search from the root to the leaf. The
+ * restructuring is the rest of insert or delete, including splits,
+ * borrows and merges. bpt_search() has the descent only.
+ */
+typedef enum bpt_op {
+    BPT_OP_INSERT,
+    BPT_OP_SEARCH,
+    BPT_OP_DELETE,
+    BPT_OP_NUM,
+} bpt_op;
+
+typedef enum bpt_phase {
+    BPT_PHASE_TOTAL,
+    BPT_PHASE_DESCENT,
+    BPT_PHASE_RESTRUCTURE,
+    BPT_PHASE_NUM,
+} bpt_phase;
+
+typedef struct bpt_latency {
+    bpt_histogram histograms[BPT_OP_NUM][BPT_PHASE_NUM];
+} bpt_latency;
+
 /*
  * B+ Tree
  */
@@ -80,8 +388,207 @@ typedef struct bpt_tree {
      */
     composite_key_store keys_compare_metadata;
 
+    /*
+     * Relaxed deletion mode and the state of incremental compaction.
+     *
+     * 'lazy_pending' counts relaxed deletions since the current pass has
+     * started. 'compact_key' is the first key of the leaf where the next
+     * bpt_lazy_compact() resumes, or NULL to start a new pass.
+     */
+    bool lazy_delete;
+    uintptr_t lazy_pending;
+    void *compact_key;
+
+    /*
+     * The first key of the leaf where the next bpt_compact() resumes,
+     * or NULL to start from the leftmost leaf.
+     */
+    void *fill_key;
+
+    /*
+     * Counters updated along with the tree for bpt_stats_fast().
+     *
+     * 'key_count' is the number of pairs of key and record. The counters
+     * are 'counts_stale' after bpt_split_at(), which doesn't know how many
+     * entries moved with the untouched subtrees. Then, the next reader
+     * recounts them by one tree walk. 'packed_bytes' is the memory of the
+     * leaves' packed keys.
+     */
+    uintptr_t key_count;
+    uintptr_t leaf_count;
+    uintptr_t internal_count;
+    uintptr_t packed_bytes;
+    bool counts_stale;
+
+    /*
+     * Array of BPT_COUNTER_SLOTS slots for bpt_counters_snapshot(). NULL
+     * when the counters are compiled out.
+     */
+    bpt_counter_slot *counters;
+
+    /*
+     * Latency histograms of each operation. NULL unless the library is
+     * built with -DBPT_LATENCY. See bpt_latency_snapshot().
+     */
+    bpt_latency *latency;
+
+    /*
+     * Optional subtree aggregate. Disabled when 'agg_combine' is NULL.
+     *
+     * See bpt_set_aggregate().
+     */
+    uintptr_t aggregate_size;
+    bpt_agg_identity_cb agg_identity;
+    bpt_agg_record_cb agg_record;
+    bpt_agg_combine_cb agg_combine;
+
+    /*
+     * Optional key abbreviation for the key search. Disabled when
+     * 'key_abbrev' is NULL. See bpt_set_key_abbrev().
+     *
+     * 'abbrev_epoch' is renewed whenever many keys can leave the tree at
+     * once, so that no cached abbreviation outlives its key. A single
+     * delete drops the key only from the caches of its leaf and the
+     * leaf's ancestors.
+     *
+     * 'key_prefix' is optional. Without it, the keys are abbreviated from
+     * their heads.
+     */
+    bpt_key_abbrev_cb key_abbrev;
+    bpt_key_prefix_cb key_prefix;
+    uintptr_t abbrev_epoch;
+
+    /*
+     * Optional frame of reference packing of the leaf keys for the key
+     * search. Disabled when NULL. See bpt_set_key_packing().
+     */
+    bpt_key_integer_cb key_integer;
+
+    /*
+     * Optional suffix truncation of the separators pushed up by leaf
+     * splits. Disabled when 'key_separator' is NULL. See
+     * bpt_set_key_separator().
+     *
+     * 'separators' registers the keys made by 'key_separator', or is
+     * NULL until the first one. The ones which are no longer in any
+     * internal node are freed by 'separator_free'.
+     */
+    bpt_key_separator_cb key_separator;
+    bpt_free_cb separator_free;
+    bpt_separator_registry *separators;
+
+    /*
+     * Optional leaf pages. Disabled when 'page_size' is zero. See
+     * bpt_set_leaf_pages().
+     *
+     * 'inline_limit' is the longest record stored in the pages. The pages
+     * replaced by rebuilds and freed leaves, and the out-of-line records
+     * removed from the tree, are kept in 'retired' until the next update
+     * of the tree, so that the record returned by bpt_delete() stays
+     * readable until then.
+     */
+    uintptr_t page_size;
+    uintptr_t inline_limit;
+    bpt_record_length_cb record_length;
+
+    /*
+     * Size of the records stored inline in the leaves, or zero. When set,
+     * the page of a leaf is one array of records parallel to the keys,
+     * without the slot directory, and the number of the records. See
+     * bpt_set_record_size().
+     */
+    uintptr_t record_size;
+
+    void **retired;
+    uintptr_t retired_num;
+    uintptr_t retired_size;
+
+    /* Optional node arena. See bpt_set_node_arena() */
+    bpt_node_arena *arena;
+
+    /*
+     * Leaves prefetched ahead by the leaf-chain walks, or zero for none.
+     * See bpt_set_scan_prefetch().
+     */
+    uint16_t scan_prefetch;
+
 } bpt_tree;
 
+/*
+ * Default and maximum distances of the leaf prefetch in leaf-chain walks.
+ * See bpt_set_scan_prefetch().
+ */
+#define BPT_SCAN_PREFETCH_DEFAULT 4
+#define BPT_SCAN_PREFETCH_MAX 64
+
+/*
+ * Cursor of one leaf-chain walk. See bpt_begin_leaf_walk().
+ *
+ * 'leaf' is the current leaf. The prefetch goes in three stages, each one
+ * leaf behind the previous, so that each stage reads what the previous
+ * one has brought in : the leaves up to 'nodes' have been prefetched,
+ * the lists of the leaves up to 'lists', and the first entries of the
+ * lists of the leaves up to 'entries'.
+ */
+typedef struct bpt_leaf_cursor {
+
+    bpt_node *leaf;
+    bpt_node *nodes;
+    bpt_node *lists;
+    bpt_node *entries;
+    uint16_t distance;
+
+} bpt_leaf_cursor;
+
+/*
+ * Number of buckets of the node occupancy histogram.
+ */
+#define BPT_FILL_BUCKETS 10
+
+/*
+ * Tree statistics.
+ *
+ * The first three members are maintained on each update and returned by
+ * bpt_stats_fast() without any tree walk. bpt_stats() walks the whole
+ * tree and fills in all of them.
+ */
+typedef struct bpt_tree_stats {
+
+    uintptr_t keys;
+    uintptr_t nodes;
+
+    /* Sum of 'node_bytes', 'list_bytes' and 'key_bytes' */
+    uintptr_t bytes;
+
+    /* Number of levels. One for a tree with the root leaf only */
+    int height;
+
+    uintptr_t leaf_nodes;
+    uintptr_t internal_nodes;
+
+    /* Average of the number of keys per node divided by 'max_keys' */
+    double leaf_fill;
+    double internal_fill;
+
+    /*
+     * Number of nodes by occupancy in steps of 1/BPT_FILL_BUCKETS.
+     * The full nodes are counted in the last bucket.
+     */
+    uintptr_t fill_histogram[BPT_FILL_BUCKETS];
+
+    /*
+     * Memory used by the nodes with their aggregates, leaf pages and
+     * packed keys, by the lists of keys and children, and by the keys.
+     * The size of keys is known only for the composite keys. Otherwise,
+     * 'key_bytes' is zero. The blocks aligned to a cache line count their
+     * rounded up sizes, but the overhead of malloc() isn't counted.
+     */
+    uintptr_t node_bytes;
+    uintptr_t list_bytes;
+    uintptr_t key_bytes;
+
+} bpt_tree_stats;
+
 void bpt_dump_whole_tree(bpt_tree *bpt);
 void bpt_node_validity(bpt_node *node);
 bpt_node *bpt_gen_node(void);
@@ -89,10 +596,54 @@ bpt_node *bpt_gen_root_callbacks_node(bpt_tree *bpt);
 bpt_tree *bpt_init(bpt_key_compare_cb keys_key_compare, bpt_free_cb keys_key_free,
 		   bpt_free_cb records_record_free, uint16_t max_keys,
 		   composite_key_store *keys_compare_metadata);
+uint16_t bpt_max_keys_for_node_size(uintptr_t node_size, uintptr_t key_size);
+bpt_tree *bpt_init_by_node_size(bpt_key_compare_cb keys_key_compare,
+				bpt_free_cb keys_key_free,
+				bpt_free_cb records_record_free,
+				uintptr_t node_size, uintptr_t key_size,
+				composite_key_store *keys_compare_metadata);
 bool bpt_insert(bpt_tree *bpt, void *key, void *data);
 bool bpt_search(bpt_tree *bpt, void *key, bpt_node **node,
 		void **record);
 bool bpt_delete(bpt_tree *bpt, void *key, void **record);
+uintptr_t bpt_delete_range(bpt_tree *bpt, void *lo, void *hi,
+			   bool free_records);
+bool bpt_split_at(bpt_tree *bpt, void *key, bpt_tree **right_tree);
+bool bpt_concat(bpt_tree *left, bpt_tree *right);
+void bpt_set_lazy_delete(bpt_tree *bpt, bool lazy_delete);
+bool bpt_lazy_compact(bpt_tree *bpt, uintptr_t budget);
+bool bpt_compact(bpt_tree *bpt, double target_fill, uintptr_t budget);
+uintptr_t bpt_compact_reclaimable(bpt_tree *bpt, double target_fill);
+bool bpt_stats(bpt_tree *bpt, bpt_tree_stats *stats);
+bool bpt_stats_fast(bpt_tree *bpt, bpt_tree_stats *stats);
+bool bpt_counters_snapshot(bpt_tree *bpt, bpt_counters *snapshot);
+void bpt_counters_reset(bpt_tree *bpt);
+bool bpt_latency_snapshot(bpt_tree *bpt, bpt_op op, bpt_phase phase,
+			  bpt_histogram *snapshot);
+void bpt_latency_reset(bpt_tree *bpt);
+void bpt_histogram_record(bpt_histogram *histogram, uint64_t value);
+void bpt_histogram_merge(bpt_histogram *dst, bpt_histogram *src);
+void bpt_histogram_reset(bpt_histogram *histogram);
+uint64_t bpt_histogram_percentile(bpt_histogram *histogram, double percentile);
 void bpt_destroy(bpt_tree *bpt);
+bool bpt_set_aggregate(bpt_tree *bpt, uintptr_t aggregate_size,
+		       bpt_agg_identity_cb agg_identity,
+		       bpt_agg_record_cb agg_record,
+		       bpt_agg_combine_cb agg_combine);
+bool bpt_aggregate_range(bpt_tree *bpt, void *lo, void *hi, void *out);
+void bpt_set_key_abbrev(bpt_tree *bpt, bpt_key_abbrev_cb key_abbrev,
+			bpt_key_prefix_cb key_prefix);
+bool bpt_set_key_separator(bpt_tree *bpt, bpt_key_separator_cb key_separator,
+			   bpt_free_cb separator_free);
+bool bpt_set_leaf_pages(bpt_tree *bpt, uintptr_t page_size,
+			bpt_record_length_cb record_length);
+void *bpt_page_ref_record(void *page, int index, uintptr_t *length);
+bool bpt_set_record_size(bpt_tree *bpt, uintptr_t record_size);
+bool bpt_set_node_arena(bpt_tree *bpt, bool arena);
+bool bpt_set_key_packing(bpt_tree *bpt, bpt_key_integer_cb key_integer);
+bool bpt_set_scan_prefetch(bpt_tree *bpt, uint16_t distance);
+bpt_node *bpt_begin_leaf_walk(bpt_tree *bpt, bpt_leaf_cursor *cursor,
+			      bpt_node *leaf);
+bpt_node *bpt_next_leaf(bpt_leaf_cursor *cursor);
 
 #endif
@@ -0,0 +1,590 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../bpt_key_handler.h"
+
+/*
+ * Microbenchmark of the composite key handling, apart from the tree.
+ *
+ * For each schema below, build the given number of composite keys with
+ * the key writers and run these operations over them.
+ *
+ *   encode   write all the fields of a key with the key writers
+ *   decode   read all the fields of a key with the key readers
+ *   compare  compare two random keys field by field, as the comparison
+ *            callback of an application does in every descent, or by
+ *            bkh_ordered_key_compare() for the ordered and fixed encodings
+ *   builtin  compare two random keys by bkh_composite_key_compare()
+ *   field    compare the last fields of two random keys located by
+ *            bkh_field_ref(), without decoding the fields before them
+ *
+ * Each schema is run in the encodings below.
+ *
+ *   native    the in-memory layout, compared by reading each field back
+ *   ordered   the order-preserving layout, compared by one memcmp()
+ *   prefixed  length-prefixed strings and order-preserving other fields
+ *   fixed     zero-padded fixed-width strings and order-preserving other
+ *             fields, compared by one memcmp()
+ *
+ * Schemas:
+ *
+ *   int       three integers
+ *   mixed     integer, double, string of 16 bytes and bool
+ *   long_str  two strings of 256 bytes sharing a long prefix
+ *
+ * The leading fields have few distinct values, so that the comparisons
+ * often go past them like on a real composite index.
+ */
+
+#define DEFAULT_KEY_COUNT 100000
+#define MAX_FIELDS 8
+#define SHORT_STR_SIZE 16
+#define LONG_STR_SIZE 256
+
+typedef enum output_format {
+    FORMAT_CSV,
+    FORMAT_JSON,
+} output_format;
+
+/*
+ * Value of one field before encoding.
+ */
+typedef struct field_value {
+    int i;
+    double d;
+    bool b;
+    char *s;
+} field_value;
+
+typedef struct key_schema {
+    const char *name;
+    key_encoding encoding;
+    composite_key_store *store;
+    int fields_num;
+
+    /* Generate the values of the 'index'-th key */
+    void (*gen_values)(uintptr_t index, field_value *values);
+} key_schema;
+
+typedef struct bench_config {
+    uintptr_t keys;
+
+    /* Operations of each workload. Zero for key count */
+    uintptr_t ops;
+
+    uint64_t seed;
+    output_format format;
+
+    /*
+     * Comma separated names of schemas, encodings and operations. NULL
+     * to run all
+     */
+    char *schemas;
+    char *encodings;
+    char *operations;
+} bench_config;
+
+static const char *encoding_names[] = {
+    "native", "ordered", "prefixed", "fixed"
+};
+
+static uint64_t rng_state;
+static bool first_row = true;
+
+/* Keep the results from being optimized out */
+static volatile uint64_t sink;
+
+/*
+ * xorshift64*
+ */
+static uint64_t
+rng_next(void){
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t
+clock_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Fill 'buf' of 'size' with a string whose leading 'prefix_len' bytes
+ * are common to all keys and whose tail is derived from 'index'.
+ */
+static void
+gen_string(char *buf, uintptr_t size, uintptr_t prefix_len, uintptr_t index){
+    char tail[17];
+    uintptr_t i, j;
+
+    for (i = 0; i < prefix_len && i < size - 1; i++)
+	buf[i] = 'a' + (char) (i % 26);
+    snprintf(tail, sizeof(tail), "%016lx",
+	     (unsigned long) (index * 0x9E3779B97F4A7C15ULL));
+    for (j = 0; tail[j] != '\0' && i < size - 1; j++)
+	buf[i++] = tail[j];
+    buf[i] = '\0';
+}
+
+static void
+gen_int_values(uintptr_t index, field_value *values){
+    values[0].i = (int) (index % 16);
+    values[1].i = (int) (index % 1024);
+    values[2].i = (int) index;
+}
+
+static void
+gen_mixed_values(uintptr_t index, field_value *values){
+    values[0].i = (int) (index % 16);
+    values[1].d = (double) (index % 1024) / 8.0;
+    gen_string(values[2].s, SHORT_STR_SIZE, 0, index);
+    values[3].b = (index & 1) == 1;
+}
+
+static void
+gen_long_str_values(uintptr_t index, field_value *values){
+    gen_string(values[0].s, LONG_STR_SIZE, LONG_STR_SIZE / 2, index % 64);
+    gen_string(values[1].s, LONG_STR_SIZE, LONG_STR_SIZE / 2, index);
+}
+
+/*
+ * 'str_sizes' gives the size of each string field and is ignored for the
+ * other types.
+ */
+static void
+schema_init(key_schema *schema, const char *name, key_type *types,
+	    int *str_sizes, int fields_num,
+	    void (*gen_values)(uintptr_t, field_value *),
+	    key_encoding encoding){
+    bpt_key *metadata[MAX_FIELDS];
+    int i;
+
+    schema->name = name;
+    schema->encoding = encoding;
+    schema->fields_num = fields_num;
+    schema->gen_values = gen_values;
+    /* The string encodings apply only to the strings */
+    for (i = 0; i < fields_num; i++)
+	metadata[i] = bpt_create_encoded_key_metadata(types[i], str_sizes[i],
+						      types[i] == BPT_STRING ||
+						      encoding == BPT_NATIVE ?
+						      encoding : BPT_ORDERED);
+    schema->store = bpt_create_key_store(metadata, fields_num);
+}
+
+static void
+schema_destroy(key_schema *schema){
+    bpt_free_key_store(schema->store);
+}
+
+static void *
+value_ptr(bpt_key *metadata, field_value *value){
+    switch(metadata->type){
+	case BPT_INT:
+	    return &value->i;
+	case BPT_DOUBLE:
+	    return &value->d;
+	case BPT_BOOLEAN:
+	    return &value->b;
+	case BPT_STRING:
+	    return value->s;
+	default:
+	    return NULL;
+    }
+}
+
+/*
+ * Write all the fields to 'buf'.
+ */
+static void
+encode_key(composite_key_store *store, int fields_num, field_value *values,
+	   void *buf){
+    bpt_key *metadata;
+    void *field = buf;
+    int i;
+
+    for (i = 0; i < fields_num; i++){
+	metadata = store->keys_metadata[i];
+	field = bkh_write_key(metadata, field, value_ptr(metadata, &values[i]));
+    }
+}
+
+static void
+decode_key(composite_key_store *store, int fields_num, void *buf,
+	   field_value *values){
+    bpt_key *metadata;
+    void *field = buf;
+    int i;
+
+    for (i = 0; i < fields_num; i++){
+	metadata = store->keys_metadata[i];
+	field = bkh_read_key(metadata, field, value_ptr(metadata, &values[i]));
+    }
+}
+
+/*
+ * Comparison callback of the typical application, which reads each field
+ * with the key reader and compares it according to its type.
+ */
+static int
+decoding_key_compare(composite_key_store *store, int fields_num,
+		     void *key1, void *key2, field_value *v1, field_value *v2){
+    bpt_key *metadata;
+    void *f1 = key1, *f2 = key2;
+    int i, ret;
+
+    for (i = 0; i < fields_num; i++){
+	metadata = store->keys_metadata[i];
+	f1 = bkh_read_key(metadata, f1, value_ptr(metadata, &v1[i]));
+	f2 = bkh_read_key(metadata, f2, value_ptr(metadata, &v2[i]));
+
+	switch(metadata->type){
+	    case BPT_INT:
+		ret = v1[i].i < v2[i].i ? -1 : (v1[i].i == v2[i].i ? 0 : 1);
+		break;
+	    case BPT_DOUBLE:
+		ret = v1[i].d < v2[i].d ? -1 : (v1[i].d == v2[i].d ? 0 : 1);
+		break;
+	    case BPT_BOOLEAN:
+		ret = v1[i].b < v2[i].b ? -1 : (v1[i].b == v2[i].b ? 0 : 1);
+		break;
+	    case BPT_STRING:
+		ret = strcmp(v1[i].s, v2[i].s);
+		ret = ret < 0 ? -1 : (ret == 0 ? 0 : 1);
+		break;
+	    default:
+		ret = 0;
+		break;
+	}
+
+	if (ret != 0)
+	    return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Allocate the string buffers of 'values' for 'schema'.
+ */
+static void
+values_init(key_schema *schema, field_value *values){
+    int i;
+
+    memset(values, 0, sizeof(field_value) * MAX_FIELDS);
+    for (i = 0; i < schema->fields_num; i++)
+	if (schema->store->keys_metadata[i]->type == BPT_STRING)
+	    values[i].s = bkh_malloc(schema->store->keys_metadata[i]->key_size);
+}
+
+static void
+values_destroy(key_schema *schema, field_value *values){
+    int i;
+
+    for (i = 0; i < schema->fields_num; i++)
+	bkh_free(values[i].s);
+}
+
+static bool
+name_enabled(char *names, const char *name){
+    const char *p;
+    size_t len = strlen(name);
+
+    if (names == NULL)
+	return true;
+
+    for (p = names; (p = strstr(p, name)) != NULL; p += len){
+	if ((p == names || p[-1] == ',') &&
+	    (p[len] == '\0' || p[len] == ','))
+	    return true;
+    }
+
+    return false;
+}
+
+static void
+print_header(bench_config *config){
+    if (config->format == FORMAT_CSV)
+	printf("schema,encoding,operation,keys,key_size,ops,seconds,"
+	       "ops_per_sec,ns_per_op\n");
+    else
+	printf("[\n");
+}
+
+static void
+print_footer(bench_config *config){
+    if (config->format == FORMAT_JSON)
+	printf("\n]\n");
+}
+
+static void
+print_result(bench_config *config, key_schema *schema, const char *operation,
+	     uintptr_t ops, uint64_t elapsed){
+    double seconds = elapsed / 1e9,
+	ops_per_sec = seconds > 0 ? ops / seconds : 0,
+	ns_per_op = ops > 0 ? (double) elapsed / ops : 0;
+
+    const char *encoding = encoding_names[schema->encoding];
+
+    if (config->format == FORMAT_CSV){
+	printf("%s,%s,%s,%lu,%lu,%lu,%.6f,%.0f,%.1f\n",
+	       schema->name, encoding, operation, config->keys,
+	       schema->store->full_key_size, ops, seconds, ops_per_sec,
+	       ns_per_op);
+    }else{
+	printf("%s  {\"schema\": \"%s\", \"encoding\": \"%s\", "
+	       "\"operation\": \"%s\", \"keys\": %lu, "
+	       "\"key_size\": %lu, \"ops\": %lu, \"seconds\": %.6f, "
+	       "\"ops_per_sec\": %.0f, \"ns_per_op\": %.1f}",
+	       first_row ? "" : ",\n",
+	       schema->name, encoding, operation, config->keys,
+	       schema->store->full_key_size, ops, seconds, ops_per_sec,
+	       ns_per_op);
+	first_row = false;
+    }
+    fflush(stdout);
+}
+
+static void
+run_schema(bench_config *config, key_schema *schema){
+    composite_key_store *store = schema->store;
+    uintptr_t key_size = store->full_key_size, i, ops, n = config->keys;
+    field_value *values, v1[MAX_FIELDS], v2[MAX_FIELDS];
+    uint64_t start, sum = 0;
+    char *keys;
+
+    ops = config->ops ? config->ops : n;
+
+    /*
+     * Generate the values in advance, so that encode measures only the
+     * key writers.
+     */
+    values = bkh_malloc(sizeof(field_value) * MAX_FIELDS * n);
+    for (i = 0; i < n; i++){
+	values_init(schema, &values[i * MAX_FIELDS]);
+	schema->gen_values(i, &values[i * MAX_FIELDS]);
+    }
+    keys = bkh_malloc(key_size * n);
+    memset(keys, 0, key_size * n);
+
+    if (name_enabled(config->operations, "encode")){
+	start = clock_ns();
+	for (i = 0; i < ops; i++)
+	    encode_key(store, schema->fields_num, &values[(i % n) * MAX_FIELDS],
+		       keys + (i % n) * key_size);
+	print_result(config, schema, "encode", ops, clock_ns() - start);
+    }else{
+	for (i = 0; i < n; i++)
+	    encode_key(store, schema->fields_num, &values[i * MAX_FIELDS],
+		       keys + i * key_size);
+    }
+
+    values_init(schema, v1);
+    values_init(schema, v2);
+
+    if (name_enabled(config->operations, "decode")){
+	start = clock_ns();
+	for (i = 0; i < ops; i++){
+	    decode_key(store, schema->fields_num, keys + (i % n) * key_size, v1);
+	    sum += v1[0].i;
+	}
+	print_result(config, schema, "decode", ops, clock_ns() - start);
+    }
+
+    if (name_enabled(config->operations, "compare")){
+	uintptr_t *pairs = bkh_malloc(sizeof(uintptr_t) * 2 * ops);
+
+	for (i = 0; i < ops * 2; i++)
+	    pairs[i] = rng_next() % n;
+
+	start = clock_ns();
+	if (bkh_is_ordered_store(store)){
+	    for (i = 0; i < ops; i++)
+		sum += bkh_ordered_key_compare(keys + pairs[i * 2] * key_size,
+					       keys + pairs[i * 2 + 1] * key_size,
+					       store);
+	}else{
+	    for (i = 0; i < ops; i++)
+		sum += decoding_key_compare(store, schema->fields_num,
+					    keys + pairs[i * 2] * key_size,
+					    keys + pairs[i * 2 + 1] * key_size,
+					    v1, v2);
+	}
+	print_result(config, schema, "compare", ops, clock_ns() - start);
+
+	bkh_free(pairs);
+    }
+
+    if (name_enabled(config->operations, "builtin")){
+	uintptr_t *pairs = bkh_malloc(sizeof(uintptr_t) * 2 * ops);
+
+	for (i = 0; i < ops * 2; i++)
+	    pairs[i] = rng_next() % n;
+
+	bkh_prepare_compare(store);
+	start = clock_ns();
+	for (i = 0; i < ops; i++)
+	    sum += bkh_composite_key_compare(keys + pairs[i * 2] * key_size,
+					     keys + pairs[i * 2 + 1] * key_size,
+					     store);
+	print_result(config, schema, "builtin", ops, clock_ns() - start);
+
+	bkh_free(pairs);
+    }
+
+    if (name_enabled(config->operations, "field")){
+	uintptr_t *pairs = bkh_malloc(sizeof(uintptr_t) * 2 * ops);
+
+	for (i = 0; i < ops * 2; i++)
+	    pairs[i] = rng_next() % n;
+
+	start = clock_ns();
+	for (i = 0; i < ops; i++)
+	    sum += bkh_field_compare(store, keys + pairs[i * 2] * key_size,
+				     keys + pairs[i * 2 + 1] * key_size,
+				     schema->fields_num - 1);
+	print_result(config, schema, "field", ops, clock_ns() - start);
+
+	bkh_free(pairs);
+    }
+
+    sink += sum;
+
+    values_destroy(schema, v1);
+    values_destroy(schema, v2);
+    for (i = 0; i < n; i++)
+	values_destroy(schema, &values[i * MAX_FIELDS]);
+    bkh_free(values);
+    bkh_free(keys);
+}
+
+static uintptr_t
+parse_count(char *arg){
+    unsigned long long value;
+    char *end;
+
+    errno = 0;
+    value = strtoull(arg, &end, 10);
+    /* Accept the suffixes of K and M */
+    if (*end == 'K' || *end == 'k'){
+	value *= 1000;
+	end++;
+    }else if (*end == 'M' || *end == 'm'){
+	value *= 1000000;
+	end++;
+    }
+    if (errno != 0 || *end != '\0' || value == 0){
+	fprintf(stderr, "invalid value '%s'\n", arg);
+	exit(-1);
+    }
+
+    return (uintptr_t) value;
+}
+
+static void
+usage(char *prog){
+    fprintf(stderr,
+	    "Usage: %s [options]\n"
+	    "  -n count     keys per schema, K and M suffixes allowed (default %d)\n"
+	    "  -o ops       operations of each workload (default key count)\n"
+	    "  -k names     comma separated schemas : int, mixed, long_str (default all)\n"
+	    "  -e names     comma separated encodings : native, ordered, prefixed, fixed (default all)\n"
+	    "  -w names     comma separated operations : encode, decode, compare, builtin, field (default all)\n"
+	    "  -s seed      random seed (default 1)\n"
+	    "  -f format    csv or json (default csv)\n",
+	    prog, DEFAULT_KEY_COUNT);
+    exit(-1);
+}
+
+int
+main(int argc, char **argv){
+    key_type int_types[] = { BPT_INT, BPT_INT, BPT_INT },
+	mixed_types[] = { BPT_INT, BPT_DOUBLE, BPT_STRING, BPT_BOOLEAN },
+	long_str_types[] = { BPT_STRING, BPT_STRING };
+    int int_sizes[] = { 0, 0, 0 },
+	mixed_sizes[] = { 0, 0, SHORT_STR_SIZE, 0 },
+	long_str_sizes[] = { LONG_STR_SIZE, LONG_STR_SIZE };
+    key_schema schemas[3];
+    bench_config config;
+    key_encoding encoding;
+    int opt, i;
+
+    memset(&config, 0, sizeof(bench_config));
+    config.keys = DEFAULT_KEY_COUNT;
+    config.seed = 1;
+    config.format = FORMAT_CSV;
+
+    while((opt = getopt(argc, argv, "n:o:k:e:w:s:f:h")) != -1){
+	switch(opt){
+	    case 'n':
+		config.keys = parse_count(optarg);
+		break;
+	    case 'o':
+		config.ops = parse_count(optarg);
+		break;
+	    case 'k':
+		config.schemas = optarg;
+		break;
+	    case 'e':
+		config.encodings = optarg;
+		break;
+	    case 'w':
+		config.operations = optarg;
+		break;
+	    case 's':
+		config.seed = strtoull(optarg, NULL, 10);
+		break;
+	    case 'f':
+		if (strcmp(optarg, "csv") == 0)
+		    config.format = FORMAT_CSV;
+		else if (strcmp(optarg, "json") == 0)
+		    config.format = FORMAT_JSON;
+		else
+		    usage(argv[0]);
+		break;
+	    default:
+		usage(argv[0]);
+	}
+    }
+
+    print_header(&config);
+
+    for (encoding = BPT_NATIVE; encoding <= BPT_FIXED_WIDTH; encoding++){
+	if (!name_enabled(config.encodings, encoding_names[encoding]))
+	    continue;
+
+	schema_init(&schemas[0], "int", int_types, int_sizes, 3,
+		    gen_int_values, encoding);
+	schema_init(&schemas[1], "mixed", mixed_types, mixed_sizes, 4,
+		    gen_mixed_values, encoding);
+	schema_init(&schemas[2], "long_str", long_str_types, long_str_sizes, 2,
+		    gen_long_str_values, encoding);
+
+	for (i = 0; i < 3; i++){
+	    if (!name_enabled(config.schemas, schemas[i].name))
+		continue;
+	    rng_state = config.seed * 0x9E3779B97F4A7C15ULL + 1;
+	    run_schema(&config, &schemas[i]);
+	}
+
+	for (i = 0; i < 3; i++)
+	    schema_destroy(&schemas[i]);
+    }
+
+    print_footer(&config);
+
+    return 0;
+}
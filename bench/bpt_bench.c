@@ -0,0 +1,893 @@
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../b_plus_tree.h"
+#include "bpt_perf.h"
+
+/*
+ * Benchmark driver of the B+ tree library.
+ *
+ * For each combination of the key count, 'max_keys' and the leaf prefetch
+ * distance of bpt_set_scan_prefetch(), run the workloads below and print
+ * one row per workload in CSV or JSON.
+ *
+ *   insert_seq      insert the keys in ascending order
+ *   insert_rand     insert the keys in random order
+ *   insert_zipf     insert keys drawn from a Zipfian distribution, where
+ *                   the hot keys hit duplicates
+ *   lookup_uniform  search for the existing keys at random
+ *   lookup_zipf     search for the existing keys with Zipfian popularity
+ *   lookup_negative search for the keys between the existing ones
+ *   range_scan      search for a random key and walk the next keys by
+ *                   bpt_next_leaf(), which prefetches the leaves ahead
+ *   mixed           lookups, inserts and deletes in the given ratio
+ *   delete_rand     delete all the keys in random order
+ *
+ * With -c, calibrate the node size instead. For each key count and node
+ * byte size, build the tree of insert_rand with the max_keys whose nodes
+ * fit in the size, see bpt_max_keys_for_node_size(), and run
+ *
+ *   calibrate       search for the existing keys at random
+ *
+ * The fastest node size for each key count is printed to stderr.
+ *
+ * With -p, the hardware counters of perf_event_open(2) are read around
+ * each workload and reported per operation. The counts of the timestamps
+ * and the histogram update around each operation, measured on an empty
+ * operation beforehand, are subtracted. The columns of unavailable
+ * counters are left empty in CSV and null in JSON.
+ *
+ * With -k, every tree packs the keys of its leaves by
+ * bpt_set_key_packing(), which the lookups and the memory per key show.
+ *
+ * The tree of insert_rand is used by the following workloads up to
+ * delete_rand. Existing keys are odd numbers, so the even numbers are
+ * never found.
+ */
+
+#define DEFAULT_KEY_COUNTS "1000,100000,1000000"
+#define DEFAULT_MAX_KEYS "4,16,64"
+#define DEFAULT_PREFETCH "4"
+#define DEFAULT_SCAN_LENGTH 100
+#define DEFAULT_READ_PERCENT 90
+#define DEFAULT_ZIPF_THETA 0.99
+#define MAX_SWEEP 32
+
+typedef enum output_format {
+    FORMAT_CSV,
+    FORMAT_JSON,
+} output_format;
+
+typedef struct bench_config {
+    uintptr_t key_counts[MAX_SWEEP];
+    int key_counts_num;
+    uint16_t max_keys[MAX_SWEEP];
+    int max_keys_num;
+    uint16_t prefetch[MAX_SWEEP];
+    int prefetch_num;
+
+    /* Operations of lookup, scan and mixed workloads. Zero for key count */
+    uintptr_t ops;
+
+    uintptr_t scan_length;
+    int read_percent;
+    double zipf_theta;
+    uint64_t seed;
+    output_format format;
+    bool perf;
+    bool key_packing;
+
+    /* Comma separated names of workloads to run. NULL to run all */
+    char *workloads;
+
+    /* Node sizes in bytes to calibrate by -c. None to run the workloads */
+    uintptr_t node_sizes[MAX_SWEEP];
+    int node_sizes_num;
+} bench_config;
+
+/*
+ * Result of one workload.
+ */
+typedef struct bench_result {
+    const char *workload;
+    uintptr_t keys;
+    uint16_t max_keys;
+    uint16_t prefetch;
+    uintptr_t ops;
+    double seconds;
+    bpt_histogram latency;
+    double bytes_per_key;
+    uint64_t perf_values[PERF_EVENTS_NUM];
+    bool perf_available[PERF_EVENTS_NUM];
+} bench_result;
+
+/*
+ * Zipfian generator by Gray et al., "Quickly generating billion-record
+ * synthetic databases", as used by YCSB.
+ */
+typedef struct zipf_gen {
+    uintptr_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} zipf_gen;
+
+static uint64_t rng_state;
+static uint16_t scan_prefetch = BPT_SCAN_PREFETCH_DEFAULT;
+static bool key_packing = false;
+static bool first_row = true;
+static perf_counters perf;
+
+/* Counts per operation of TIMED_OP() itself. See measure_perf_overhead() */
+static double perf_overhead[PERF_EVENTS_NUM];
+
+/*
+ * xorshift64*
+ */
+static uint64_t
+rng_next(void){
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double
+rng_double(void){
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t
+clock_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+zipf_init(zipf_gen *z, uintptr_t n, double theta){
+    double zeta2 = 0;
+    uintptr_t i;
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (i = 1; i <= n; i++)
+	z->zetan += 1.0 / pow((double) i, theta);
+    for (i = 1; i <= 2 && i <= n; i++)
+	zeta2 += 1.0 / pow((double) i, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+/*
+ * Return the rank from 0 (the hottest) to n - 1.
+ */
+static uintptr_t
+zipf_next(zipf_gen *z){
+    double u = rng_double(), uz = u * z->zetan;
+    uintptr_t rank;
+
+    if (uz < 1.0)
+	return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+	return 1;
+
+    rank = (uintptr_t) (z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+
+    return rank < z->n ? rank : z->n - 1;
+}
+
+/*
+ * Spread the hot ranks over the key space. Return the index of the key
+ * from 0 to n - 1.
+ */
+static uintptr_t
+zipf_scatter(uintptr_t rank, uintptr_t n){
+    return (uintptr_t) ((rank * 0x9E3779B97F4A7C15ULL) % n);
+}
+
+/*
+ * The i-th existing key. Zero is never used as a key.
+ */
+static inline void *
+key_of(uintptr_t index){
+    return (void *) (index * 2 + 1);
+}
+
+static int
+bench_key_compare(void *key1, void *key2, void *metadata){
+    uintptr_t k1 = (uintptr_t) key1, k2 = (uintptr_t) key2;
+
+    return k1 < k2 ? -1 : (k1 == k2 ? 0 : 1);
+}
+
+static void
+bench_nop_free(void *p){
+}
+
+static uint64_t
+bench_key_integer(void *key, void *metadata){
+    return (uintptr_t) key;
+}
+
+static bpt_tree *
+bench_tree_init(uint16_t max_keys){
+    bpt_tree *tree;
+
+    if ((tree = bpt_init(bench_key_compare, bench_nop_free, bench_nop_free,
+			 max_keys, NULL)) == NULL){
+	fprintf(stderr, "failed to create a tree with max keys = %u\n",
+		max_keys);
+	exit(-1);
+    }
+    (void) bpt_set_scan_prefetch(tree, scan_prefetch);
+    if (key_packing)
+	(void) bpt_set_key_packing(tree, bench_key_integer);
+
+    return tree;
+}
+
+/*
+ * Return a random permutation of 0 to n - 1.
+ */
+static uintptr_t *
+gen_permutation(uintptr_t n){
+    uintptr_t *perm, i, j, tmp;
+
+    if ((perm = malloc(sizeof(uintptr_t) * n)) == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+
+    for (i = 0; i < n; i++)
+	perm[i] = i;
+    for (i = n - 1; i > 0; i--){
+	j = rng_next() % (i + 1);
+	tmp = perm[i];
+	perm[i] = perm[j];
+	perm[j] = tmp;
+    }
+
+    return perm;
+}
+
+static bool
+workload_enabled(bench_config *config, const char *name){
+    const char *p;
+    size_t len = strlen(name);
+
+    if (config->workloads == NULL)
+	return true;
+
+    for (p = config->workloads; (p = strstr(p, name)) != NULL; p += len){
+	if ((p == config->workloads || p[-1] == ',') &&
+	    (p[len] == '\0' || p[len] == ','))
+	    return true;
+    }
+
+    return false;
+}
+
+static double
+bytes_per_key(bpt_tree *tree){
+    bpt_tree_stats stats;
+
+    if (!bpt_stats_fast(tree, &stats) || stats.keys == 0)
+	return 0;
+
+    return (double) stats.bytes / stats.keys;
+}
+
+static void
+print_header(bench_config *config){
+    int i;
+
+    if (config->format == FORMAT_CSV){
+	printf("workload,keys,max_keys,prefetch,ops,seconds,ops_per_sec,ns_per_op,"
+	       "p50_ns,p99_ns,p999_ns,max_ns,bytes_per_key");
+	for (i = 0; i < PERF_EVENTS_NUM; i++)
+	    printf(",%s_per_op", perf_event_name(i));
+	printf("\n");
+    }else
+	printf("[\n");
+}
+
+static void
+print_footer(bench_config *config){
+    if (config->format == FORMAT_JSON)
+	printf("\n]\n");
+}
+
+/*
+ * Print the hardware counters per operation after the other columns.
+ */
+static void
+print_perf_columns(bench_config *config, bench_result *result){
+    double per_op;
+    int i;
+
+    for (i = 0; i < PERF_EVENTS_NUM; i++){
+	if (config->format == FORMAT_JSON)
+	    printf(", \"%s_per_op\": ", perf_event_name(i));
+	else
+	    printf(",");
+
+	if (!result->perf_available[i] || result->ops == 0){
+	    if (config->format == FORMAT_JSON)
+		printf("null");
+	    continue;
+	}
+
+	per_op = (double) result->perf_values[i] / result->ops -
+	    perf_overhead[i];
+	printf("%.3f", per_op > 0 ? per_op : 0);
+    }
+}
+
+static void
+print_result(bench_config *config, bench_result *result){
+    double ops_per_sec = result->seconds > 0 ? result->ops / result->seconds : 0,
+	ns_per_op = result->ops > 0 ? result->seconds * 1e9 / result->ops : 0;
+    uint64_t p50 = bpt_histogram_percentile(&result->latency, 50.0),
+	p99 = bpt_histogram_percentile(&result->latency, 99.0),
+	p999 = bpt_histogram_percentile(&result->latency, 99.9);
+
+    if (config->format == FORMAT_CSV){
+	printf("%s,%lu,%u,%u,%lu,%.6f,%.0f,%.1f,%lu,%lu,%lu,%lu,%.1f",
+	       result->workload, result->keys, result->max_keys,
+	       result->prefetch, result->ops,
+	       result->seconds, ops_per_sec, ns_per_op, p50, p99, p999,
+	       result->latency.max, result->bytes_per_key);
+	print_perf_columns(config, result);
+	printf("\n");
+    }else{
+	printf("%s  {\"workload\": \"%s\", \"keys\": %lu, \"max_keys\": %u, "
+	       "\"prefetch\": %u, \"ops\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+	       "\"ns_per_op\": %.1f, \"p50_ns\": %lu, \"p99_ns\": %lu, "
+	       "\"p999_ns\": %lu, \"max_ns\": %lu, \"bytes_per_key\": %.1f",
+	       first_row ? "" : ",\n",
+	       result->workload, result->keys, result->max_keys,
+	       result->prefetch, result->ops,
+	       result->seconds, ops_per_sec, ns_per_op, p50, p99, p999,
+	       result->latency.max, result->bytes_per_key);
+	print_perf_columns(config, result);
+	printf("}");
+	first_row = false;
+    }
+    fflush(stdout);
+}
+
+/*
+ * Start and finish the measurement of one workload. The hardware
+ * counters are not opened without -p, so starting and stopping them
+ * costs nothing then.
+ */
+static void
+result_begin(bench_result *result, const char *workload, uintptr_t keys,
+	     uint16_t max_keys){
+    memset(result, 0, sizeof(bench_result));
+    result->workload = workload;
+    result->keys = keys;
+    result->max_keys = max_keys;
+    result->prefetch = scan_prefetch;
+    bpt_histogram_reset(&result->latency);
+    perf_start(&perf);
+}
+
+static void
+result_end(bench_config *config, bench_result *result, uint64_t start,
+	   bpt_tree *tree){
+    result->seconds = (clock_ns() - start) / 1e9;
+    perf_stop(&perf);
+    memcpy(result->perf_values, perf.values, sizeof(perf.values));
+    memcpy(result->perf_available, perf.available, sizeof(perf.available));
+    if (tree != NULL)
+	result->bytes_per_key = bytes_per_key(tree);
+    print_result(config, result);
+}
+
+/*
+ * Measure one operation. The timestamps are included in the throughput.
+ */
+#define TIMED_OP(result, op)					\
+    do {							\
+	uint64_t op_start = clock_ns();				\
+	op;							\
+	bpt_histogram_record(&(result)->latency,		\
+			     clock_ns() - op_start);		\
+	(result)->ops++;					\
+    } while(0)
+
+/*
+ * Count the hardware events of TIMED_OP() around an empty operation, to
+ * be subtracted from the counts per operation of the workloads.
+ */
+static void
+measure_perf_overhead(void){
+    bench_result result;
+    uintptr_t i, ops = 1000000;
+    int e;
+
+    memset(&result, 0, sizeof(bench_result));
+    perf_start(&perf);
+    for (i = 0; i < ops; i++)
+	TIMED_OP(&result, (void) 0);
+    perf_stop(&perf);
+
+    for (e = 0; e < PERF_EVENTS_NUM; e++)
+	perf_overhead[e] = perf.available[e] ?
+	    (double) perf.values[e] / ops : 0;
+}
+
+static void
+run_insert_seq(bench_config *config, uintptr_t n, uint16_t max_keys){
+    bench_result result;
+    bpt_tree *tree = bench_tree_init(max_keys);
+    uint64_t start;
+    uintptr_t i;
+
+    result_begin(&result, "insert_seq", n, max_keys);
+    start = clock_ns();
+    for (i = 0; i < n; i++)
+	TIMED_OP(&result, bpt_insert(tree, key_of(i), key_of(i)));
+    result_end(config, &result, start, tree);
+
+    bpt_destroy(tree);
+}
+
+static void
+run_insert_zipf(bench_config *config, uintptr_t n, uint16_t max_keys,
+		zipf_gen *zipf){
+    bench_result result;
+    bpt_tree *tree = bench_tree_init(max_keys);
+    uint64_t start;
+    uintptr_t i, index;
+
+    result_begin(&result, "insert_zipf", n, max_keys);
+    start = clock_ns();
+    for (i = 0; i < n; i++){
+	index = zipf_scatter(zipf_next(zipf), n);
+	TIMED_OP(&result, bpt_insert(tree, key_of(index), key_of(index)));
+    }
+    result_end(config, &result, start, tree);
+
+    bpt_destroy(tree);
+}
+
+static void
+run_lookups(bench_config *config, bpt_tree *tree, uintptr_t n,
+	    uint16_t max_keys, zipf_gen *zipf){
+    bench_result result;
+    uint64_t start;
+    uintptr_t i, index, ops = config->ops ? config->ops : n;
+    uintptr_t found = 0;
+    bool ret;
+
+    if (workload_enabled(config, "lookup_uniform")){
+	result_begin(&result, "lookup_uniform", n, max_keys);
+	start = clock_ns();
+	for (i = 0; i < ops; i++){
+	    index = rng_next() % n;
+	    TIMED_OP(&result, ret = bpt_search(tree, key_of(index), NULL, NULL));
+	    found += ret;
+	}
+	result_end(config, &result, start, tree);
+    }
+
+    if (workload_enabled(config, "lookup_zipf")){
+	result_begin(&result, "lookup_zipf", n, max_keys);
+	start = clock_ns();
+	for (i = 0; i < ops; i++){
+	    index = zipf_scatter(zipf_next(zipf), n);
+	    TIMED_OP(&result, ret = bpt_search(tree, key_of(index), NULL, NULL));
+	    found += ret;
+	}
+	result_end(config, &result, start, tree);
+    }
+
+    if (workload_enabled(config, "lookup_negative")){
+	result_begin(&result, "lookup_negative", n, max_keys);
+	start = clock_ns();
+	for (i = 0; i < ops; i++){
+	    index = rng_next() % n;
+	    TIMED_OP(&result,
+		     ret = bpt_search(tree, (void *) ((index + 1) * 2), NULL, NULL));
+	    found += ret;
+	}
+	result_end(config, &result, start, tree);
+    }
+
+    /* Keep the searches from being optimized out */
+    if (found == (uintptr_t) -1)
+	printf("unexpected\n");
+}
+
+/*
+ * Return the number of keys walked from the leaf of 'key'.
+ */
+static uintptr_t
+scan_from(bpt_tree *tree, void *key, uintptr_t length){
+    bpt_leaf_cursor cursor;
+    bpt_node *leaf = NULL;
+    uintptr_t walked = 0;
+    int i;
+
+    (void) bpt_search(tree, key, &leaf, NULL);
+
+    for (leaf = bpt_begin_leaf_walk(tree, &cursor, leaf);
+	 leaf != NULL && walked < length; leaf = bpt_next_leaf(&cursor)){
+	ll_begin_iter(leaf->keys);
+	for (i = 0; i < ll_get_length(leaf->keys) && walked < length; i++){
+	    if ((uintptr_t) ll_get_iter_data(leaf->keys) >= (uintptr_t) key)
+		walked++;
+	}
+	ll_end_iter(leaf->keys);
+    }
+
+    return walked;
+}
+
+static void
+run_range_scan(bench_config *config, bpt_tree *tree, uintptr_t n,
+	       uint16_t max_keys){
+    bench_result result;
+    uint64_t start;
+    uintptr_t i, ops = config->ops ? config->ops : n, walked = 0;
+
+    /* Each scan walks many keys. Keep the total work comparable */
+    ops = ops / (config->scan_length / 10 + 1) + 1;
+
+    result_begin(&result, "range_scan", n, max_keys);
+    start = clock_ns();
+    for (i = 0; i < ops; i++)
+	TIMED_OP(&result, walked += scan_from(tree, key_of(rng_next() % n),
+					      config->scan_length));
+    result_end(config, &result, start, tree);
+
+    if (walked == (uintptr_t) -1)
+	printf("unexpected\n");
+}
+
+/*
+ * Lookups for 'read_percent' of operations. The rest is half inserts and
+ * half deletes of random keys, which keeps the tree size stable.
+ */
+static void
+run_mixed(bench_config *config, bpt_tree *tree, uintptr_t n,
+	  uint16_t max_keys){
+    bench_result result;
+    uint64_t start;
+    uintptr_t i, index, ops = config->ops ? config->ops : n;
+    int dice;
+
+    result_begin(&result, "mixed", n, max_keys);
+    start = clock_ns();
+    for (i = 0; i < ops; i++){
+	index = rng_next() % n;
+	dice = (int) (rng_next() % 100);
+	if (dice < config->read_percent)
+	    TIMED_OP(&result, bpt_search(tree, key_of(index), NULL, NULL));
+	else if ((dice - config->read_percent) % 2 == 0)
+	    TIMED_OP(&result, bpt_insert(tree, key_of(index), key_of(index)));
+	else
+	    TIMED_OP(&result, bpt_delete(tree, key_of(index), NULL));
+    }
+    result_end(config, &result, start, tree);
+}
+
+static void
+run_delete_rand(bench_config *config, bpt_tree *tree, uintptr_t n,
+		uint16_t max_keys){
+    bench_result result;
+    uintptr_t *perm = gen_permutation(n), i;
+    uint64_t start;
+
+    result_begin(&result, "delete_rand", n, max_keys);
+    start = clock_ns();
+    for (i = 0; i < n; i++)
+	TIMED_OP(&result, bpt_delete(tree, key_of(perm[i]), NULL));
+    result_end(config, &result, start, NULL);
+
+    free(perm);
+}
+
+static void
+run_one(bench_config *config, uintptr_t n, uint16_t max_keys,
+	zipf_gen *zipf){
+    bench_result result;
+    bpt_tree *tree;
+    uintptr_t *perm, i;
+    uint64_t start;
+
+    if (workload_enabled(config, "insert_seq"))
+	run_insert_seq(config, n, max_keys);
+
+    if (workload_enabled(config, "insert_zipf"))
+	run_insert_zipf(config, n, max_keys, zipf);
+
+    /* Build the shared tree, measured as insert_rand */
+    tree = bench_tree_init(max_keys);
+    perm = gen_permutation(n);
+    result_begin(&result, "insert_rand", n, max_keys);
+    start = clock_ns();
+    for (i = 0; i < n; i++)
+	TIMED_OP(&result, bpt_insert(tree, key_of(perm[i]), key_of(perm[i])));
+    if (workload_enabled(config, "insert_rand"))
+	result_end(config, &result, start, tree);
+    free(perm);
+
+    run_lookups(config, tree, n, max_keys, zipf);
+
+    if (workload_enabled(config, "range_scan"))
+	run_range_scan(config, tree, n, max_keys);
+
+    if (workload_enabled(config, "mixed"))
+	run_mixed(config, tree, n, max_keys);
+
+    if (workload_enabled(config, "delete_rand")){
+	/* The mixed workload may have changed the key set. Rebuild it */
+	if (workload_enabled(config, "mixed")){
+	    bpt_destroy(tree);
+	    tree = bench_tree_init(max_keys);
+	    perm = gen_permutation(n);
+	    for (i = 0; i < n; i++)
+		(void) bpt_insert(tree, key_of(perm[i]), key_of(perm[i]));
+	    free(perm);
+	}
+	run_delete_rand(config, tree, n, max_keys);
+    }
+
+    bpt_destroy(tree);
+}
+
+/*
+ * Measure uniform lookups for each node size of -c, with the same keys,
+ * and report the fastest size.
+ */
+static void
+run_calibration(bench_config *config, uintptr_t n){
+    bench_result result;
+    bpt_tree *tree;
+    uintptr_t *perm, i, ops = config->ops ? config->ops : n, found = 0;
+    uintptr_t best_size = 0;
+    uint16_t max_keys, best_max_keys = 0;
+    double ns, best_ns = 0;
+    uint64_t start;
+    int j;
+    bool ret;
+
+    for (j = 0; j < config->node_sizes_num; j++){
+	/* The error has been printed for too small sizes */
+	if ((max_keys = bpt_max_keys_for_node_size(config->node_sizes[j],
+						   0)) == 0)
+	    continue;
+
+	rng_state = config->seed * 0x9E3779B97F4A7C15ULL + 1;
+	tree = bench_tree_init(max_keys);
+	perm = gen_permutation(n);
+	for (i = 0; i < n; i++)
+	    (void) bpt_insert(tree, key_of(perm[i]), key_of(perm[i]));
+	free(perm);
+
+	result_begin(&result, "calibrate", n, max_keys);
+	start = clock_ns();
+	for (i = 0; i < ops; i++){
+	    TIMED_OP(&result, ret = bpt_search(tree, key_of(rng_next() % n),
+					       NULL, NULL));
+	    found += ret;
+	}
+	result_end(config, &result, start, tree);
+	bpt_destroy(tree);
+
+	ns = result.seconds * 1e9 / result.ops;
+	if (best_size == 0 || ns < best_ns){
+	    best_size = config->node_sizes[j];
+	    best_max_keys = max_keys;
+	    best_ns = ns;
+	}
+    }
+
+    if (best_size != 0)
+	fprintf(stderr, "fastest node size for %lu keys : %lu bytes "
+		"(max_keys = %u, %.1f ns/op)\n", (unsigned long) n,
+		(unsigned long) best_size, best_max_keys, best_ns);
+
+    /* Keep the searches from being optimized out */
+    if (found == (uintptr_t) -1)
+	printf("unexpected\n");
+}
+
+/*
+ * Parse the comma separated numbers. Return the number of items.
+ */
+static int
+parse_list(char *arg, uintptr_t *values, uintptr_t min, uintptr_t max){
+    char *token, *end, *saveptr = NULL;
+    unsigned long long value;
+    int num = 0;
+
+    for (token = strtok_r(arg, ",", &saveptr); token != NULL;
+	 token = strtok_r(NULL, ",", &saveptr)){
+	errno = 0;
+	value = strtoull(token, &end, 10);
+	/* Accept the suffixes of K and M */
+	if (*end == 'K' || *end == 'k'){
+	    value *= 1000;
+	    end++;
+	}else if (*end == 'M' || *end == 'm'){
+	    value *= 1000000;
+	    end++;
+	}
+	if (errno != 0 || *end != '\0' || value < min || value > max ||
+	    num == MAX_SWEEP){
+	    fprintf(stderr, "invalid value '%s'\n", token);
+	    exit(-1);
+	}
+	values[num++] = (uintptr_t) value;
+    }
+
+    return num;
+}
+
+static void
+usage(char *prog){
+    fprintf(stderr,
+	    "Usage: %s [options]\n"
+	    "  -n counts    comma separated key counts, K and M suffixes allowed (default %s)\n"
+	    "  -m max_keys  comma separated max_keys values (default %s)\n"
+	    "  -d distances comma separated leaf prefetch distances, 0 to disable (default %s)\n"
+	    "  -o ops       operations of lookup, scan and mixed workloads, K and M suffixes allowed (default key count)\n"
+	    "  -w names     comma separated workloads to run (default all)\n"
+	    "  -l length    keys walked by one range scan, K and M suffixes allowed (default %d)\n"
+	    "  -r percent   lookups in the mixed workload (default %d)\n"
+	    "  -z theta     Zipfian constant (default %.2f)\n"
+	    "  -s seed      random seed (default 1)\n"
+	    "  -f format    csv or json (default csv)\n"
+	    "  -p           report the hardware counters per operation\n"
+	    "  -k           pack the leaf keys by bpt_set_key_packing\n"
+	    "  -c sizes     calibrate comma separated node sizes in bytes instead of -m and -w\n",
+	    prog, DEFAULT_KEY_COUNTS, DEFAULT_MAX_KEYS, DEFAULT_PREFETCH,
+	    DEFAULT_SCAN_LENGTH,
+	    DEFAULT_READ_PERCENT, DEFAULT_ZIPF_THETA);
+    exit(-1);
+}
+
+int
+main(int argc, char **argv){
+    bench_config config;
+    uintptr_t values[MAX_SWEEP];
+    char key_counts[] = DEFAULT_KEY_COUNTS, max_keys[] = DEFAULT_MAX_KEYS,
+	prefetch[] = DEFAULT_PREFETCH;
+    zipf_gen zipf;
+    int opt, i, j, k;
+
+    memset(&config, 0, sizeof(bench_config));
+    config.scan_length = DEFAULT_SCAN_LENGTH;
+    config.read_percent = DEFAULT_READ_PERCENT;
+    config.zipf_theta = DEFAULT_ZIPF_THETA;
+    config.seed = 1;
+    config.format = FORMAT_CSV;
+    config.key_counts_num = parse_list(key_counts, config.key_counts,
+				       1, UINTPTR_MAX / 4);
+    config.max_keys_num = parse_list(max_keys, values, 3, UINT16_MAX);
+    for (i = 0; i < config.max_keys_num; i++)
+	config.max_keys[i] = (uint16_t) values[i];
+    config.prefetch_num = parse_list(prefetch, values, 0,
+				     BPT_SCAN_PREFETCH_MAX);
+    for (i = 0; i < config.prefetch_num; i++)
+	config.prefetch[i] = (uint16_t) values[i];
+
+    while((opt = getopt(argc, argv, "n:m:d:o:w:l:r:z:s:f:pkc:h")) != -1){
+	switch(opt){
+	    case 'n':
+		config.key_counts_num = parse_list(optarg, config.key_counts,
+						   1, UINTPTR_MAX / 4);
+		break;
+	    case 'm':
+		config.max_keys_num = parse_list(optarg, values, 3, UINT16_MAX);
+		for (i = 0; i < config.max_keys_num; i++)
+		    config.max_keys[i] = (uint16_t) values[i];
+		break;
+	    case 'd':
+		config.prefetch_num = parse_list(optarg, values, 0,
+						 BPT_SCAN_PREFETCH_MAX);
+		for (i = 0; i < config.prefetch_num; i++)
+		    config.prefetch[i] = (uint16_t) values[i];
+		break;
+	    case 'o':
+		if (parse_list(optarg, values, 1, UINTPTR_MAX / 4) != 1)
+		    usage(argv[0]);
+		config.ops = values[0];
+		break;
+	    case 'w':
+		config.workloads = optarg;
+		break;
+	    case 'l':
+		if (parse_list(optarg, values, 1, UINTPTR_MAX / 4) != 1)
+		    usage(argv[0]);
+		config.scan_length = values[0];
+		break;
+	    case 'r':
+		config.read_percent = atoi(optarg);
+		if (config.read_percent < 0 || config.read_percent > 100)
+		    usage(argv[0]);
+		break;
+	    case 'z':
+		config.zipf_theta = atof(optarg);
+		if (config.zipf_theta <= 0.0 || config.zipf_theta >= 1.0)
+		    usage(argv[0]);
+		break;
+	    case 's':
+		config.seed = strtoull(optarg, NULL, 10);
+		break;
+	    case 'f':
+		if (strcmp(optarg, "csv") == 0)
+		    config.format = FORMAT_CSV;
+		else if (strcmp(optarg, "json") == 0)
+		    config.format = FORMAT_JSON;
+		else
+		    usage(argv[0]);
+		break;
+	    case 'p':
+		config.perf = true;
+		break;
+	    case 'k':
+		config.key_packing = true;
+		break;
+	    case 'c':
+		config.node_sizes_num = parse_list(optarg, config.node_sizes,
+						   1, UINTPTR_MAX / 4);
+		break;
+	    default:
+		usage(argv[0]);
+	}
+    }
+
+    key_packing = config.key_packing;
+
+    perf_init(&perf);
+    if (config.perf){
+	if (perf_open(&perf) == 0)
+	    fprintf(stderr, "no hardware counters are available. "
+		    "Check perf_event_paranoid or the container settings\n");
+	else
+	    measure_perf_overhead();
+    }
+
+    print_header(&config);
+
+    for (i = 0; i < config.key_counts_num; i++){
+	if (config.node_sizes_num > 0){
+	    scan_prefetch = config.prefetch[0];
+	    run_calibration(&config, config.key_counts[i]);
+	    continue;
+	}
+	zipf_init(&zipf, config.key_counts[i], config.zipf_theta);
+	for (j = 0; j < config.max_keys_num; j++){
+	    for (k = 0; k < config.prefetch_num; k++){
+		/* Same keys for every max_keys and distance */
+		rng_state = config.seed * 0x9E3779B97F4A7C15ULL + 1;
+		scan_prefetch = config.prefetch[k];
+		run_one(&config, config.key_counts[i], config.max_keys[j],
+			&zipf);
+	    }
+	}
+    }
+
+    print_footer(&config);
+    perf_close(&perf);
+
+    return 0;
+}
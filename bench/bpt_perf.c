@@ -0,0 +1,196 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "bpt_perf.h"
+
+static const char *event_names[PERF_EVENTS_NUM] = {
+    "cycles",
+    "instructions",
+    "l1d_misses",
+    "llc_misses",
+    "dtlb_misses",
+    "branch_misses",
+};
+
+const char *
+perf_event_name(perf_event_kind kind){
+    return event_names[kind];
+}
+
+/*
+ * Mark all the events unavailable. Call this before any other function.
+ */
+void
+perf_init(perf_counters *counters){
+    int i;
+
+    memset(counters, 0, sizeof(perf_counters));
+    for (i = 0; i < PERF_EVENTS_NUM; i++)
+	counters->fds[i] = -1;
+    counters->leader = -1;
+}
+
+#ifdef __linux__
+
+#define HW_CACHE_READ_MISS(cache)				\
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |		\
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/*
+ * Open one event for this thread on any CPU, counting the user space only.
+ * The event joins the group of 'leader', or leads a new group if it's -1.
+ * Only the leader starts disabled. The others follow it.
+ */
+static int
+perf_open_event(perf_event_kind kind, int leader){
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = leader < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch(kind){
+	case PERF_CYCLES:
+	    attr.type = PERF_TYPE_HARDWARE;
+	    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	    break;
+	case PERF_INSTRUCTIONS:
+	    attr.type = PERF_TYPE_HARDWARE;
+	    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	    break;
+	case PERF_L1D_MISSES:
+	    attr.type = PERF_TYPE_HW_CACHE;
+	    attr.config = HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D);
+	    break;
+	case PERF_LLC_MISSES:
+	    attr.type = PERF_TYPE_HW_CACHE;
+	    attr.config = HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL);
+	    break;
+	case PERF_DTLB_MISSES:
+	    attr.type = PERF_TYPE_HW_CACHE;
+	    attr.config = HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB);
+	    break;
+	case PERF_BRANCH_MISSES:
+	    attr.type = PERF_TYPE_HARDWARE;
+	    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+	    break;
+	default:
+	    return -1;
+    }
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+/*
+ * Open all the events. Return the number of available events.
+ */
+int
+perf_open(perf_counters *counters){
+    int i, available = 0;
+
+    perf_init(counters);
+
+    for (i = 0; i < PERF_EVENTS_NUM; i++){
+	if ((counters->fds[i] = perf_open_event(i, counters->leader)) >= 0){
+	    if (counters->leader < 0)
+		counters->leader = counters->fds[i];
+	    available++;
+	}else
+	    fprintf(stderr, "perf event '%s' is unavailable : %s\n",
+		    event_names[i], strerror(errno));
+    }
+
+    return available;
+}
+
+void
+perf_start(perf_counters *counters){
+    if (counters->leader < 0)
+	return;
+
+    ioctl(counters->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/*
+ * Stop the events and read the counts.
+ */
+void
+perf_stop(perf_counters *counters){
+    uint64_t buf[3];
+    int i;
+
+    if (counters->leader >= 0)
+	ioctl(counters->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for (i = 0; i < PERF_EVENTS_NUM; i++){
+	counters->available[i] = false;
+	if (counters->fds[i] < 0)
+	    continue;
+
+	/*
+	 * The value, the time enabled and the time running. The group
+	 * never runs if it has more events than the PMU can count at once
+	 */
+	if (read(counters->fds[i], buf, sizeof(buf)) != sizeof(buf) ||
+	    buf[2] == 0)
+	    continue;
+
+	if (buf[2] < buf[1])
+	    counters->values[i] = (uint64_t) ((double) buf[0] * buf[1] / buf[2]);
+	else
+	    counters->values[i] = buf[0];
+	counters->available[i] = true;
+    }
+}
+
+void
+perf_close(perf_counters *counters){
+    int i;
+
+    for (i = 0; i < PERF_EVENTS_NUM; i++){
+	if (counters->fds[i] >= 0)
+	    close(counters->fds[i]);
+	counters->fds[i] = -1;
+	counters->available[i] = false;
+    }
+    counters->leader = -1;
+}
+
+#else
+
+/* No perf_event_open(2). Every event is unavailable */
+int
+perf_open(perf_counters *counters){
+    perf_init(counters);
+
+    fprintf(stderr, "perf events are unavailable on this platform\n");
+
+    return 0;
+}
+
+void
+perf_start(perf_counters *counters){
+}
+
+void
+perf_stop(perf_counters *counters){
+}
+
+void
+perf_close(perf_counters *counters){
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __BPT_PERF__
+#define __BPT_PERF__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hardware performance counters read by perf_event_open(2) around each
+ * workload of the benchmark.
+ *
+ * The events are opened as one group led by the first available event,
+ * so that they are enabled and disabled together and count the same
+ * instructions. The events the CPU or the kernel doesn't support are
+ * left out of the group and reported as unavailable. In containers or
+ * with a strict perf_event_paranoid, all of them can be unavailable.
+ */
+typedef enum perf_event_kind {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_EVENTS_NUM,
+} perf_event_kind;
+
+typedef struct perf_counters {
+
+    /* File descriptors of the events. -1 when unavailable */
+    int fds[PERF_EVENTS_NUM];
+
+    /* File descriptor of the group leader, one of 'fds', or -1 */
+    int leader;
+
+    /*
+     * Counts of the last measurement, scaled when the kernel multiplexed
+     * the events. Valid only when 'available' is true.
+     */
+    uint64_t values[PERF_EVENTS_NUM];
+    bool available[PERF_EVENTS_NUM];
+
+} perf_counters;
+
+const char *perf_event_name(perf_event_kind kind);
+void perf_init(perf_counters *counters);
+int perf_open(perf_counters *counters);
+void perf_start(perf_counters *counters);
+void perf_stop(perf_counters *counters);
+void perf_close(perf_counters *counters);
+
+#endif
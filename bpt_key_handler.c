@@ -26,12 +26,13 @@ bkh_free(void *p){
 
 /*
  * Write an integer value from 'int_ptr' to 'key_sequence'.
+ *
+ * The keys after a string can be unaligned. Copy the fixed-size values
+ * by memcpy().
  */
 void *
 bkh_int_write(void *key_sequence, void *int_ptr){
-    int *p = key_sequence;
-
-    *p = *((int *) int_ptr);
+    memcpy(key_sequence, int_ptr, INT_SIZE);
     key_sequence += INT_SIZE;
 
     return key_sequence;
@@ -42,9 +43,7 @@ bkh_int_write(void *key_sequence, void *int_ptr){
  */
 void *
 bkh_int_read(void *key_sequence, void *int_ptr){
-    int *ip = (int *) int_ptr;
-
-    *ip = *((int *) key_sequence);
+    memcpy(int_ptr, key_sequence, INT_SIZE);
     key_sequence += INT_SIZE;
 
     return key_sequence;
@@ -55,9 +54,7 @@ bkh_int_read(void *key_sequence, void *int_ptr){
  */
 void *
 bkh_double_write(void *key_sequence, void *double_ptr){
-    double *dp = (double *) key_sequence;
-
-    *dp = *((double *) double_ptr);
+    memcpy(key_sequence, double_ptr, DOUBLE_SIZE);
     key_sequence += DOUBLE_SIZE;
 
     return key_sequence;
@@ -68,9 +65,7 @@ bkh_double_write(void *key_sequence, void *double_ptr){
  */
 void *
 bkh_double_read(void *key_sequence, void *double_ptr){
-    double *dp = (double *) double_ptr;
-
-    *dp = *((double *) key_sequence);
+    memcpy(double_ptr, key_sequence, DOUBLE_SIZE);
     key_sequence += DOUBLE_SIZE;
 
     return key_sequence;
@@ -110,17 +105,9 @@ bkh_bool_read(void *key_sequence, void *bool_ptr){
  */
 void *
 bkh_str_write(void *key_sequence, void *str_ptr){
-    char *cp = (char *) key_sequence,
-	*s = (char *) str_ptr;
-    int i, str_len = strlen(s);
-
-    for (i = 0; i < str_len; i++){
-	*cp = *s;
-	cp++;
-	s++;
-    }
-    *cp = '\0';
+    size_t str_len = strlen((char *) str_ptr);
 
+    memcpy(key_sequence, str_ptr, str_len + 1);
     key_sequence += (str_len + 1);
 
     return key_sequence;
@@ -134,22 +121,563 @@ bkh_str_write(void *key_sequence, void *str_ptr){
  */
 void *
 bkh_str_read(void *key_sequence, void *str_ptr){
-    char *cp = (char *) key_sequence,
-	*s = (char *) str_ptr;
-    int i, str_len = strlen(cp);
-
-    for (i = 0; i < str_len; i++){
-	*s = *cp;
-	s++;
-	cp++;
-    }
-    *s = '\0';
+    size_t str_len = strlen((char *) key_sequence);
 
+    memcpy(str_ptr, key_sequence, str_len + 1);
     key_sequence += (str_len + 1);
 
     return key_sequence;
 }
 
+/*
+ * Order-preserving key handlers.
+ *
+ * The unsigned byte order of the written sequence is the order of the
+ * values, so that the keys can be compared by memcmp() without reading
+ * them back.
+ */
+
+/*
+ * Write 'value' of 'size' bytes in big-endian.
+ */
+static void *
+bkh_write_big_endian(void *key_sequence, uint64_t value, int size){
+    unsigned char *cp = (unsigned char *) key_sequence;
+    int i;
+
+    for (i = size - 1; i >= 0; i--){
+	cp[i] = (unsigned char) (value & 0xff);
+	value >>= 8;
+    }
+
+    return key_sequence + size;
+}
+
+static uint64_t
+bkh_read_big_endian(void *key_sequence, int size){
+    unsigned char *cp = (unsigned char *) key_sequence;
+    uint64_t value = 0;
+    int i;
+
+    for (i = 0; i < size; i++)
+	value = (value << 8) | cp[i];
+
+    return value;
+}
+
+#define INT_SIGN_BIT ((uint64_t) 1 << (INT_SIZE * 8 - 1))
+#define DOUBLE_SIGN_BIT ((uint64_t) 1 << 63)
+
+/*
+ * Write an integer value from 'int_ptr' in big-endian with the sign bit
+ * flipped, so that the negative values come first.
+ */
+void *
+bkh_int_ordered_write(void *key_sequence, void *int_ptr){
+    unsigned int u = (unsigned int) *((int *) int_ptr);
+
+    return bkh_write_big_endian(key_sequence, u ^ INT_SIGN_BIT, INT_SIZE);
+}
+
+void *
+bkh_int_ordered_read(void *key_sequence, void *int_ptr){
+    uint64_t u = bkh_read_big_endian(key_sequence, INT_SIZE) ^ INT_SIGN_BIT;
+
+    *((int *) int_ptr) = (int) (unsigned int) u;
+
+    return key_sequence + INT_SIZE;
+}
+
+/*
+ * Write a double value from 'double_ptr' in big-endian. Flip the sign bit
+ * of positive values and all the bits of negative values, so that the
+ * negative values come first in the reverse order of their magnitudes.
+ *
+ * -0.0 is written as 0.0, which is equal to it. NaN sorts after the
+ * infinity, or before the negative infinity if its sign bit is set.
+ */
+void *
+bkh_double_ordered_write(void *key_sequence, void *double_ptr){
+    double d = *((double *) double_ptr);
+    uint64_t bits;
+
+    if (d == 0.0)
+	d = 0.0;
+    memcpy(&bits, &d, sizeof(bits));
+    bits = (bits & DOUBLE_SIGN_BIT) ? ~bits : bits ^ DOUBLE_SIGN_BIT;
+
+    return bkh_write_big_endian(key_sequence, bits, DOUBLE_SIZE);
+}
+
+void *
+bkh_double_ordered_read(void *key_sequence, void *double_ptr){
+    uint64_t bits = bkh_read_big_endian(key_sequence, DOUBLE_SIZE);
+
+    bits = (bits & DOUBLE_SIGN_BIT) ? bits ^ DOUBLE_SIGN_BIT : ~bits;
+    memcpy(double_ptr, &bits, sizeof(bits));
+
+    return key_sequence + DOUBLE_SIZE;
+}
+
+/*
+ * Write a bool value from 'bool_ptr' as one byte of 0 or 1.
+ */
+void *
+bkh_bool_ordered_write(void *key_sequence, void *bool_ptr){
+    *((unsigned char *) key_sequence) = *((bool *) bool_ptr) ? 1 : 0;
+
+    return key_sequence + 1;
+}
+
+void *
+bkh_bool_ordered_read(void *key_sequence, void *bool_ptr){
+    *((bool *) bool_ptr) = *((unsigned char *) key_sequence) != 0;
+
+    return key_sequence + 1;
+}
+
+/*
+ * Write a string value from 'str_ptr' with the null-termination.
+ *
+ * The next key follows the null-termination directly. A string can't
+ * contain the null byte, so the null-termination is smaller than any
+ * byte of a longer string that shares the same prefix, and two equal
+ * strings place the next keys at the same position.
+ */
+void *
+bkh_str_ordered_write(void *key_sequence, void *str_ptr){
+    size_t len = strlen((char *) str_ptr) + 1;
+
+    memcpy(key_sequence, str_ptr, len);
+
+    return key_sequence + len;
+}
+
+/*
+ * Read a string value from 'key_sequence' to 'str_ptr'.
+ *
+ * The caller must ensure that the str_ptr has enough
+ * space to copy the string in key_sequence.
+ */
+void *
+bkh_str_ordered_read(void *key_sequence, void *str_ptr){
+    size_t len = strlen((char *) key_sequence) + 1;
+
+    memcpy(str_ptr, key_sequence, len);
+
+    return key_sequence + len;
+}
+
+/*
+ * Write a string value from 'str_ptr' after its length.
+ *
+ * The caller must ensure that the length fits in the 'key_size' given to
+ * bpt_create_encoded_key_metadata().
+ */
+void *
+bkh_str_prefixed_write(void *key_sequence, void *str_ptr){
+    uint16_t str_len = (uint16_t) strlen((char *) str_ptr);
+
+    memcpy(key_sequence, &str_len, STR_LEN_SIZE);
+    memcpy(key_sequence + STR_LEN_SIZE, str_ptr, str_len);
+
+    return key_sequence + STR_LEN_SIZE + str_len;
+}
+
+/*
+ * Read a string value from 'key_sequence' to 'str_ptr' and add the
+ * null-termination.
+ */
+void *
+bkh_str_prefixed_read(void *key_sequence, void *str_ptr){
+    uint16_t str_len;
+
+    memcpy(&str_len, key_sequence, STR_LEN_SIZE);
+    memcpy(str_ptr, key_sequence + STR_LEN_SIZE, str_len);
+    ((char *) str_ptr)[str_len] = '\0';
+
+    return key_sequence + STR_LEN_SIZE + str_len;
+}
+
+/*
+ * Write one key of 'metadata' from 'value' and return the position of the
+ * next key.
+ *
+ * Unlike the key writer alone, skip the unused space of BPT_NATIVE
+ * strings and pad BPT_FIXED_WIDTH strings with zeros up to 'key_size'.
+ */
+void *
+bkh_write_key(bpt_key *metadata, void *key_sequence, void *value){
+    void *written = metadata->key_writer(key_sequence, value);
+
+    if (metadata->type != BPT_STRING)
+	return written;
+
+    if (metadata->encoding == BPT_FIXED_WIDTH)
+	memset(written, 0, key_sequence + metadata->key_size - written);
+    if (metadata->encoding == BPT_NATIVE ||
+	metadata->encoding == BPT_FIXED_WIDTH)
+	return key_sequence + metadata->key_size;
+
+    return written;
+}
+
+/*
+ * Read one key of 'metadata' to 'value' and return the position of the
+ * next key.
+ */
+void *
+bkh_read_key(bpt_key *metadata, void *key_sequence, void *value){
+    void *read = metadata->key_reader(key_sequence, value);
+
+    if (metadata->type == BPT_STRING &&
+	(metadata->encoding == BPT_NATIVE ||
+	 metadata->encoding == BPT_FIXED_WIDTH))
+	return key_sequence + metadata->key_size;
+
+    return read;
+}
+
+/*
+ * Return true if all the keys of 'store' are BPT_ORDERED or
+ * BPT_FIXED_WIDTH, which are compared by memcmp() together.
+ */
+bool
+bkh_is_ordered_store(composite_key_store *store){
+    uintptr_t i;
+
+    if (store == NULL || store->keys_num == 0)
+	return false;
+
+    for (i = 0; i < store->keys_num; i++)
+	if (store->keys_metadata[i]->encoding != BPT_ORDERED &&
+	    store->keys_metadata[i]->encoding != BPT_FIXED_WIDTH)
+	    return false;
+
+    return true;
+}
+
+/*
+ * Comparison callback of bpt_init() for the composite keys that consist
+ * of BPT_ORDERED keys. Pass the composite_key_store as 'store'.
+ *
+ * The keys must be sequences of 'full_key_size' bytes whose unused space
+ * after the last key is zero-filled, for example allocated by calloc().
+ */
+int
+bkh_ordered_key_compare(void *key1, void *key2, void *store){
+    int ret = memcmp(key1, key2,
+		     ((composite_key_store *) store)->full_key_size);
+
+    return ret < 0 ? -1 : (ret == 0 ? 0 : 1);
+}
+
+/*
+ * Key abbreviation for the composite keys of bkh_ordered_key_compare().
+ *
+ * Return eight bytes of the sequence from 'offset' as a big-endian
+ * integer, which is ordered as the memcmp() of the whole sequences with
+ * the same first 'offset' bytes, except for the ties. The bytes beyond
+ * the sequence are read as zeros.
+ */
+uint64_t
+bkh_ordered_key_abbrev(void *key, uintptr_t offset, void *store){
+    uintptr_t i, size = ((composite_key_store *) store)->full_key_size;
+    uint8_t *bytes = key;
+    uint64_t prefix = 0;
+
+    for (i = offset; i < offset + sizeof(uint64_t); i++)
+	prefix = (prefix << 8) | (i < size ? bytes[i] : 0);
+
+    return prefix;
+}
+
+/*
+ * Return the number of the same leading bytes of two composite keys of
+ * bkh_ordered_key_compare().
+ */
+uintptr_t
+bkh_ordered_key_prefix(void *key1, void *key2, void *store){
+    uintptr_t i, size = ((composite_key_store *) store)->full_key_size;
+    uint8_t *bytes1 = key1, *bytes2 = key2;
+
+    for (i = 0; i < size && bytes1[i] == bytes2[i]; i++)
+	;
+
+    return i;
+}
+
+/*
+ * Separator callback for the composite keys of bkh_ordered_key_compare().
+ * Free the separators by bkh_free().
+ *
+ * Return the bytes of 'right' up to the first byte different from 'left',
+ * followed by zeros. This is the shortest sequence bigger than 'left' and
+ * not bigger than 'right'. Return NULL if it's 'right' itself.
+ */
+void *
+bkh_ordered_key_separator(void *left, void *right, void *store){
+    uintptr_t size = ((composite_key_store *) store)->full_key_size,
+	prefix = bkh_ordered_key_prefix(left, right, store);
+    void *separator;
+
+    if (prefix + 1 >= size)
+	return NULL;
+
+    separator = bkh_malloc(size);
+    memcpy(separator, right, prefix + 1);
+    memset((char *) separator + prefix + 1, 0, size - prefix - 1);
+
+    return separator;
+}
+
+/*
+ * Built-in comparison of composite keys.
+ *
+ * bkh_prepare_compare() translates the keys of a store into a fixed
+ * sequence of typed steps once, so that the comparison neither switches
+ * on the key types nor calls the key readers. Adjacent BPT_ORDERED keys
+ * of fixed size share one memcmp() step.
+ */
+static int
+bkh_int_step(void *key1, void *key2, uintptr_t size){
+    int i1, i2;
+
+    /* The native keys after a string can be unaligned */
+    memcpy(&i1, key1, INT_SIZE);
+    memcpy(&i2, key2, INT_SIZE);
+
+    return i1 < i2 ? -1 : (i1 == i2 ? 0 : 1);
+}
+
+static int
+bkh_double_step(void *key1, void *key2, uintptr_t size){
+    double d1, d2;
+
+    memcpy(&d1, key1, DOUBLE_SIZE);
+    memcpy(&d2, key2, DOUBLE_SIZE);
+
+    return d1 < d2 ? -1 : (d1 == d2 ? 0 : 1);
+}
+
+static int
+bkh_bool_step(void *key1, void *key2, uintptr_t size){
+    bool b1 = *((bool *) key1), b2 = *((bool *) key2);
+
+    return b1 < b2 ? -1 : (b1 == b2 ? 0 : 1);
+}
+
+/*
+ * Native strings end with the null-termination within 'size' bytes.
+ */
+static int
+bkh_str_step(void *key1, void *key2, uintptr_t size){
+    int ret = strncmp((char *) key1, (char *) key2, size);
+
+    return ret < 0 ? -1 : (ret == 0 ? 0 : 1);
+}
+
+/*
+ * Ordered strings. Same as memcmp() up to the null-termination.
+ */
+static int
+bkh_ordered_str_step(void *key1, void *key2, uintptr_t size){
+    int ret = strcmp((char *) key1, (char *) key2);
+
+    return ret < 0 ? -1 : (ret == 0 ? 0 : 1);
+}
+
+/*
+ * Length-prefixed strings. The shorter string comes first when it's the
+ * prefix of the other.
+ */
+static int
+bkh_prefixed_str_step(void *key1, void *key2, uintptr_t size){
+    uint16_t len1, len2;
+    int ret;
+
+    memcpy(&len1, key1, STR_LEN_SIZE);
+    memcpy(&len2, key2, STR_LEN_SIZE);
+    if ((ret = memcmp(key1 + STR_LEN_SIZE, key2 + STR_LEN_SIZE,
+		      len1 < len2 ? len1 : len2)) != 0)
+	return ret < 0 ? -1 : 1;
+
+    return len1 < len2 ? -1 : (len1 == len2 ? 0 : 1);
+}
+
+static int
+bkh_memcmp_step(void *key1, void *key2, uintptr_t size){
+    int ret = memcmp(key1, key2, size);
+
+    return ret < 0 ? -1 : (ret == 0 ? 0 : 1);
+}
+
+static uintptr_t
+bkh_ordered_str_length(void *key){
+    return strlen((char *) key) + 1;
+}
+
+static uintptr_t
+bkh_prefixed_str_length(void *key){
+    uint16_t str_len;
+
+    memcpy(&str_len, key, STR_LEN_SIZE);
+
+    return STR_LEN_SIZE + str_len;
+}
+
+/*
+ * Return the callback to measure one key of 'metadata' in the sequence,
+ * or NULL if the key has the fixed size.
+ */
+static bkh_key_length_cb
+bkh_ref_key_length(bpt_key *metadata){
+    if (metadata->type != BPT_STRING)
+	return NULL;
+
+    switch(metadata->encoding){
+	case BPT_ORDERED:
+	    return bkh_ordered_str_length;
+	case BPT_LENGTH_PREFIXED:
+	    return bkh_prefixed_str_length;
+	default:
+	    return NULL;
+    }
+}
+
+/*
+ * Return the step to compare one key of 'metadata'.
+ */
+static bkh_compare_step_cb
+bkh_ref_compare_step(bpt_key *metadata){
+    if (metadata->type == BPT_STRING &&
+	metadata->encoding == BPT_ORDERED)
+	return bkh_ordered_str_step;
+    else if (metadata->encoding == BPT_LENGTH_PREFIXED)
+	return bkh_prefixed_str_step;
+    else if (metadata->encoding == BPT_ORDERED ||
+	     metadata->encoding == BPT_FIXED_WIDTH)
+	return bkh_memcmp_step;
+
+    switch(metadata->type){
+	case BPT_INT:
+	    return bkh_int_step;
+	case BPT_DOUBLE:
+	    return bkh_double_step;
+	case BPT_BOOLEAN:
+	    return bkh_bool_step;
+	case BPT_STRING:
+	    return bkh_str_step;
+	default:
+	    assert(0);
+	    return NULL;
+    }
+}
+
+/*
+ * Set up the steps of bkh_composite_key_compare() for 'store' created by
+ * bpt_create_key_store(). Called by bpt_init() when no comparison
+ * callback is given.
+ */
+bool
+bkh_prepare_compare(composite_key_store *store){
+    bkh_compare_step *steps, *step = NULL;
+    bpt_key *metadata;
+    uintptr_t i, steps_num = 0;
+    bool all_ordered;
+
+    if (store == NULL || store->keys_num == 0){
+	fprintf(stderr, "detected empty keys for composite key\n");
+	return false;
+    }
+
+    steps = bkh_malloc(sizeof(bkh_compare_step) * store->keys_num);
+
+    /* Fast path. Compare the whole sequences by one memcmp() */
+    if ((all_ordered = bkh_is_ordered_store(store)) == true){
+	steps[0].compare = bkh_memcmp_step;
+	steps[0].size = store->full_key_size;
+	steps[0].key_length = NULL;
+	steps_num = 1;
+    }
+
+    for (i = 0; i < store->keys_num && !all_ordered; i++){
+	metadata = store->keys_metadata[i];
+
+	/* Extend the memcmp() of the previous ordered keys */
+	if (bkh_ref_compare_step(metadata) == bkh_memcmp_step &&
+	    step != NULL && step->compare == bkh_memcmp_step){
+	    step->size += metadata->key_size;
+	    continue;
+	}
+
+	step = &steps[steps_num++];
+	step->compare = bkh_ref_compare_step(metadata);
+	step->size = metadata->key_size;
+	step->key_length = bkh_ref_key_length(metadata);
+    }
+
+    bkh_free(store->compare_steps);
+    store->compare_steps = steps;
+    store->compare_steps_num = steps_num;
+
+    return true;
+}
+
+/*
+ * Comparison callback of bpt_init() for the composite keys of 'store'
+ * prepared by bkh_prepare_compare().
+ */
+int
+bkh_composite_key_compare(void *key1, void *key2, void *store){
+    composite_key_store *cks = (composite_key_store *) store;
+    bkh_compare_step *step = cks->compare_steps,
+	*end = step + cks->compare_steps_num;
+    uintptr_t size;
+    int ret;
+
+    for (; step < end; step++){
+	if ((ret = step->compare(key1, key2, step->size)) != 0)
+	    return ret;
+	size = step->key_length != NULL ? step->key_length(key1) : step->size;
+	key1 += size;
+	key2 += size;
+    }
+
+    return 0;
+}
+
+/*
+ * Return the pointer to the 'idx'-th key in the composite 'key' without
+ * copying it.
+ *
+ * The keys that don't follow a variable-size string are located in O(1)
+ * by their fixed offsets. The others need the lengths of the strings
+ * before them, not the readers of all the preceding keys.
+ */
+void *
+bkh_field_ref(composite_key_store *store, void *key, uintptr_t idx){
+    bkh_field_position *pos = &store->field_positions[idx];
+
+    if (pos->anchor >= 0){
+	key = bkh_field_ref(store, key, pos->anchor);
+	key += bkh_ref_key_length(store->keys_metadata[pos->anchor])(key);
+    }
+
+    return key + pos->offset;
+}
+
+/*
+ * Compare only the 'idx'-th key of two composite keys. Return -1, 0 or 1.
+ */
+int
+bkh_field_compare(composite_key_store *store, void *key1, void *key2,
+		  uintptr_t idx){
+    return store->field_positions[idx].compare(bkh_field_ref(store, key1, idx),
+					       bkh_field_ref(store, key2, idx),
+					       store->keys_metadata[idx]->key_size);
+}
+
 /*
  * Return dynamically allocated bpt_key * data for 'type'.
  *
@@ -158,7 +686,23 @@ bkh_str_read(void *key_sequence, void *str_ptr){
  */
 bpt_key *
 bpt_create_key_metadata(key_type type, int str_size){
+    return bpt_create_encoded_key_metadata(type, str_size, BPT_NATIVE);
+}
+
+/*
+ * Same as bpt_create_key_metadata(), but select the handlers for
+ * 'encoding'.
+ */
+bpt_key *
+bpt_create_encoded_key_metadata(key_type type, int str_size,
+				key_encoding encoding){
     bpt_key *key_metadata;
+    bool ordered = encoding == BPT_ORDERED;
+
+    if (encoding < BPT_NATIVE || BPT_FIXED_WIDTH < encoding){
+	fprintf(stderr, "detected invalid key encoding.\n");
+	return NULL;
+    }
 
     if (type < BPT_INT || BPT_BOOLEAN < type){
 	fprintf(stderr, "detected invalid key type.\n");
@@ -170,31 +714,57 @@ bpt_create_key_metadata(key_type type, int str_size){
 	return NULL;
     }
 
+    if (type != BPT_STRING &&
+	(encoding == BPT_LENGTH_PREFIXED || encoding == BPT_FIXED_WIDTH)){
+	fprintf(stderr, "detected string encoding for non-string type\n");
+	return NULL;
+    }
+
+    if (encoding == BPT_LENGTH_PREFIXED && str_size - 1 > UINT16_MAX){
+	fprintf(stderr, "detected too long length-prefixed string\n");
+	return NULL;
+    }
+
     key_metadata = bkh_malloc(sizeof(bpt_key));
+    key_metadata->encoding = encoding;
     switch(type){
 	case BPT_INT:
 	    key_metadata->type = BPT_INT;
 	    key_metadata->key_size = INT_SIZE;
-	    key_metadata->key_writer = bkh_int_write;
-	    key_metadata->key_reader = bkh_int_read;
+	    key_metadata->key_writer = ordered ?
+		bkh_int_ordered_write : bkh_int_write;
+	    key_metadata->key_reader = ordered ?
+		bkh_int_ordered_read : bkh_int_read;
 	    break;
 	case BPT_DOUBLE:
 	    key_metadata->type = BPT_DOUBLE;
 	    key_metadata->key_size = DOUBLE_SIZE;
-	    key_metadata->key_writer = bkh_double_write;
-	    key_metadata->key_reader = bkh_double_read;
+	    key_metadata->key_writer = ordered ?
+		bkh_double_ordered_write : bkh_double_write;
+	    key_metadata->key_reader = ordered ?
+		bkh_double_ordered_read : bkh_double_read;
 	    break;
 	case BPT_STRING:
 	    key_metadata->type = BPT_STRING;
 	    key_metadata->key_size = str_size;
-	    key_metadata->key_writer = bkh_str_write;
-	    key_metadata->key_reader = bkh_str_read;
+	    key_metadata->key_writer = ordered ?
+		bkh_str_ordered_write : bkh_str_write;
+	    key_metadata->key_reader = ordered ?
+		bkh_str_ordered_read : bkh_str_read;
+	    /* The padding of BPT_FIXED_WIDTH is done by bkh_write_key() */
+	    if (encoding == BPT_LENGTH_PREFIXED){
+		key_metadata->key_size = STR_LEN_SIZE + str_size - 1;
+		key_metadata->key_writer = bkh_str_prefixed_write;
+		key_metadata->key_reader = bkh_str_prefixed_read;
+	    }
 	    break;
 	case BPT_BOOLEAN:
 	    key_metadata->type = BPT_BOOLEAN;
 	    key_metadata->key_size = BOOLEAN_SIZE;
-	    key_metadata->key_writer = bkh_bool_write;
-	    key_metadata->key_reader = bkh_bool_read;
+	    key_metadata->key_writer = ordered ?
+		bkh_bool_ordered_write : bkh_bool_write;
+	    key_metadata->key_reader = ordered ?
+		bkh_bool_ordered_read : bkh_bool_read;
 	    break;
 	default:
 	    assert(0);
@@ -209,3 +779,70 @@ bpt_free_key_metadata(bpt_key *key_metadata){
     if (key_metadata != NULL)
 	free(key_metadata);
 }
+
+/*
+ * Return dynamically allocated composite_key_store * data of 'keys_num'
+ * keys in 'keys_metadata', whose 'full_key_size' is the sum of the key
+ * sizes.
+ *
+ * The store takes over the bpt_key * data, which are freed by
+ * bpt_free_key_store().
+ */
+composite_key_store *
+bpt_create_key_store(bpt_key **keys_metadata, uintptr_t keys_num){
+    composite_key_store *store;
+    uintptr_t i, offset = 0;
+    intptr_t anchor = -1;
+
+    if (keys_metadata == NULL || keys_num == 0){
+	fprintf(stderr, "detected empty keys for composite key\n");
+	return NULL;
+    }
+
+    for (i = 0; i < keys_num; i++){
+	if (keys_metadata[i] == NULL){
+	    fprintf(stderr, "detected NULL key metadata at %lu\n", i);
+	    return NULL;
+	}
+    }
+
+    store = bkh_malloc(sizeof(composite_key_store));
+    store->keys_metadata = bkh_malloc(sizeof(bpt_key *) * keys_num);
+    store->keys_num = keys_num;
+    store->field_positions = bkh_malloc(sizeof(bkh_field_position) * keys_num);
+    store->compare_steps = NULL;
+    store->compare_steps_num = 0;
+    store->full_key_size = 0;
+    for (i = 0; i < keys_num; i++){
+	store->keys_metadata[i] = keys_metadata[i];
+	store->field_positions[i].anchor = anchor;
+	store->field_positions[i].offset = offset;
+	store->field_positions[i].compare =
+	    bkh_ref_compare_step(keys_metadata[i]);
+	store->full_key_size += keys_metadata[i]->key_size;
+
+	/* The next key starts right after this string */
+	if (bkh_ref_key_length(keys_metadata[i]) != NULL){
+	    anchor = (intptr_t) i;
+	    offset = 0;
+	}else
+	    offset += keys_metadata[i]->key_size;
+    }
+
+    return store;
+}
+
+void
+bpt_free_key_store(composite_key_store *store){
+    uintptr_t i;
+
+    if (store == NULL)
+	return;
+
+    for (i = 0; i < store->keys_num; i++)
+	bpt_free_key_metadata(store->keys_metadata[i]);
+    free(store->keys_metadata);
+    free(store->field_positions);
+    bkh_free(store->compare_steps);
+    free(store);
+}
@@ -1,6 +1,7 @@
 #ifndef __BPT_KEY_HANDLER__
 #define __BPT_KEY_HANDLER__
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /*
@@ -13,6 +14,38 @@ typedef enum key_type {
     BPT_BOOLEAN,
 } key_type;
 
+/*
+ * Define how each key is laid out in the key sequence.
+ *
+ * BPT_NATIVE writes the in-memory representation, so the application
+ * must read each field back to compare keys. Strings occupy their whole
+ * 'key_size' in the sequence.
+ *
+ * BPT_ORDERED writes a byte form whose unsigned byte order is the order
+ * of the values : big-endian integers with the sign bit flipped, doubles
+ * whose bits are flipped to sort as unsigned integers and null-terminated
+ * strings followed by the next key without the unused space. A composite
+ * key that consists only of BPT_ORDERED keys is compared by one memcmp()
+ * of its sequence. See bkh_ordered_key_compare().
+ *
+ * The other two are only for strings.
+ *
+ * BPT_LENGTH_PREFIXED writes the length in STR_LEN_SIZE bytes and the
+ * string without the null-termination, followed by the next key. The
+ * strings are copied by memcpy() and compared by memcmp() of the shorter
+ * length and then by the lengths.
+ *
+ * BPT_FIXED_WIDTH writes the string padded with zeros up to 'key_size'
+ * by bkh_write_key(). It is compared by memcmp() of 'key_size' and can
+ * be mixed with BPT_ORDERED keys in a memcmp() comparable composite key.
+ */
+typedef enum key_encoding {
+    BPT_NATIVE,
+    BPT_ORDERED,
+    BPT_LENGTH_PREFIXED,
+    BPT_FIXED_WIDTH,
+} key_encoding;
+
 /*
  * Define key sizes of fixed-size variables.
  *
@@ -22,6 +55,9 @@ typedef enum key_type {
 #define DOUBLE_SIZE (sizeof(double))
 #define BOOLEAN_SIZE (sizeof(bool))
 
+/* Length of BPT_LENGTH_PREFIXED strings */
+#define STR_LEN_SIZE (sizeof(uint16_t))
+
 /*
  * Define one key for each key type.
  */
@@ -30,8 +66,13 @@ typedef struct bpt_key {
     /* Key data type */
     key_type type;
 
+    key_encoding encoding;
+
     /*
-     * Fixed size except for STRING type.
+     * Fixed size except for STRING type. For STRING type, the maximum
+     * size in the sequence. It's the string size including the
+     * null-termination, or the maximum length plus STR_LEN_SIZE for
+     * BPT_LENGTH_PREFIXED.
      */
     uintptr_t key_size;
 
@@ -44,6 +85,55 @@ typedef struct bpt_key {
 
 } bpt_key;
 
+/*
+ * Compare 'size' bytes of one key in two sequences. Return -1, 0 or 1.
+ */
+typedef int (*bkh_compare_step_cb)(void *key1, void *key2, uintptr_t size);
+
+/*
+ * Return the bytes of one variable-size key in the sequence.
+ */
+typedef uintptr_t (*bkh_key_length_cb)(void *key);
+
+/*
+ * One step of the built-in comparison of composite keys.
+ *
+ * 'compare' compares the keys at the current positions. When the keys
+ * are equal, the next step starts 'size' bytes later, or 'key_length'
+ * bytes later for a variable-size key.
+ */
+typedef struct bkh_compare_step {
+
+    bkh_compare_step_cb compare;
+
+    uintptr_t size;
+
+    /* NULL for the fixed-size keys */
+    bkh_key_length_cb key_length;
+
+} bkh_compare_step;
+
+/*
+ * Position of one key in the composite key sequence.
+ *
+ * Every key has a fixed offset except for the keys that follow a
+ * variable-size key, which is a BPT_ORDERED or BPT_LENGTH_PREFIXED
+ * string. Such keys are
+ * located at 'offset' bytes after the end of the 'anchor'-th key, the
+ * last variable-size key before them. 'anchor' is -1 for the keys with
+ * fixed offsets from the head of the sequence.
+ */
+typedef struct bkh_field_position {
+
+    intptr_t anchor;
+
+    uintptr_t offset;
+
+    /* Compare this key of two sequences. See bkh_field_compare() */
+    bkh_compare_step_cb compare;
+
+} bkh_field_position;
+
 /*
  * Build one unique key from multiple keys.
  *
@@ -61,6 +151,23 @@ typedef struct composite_key_store {
      */
     bpt_key **keys_metadata;
 
+    /*
+     * Number of keys in 'keys_metadata'. Set by bpt_create_key_store()
+     */
+    uintptr_t keys_num;
+
+    /*
+     * Position of each key in 'keys_metadata'. Set by
+     * bpt_create_key_store()
+     */
+    bkh_field_position *field_positions;
+
+    /*
+     * Steps of the built-in comparison. Set up by bkh_prepare_compare()
+     */
+    bkh_compare_step *compare_steps;
+    uintptr_t compare_steps_num;
+
 } composite_key_store;
 
 void *bkh_malloc(size_t size);
@@ -75,7 +182,38 @@ void *bkh_bool_read(void *key_sequence, void *bool_ptr);
 void *bkh_str_write(void *key_sequence, void *str_ptr);
 void *bkh_str_read(void *key_sequence, void *str_ptr);
 
+void *bkh_int_ordered_write(void *key_sequence, void *int_ptr);
+void *bkh_int_ordered_read(void *key_sequence, void *int_ptr);
+void *bkh_double_ordered_write(void *key_sequence, void *double_ptr);
+void *bkh_double_ordered_read(void *key_sequence, void *double_ptr);
+void *bkh_bool_ordered_write(void *key_sequence, void *bool_ptr);
+void *bkh_bool_ordered_read(void *key_sequence, void *bool_ptr);
+void *bkh_str_ordered_write(void *key_sequence, void *str_ptr);
+void *bkh_str_ordered_read(void *key_sequence, void *str_ptr);
+void *bkh_str_prefixed_write(void *key_sequence, void *str_ptr);
+void *bkh_str_prefixed_read(void *key_sequence, void *str_ptr);
+
+void *bkh_write_key(bpt_key *metadata, void *key_sequence, void *value);
+void *bkh_read_key(bpt_key *metadata, void *key_sequence, void *value);
+
+bool bkh_is_ordered_store(composite_key_store *store);
+int bkh_ordered_key_compare(void *key1, void *key2, void *store);
+uint64_t bkh_ordered_key_abbrev(void *key, uintptr_t offset, void *store);
+uintptr_t bkh_ordered_key_prefix(void *key1, void *key2, void *store);
+void *bkh_ordered_key_separator(void *left, void *right, void *store);
+bool bkh_prepare_compare(composite_key_store *store);
+int bkh_composite_key_compare(void *key1, void *key2, void *store);
+void *bkh_field_ref(composite_key_store *store, void *key, uintptr_t idx);
+int bkh_field_compare(composite_key_store *store, void *key1, void *key2,
+		      uintptr_t idx);
+
 bpt_key *bpt_create_key_metadata(key_type type, int str_size);
+bpt_key *bpt_create_encoded_key_metadata(key_type type, int str_size,
+					 key_encoding encoding);
 void bpt_free_key_metadata(bpt_key *key_metadata);
 
+composite_key_store *bpt_create_key_store(bpt_key **keys_metadata,
+					  uintptr_t keys_num);
+void bpt_free_key_store(composite_key_store *store);
+
 #endif
@@ -73,6 +73,270 @@ records_bpt_test(){
     bpt_destroy(tree);
 }
 
+/*
+ * Keep the student records inline in the leaves. Every record must be
+ * the copy at its key's position in the leaf.
+ */
+static void
+inline_records_test(uint16_t max_keys){
+    bpt_tree *tree, *right;
+    bpt_tree_stats stats;
+    bpt_node *leaf;
+    student new_std, *std;
+    uintptr_t i, line, records_num = 700;
+    void *page;
+    int index;
+
+    tree = bpt_init(student_key_compare,
+		    student_key_free,
+		    student_record_free,
+		    max_keys, NULL);
+    assert(bpt_set_record_size(tree, sizeof(student)) == true);
+
+    /* Insert the copies of one struct in a scattered order */
+    for (i = 1; i <= records_num; i++){
+	memset(&new_std, 0, sizeof(student));
+	new_std.student_no = i * 31 % (records_num + 1);
+	new_std.class_id = new_std.student_no % 5;
+	snprintf(new_std.name, NAME_LEN, "std-%d", new_std.student_no);
+	assert(bpt_insert(tree, (void *)(uintptr_t) new_std.student_no,
+			  &new_std) == true);
+    }
+    assert(bpt_set_record_size(tree, sizeof(student)) == false);
+
+    for (i = 1; i <= records_num; i++){
+	assert(bpt_search(tree, (void *) i, &leaf, (void **) &std) == true);
+	assert(std->student_no == i && std->class_id == i % 5);
+	page = leaf->page;
+	index = ((char *) std - (char *) page) / sizeof(student);
+	assert((char *) page + index * sizeof(student) == (char *) std);
+	assert((uintptr_t) ll_ref_index_data(leaf->keys, index) == i);
+    }
+
+    /* A record in the middle of a roomy leaf is deleted in place */
+    for (leaf = tree->root; !leaf->is_leaf;
+	 leaf = ll_ref_index_data(leaf->children, 0))
+	;
+    while(ll_get_length(leaf->keys) < max_keys / 2 + 2)
+	leaf = leaf->next;
+    page = leaf->page;
+    i = (uintptr_t) ll_ref_index_data(leaf->keys, 1);
+    assert(bpt_delete(tree, (void *) i, (void **) &std) == true);
+    assert(std->student_no == i && leaf->page == page);
+    new_std = *std;
+    assert(bpt_insert(tree, (void *) i, &new_std) == true);
+    assert(leaf->page == page);
+
+    /* The deleted record is readable until the next update */
+    for (i = 2; i <= records_num; i += 2){
+	assert(bpt_delete(tree, (void *) i, (void **) &std) == true);
+	assert(std->student_no == i);
+    }
+
+    assert(bpt_split_at(tree, (void *) (records_num / 3), &right) == true);
+    assert(bpt_search(right, (void *) (records_num - 1), NULL,
+		      (void **) &std) == true);
+    assert(std->student_no == records_num - 1);
+    assert(bpt_concat(tree, right) == true);
+
+    for (i = 1; i <= records_num; i++){
+	if (i % 2 == 0){
+	    assert(bpt_search(tree, (void *) i, NULL, NULL) == false);
+	    continue;
+	}
+	assert(bpt_search(tree, (void *) i, &leaf, (void **) &std) == true);
+	assert(std->student_no == i);
+	assert((char *) std >= (char *) leaf->page &&
+	       (char *) std < (char *) leaf->page + tree->page_size);
+    }
+
+    /* The pages are counted as allocated, in whole cache lines */
+    line = BPT_CACHE_LINE_SIZE;
+    assert(bpt_stats(tree, &stats) == true);
+    assert(stats.node_bytes == stats.nodes * sizeof(bpt_node) +
+	   stats.leaf_nodes * ((tree->page_size + line - 1) / line * line));
+
+    bpt_destroy(tree);
+}
+
+/*
+ * Turn the inline records on and off again on an empty tree. The records
+ * must be stored by their pointers as before.
+ */
+static void
+inline_records_off_test(void){
+    bpt_tree *tree;
+    student *std, *std_ary;
+    uintptr_t i, records_num = 100;
+
+    tree = bpt_init(student_key_compare,
+		    student_key_free,
+		    student_record_free,
+		    4, NULL);
+    assert(bpt_set_record_size(tree, sizeof(student)) == true);
+    assert(bpt_set_record_size(tree, 0) == true);
+    assert(tree->page_size == 0 && tree->record_size == 0);
+
+    std_ary = (student *) malloc(sizeof(student) * (records_num + 1));
+
+    for (i = 1; i <= records_num; i++){
+	std_ary[i].student_no = i;
+	assert(bpt_insert(tree, (void *) i, &std_ary[i]) == true);
+    }
+
+    for (i = 1; i <= records_num; i++){
+	assert(bpt_search(tree, (void *) i, NULL, (void **) &std) == true);
+	assert(std == &std_ary[i]);
+    }
+
+    for (i = 1; i <= records_num; i++){
+	assert(bpt_delete(tree, (void *) i, (void **) &std) == true);
+	assert(std == &std_ary[i]);
+    }
+
+    free(std_ary);
+
+    bpt_destroy(tree);
+}
+
+/*
+ * Write the composite key of (class_id, name, student_no) for 'std'.
+ */
+static void *
+student_composite_key(composite_key_store *store, student *std){
+    void *key = calloc(1, store->full_key_size), *field = key;
+    void *values[] = { &std->class_id, std->name, &std->student_no };
+    int i;
+
+    for (i = 0; i < 3; i++)
+	field = bkh_write_key(store->keys_metadata[i], field, values[i]);
+
+    return key;
+}
+
+static int
+student_order(student *s1, student *s2){
+    int ret;
+
+    if (s1->class_id != s2->class_id)
+	return s1->class_id < s2->class_id ? -1 : 1;
+    if ((ret = strcmp(s1->name, s2->name)) != 0)
+	return ret < 0 ? -1 : 1;
+    if (s1->student_no != s2->student_no)
+	return s1->student_no < s2->student_no ? -1 : 1;
+
+    return 0;
+}
+
+/*
+ * Let the tree compare the composite keys by the built-in comparison,
+ * without any application callback.
+ */
+static void
+builtin_compare_test(key_encoding int_encoding, key_encoding str_encoding){
+    composite_key_store *store;
+    bpt_key *metadata[3];
+    bpt_tree *tree;
+    bpt_node *leaf;
+    student *std_ary, *std, *prev = NULL;
+    void **keys;
+    int i, records_num = 512, walked = 0;
+
+    metadata[0] = bpt_create_encoded_key_metadata(BPT_INT, 0, int_encoding);
+    metadata[1] = bpt_create_encoded_key_metadata(BPT_STRING, NAME_LEN,
+						  str_encoding);
+    metadata[2] = bpt_create_encoded_key_metadata(BPT_INT, 0, int_encoding);
+    store = bpt_create_key_store(metadata, 3);
+
+    /* No comparison callback is invalid without the composite key */
+    assert(bpt_init(NULL, student_key_free, student_record_free,
+		    4, NULL) == NULL);
+
+    tree = bpt_init(NULL, student_key_free, student_record_free,
+		    4, store);
+    assert(tree != NULL);
+
+    /* Only the memcmp() comparable keys are abbreviated */
+    assert((tree->key_abbrev != NULL) == bkh_is_ordered_store(store));
+
+    /* Let them push up the shortest separators as well */
+    if (bkh_is_ordered_store(store))
+	assert(bpt_set_key_separator(tree, bkh_ordered_key_separator,
+				     bkh_free) == true);
+
+    std_ary = (student *) malloc(sizeof(student) * records_num);
+    keys = (void **) malloc(sizeof(void *) * records_num);
+
+    /* Duplicate class_id and name so that all the keys get compared */
+    for (i = 0; i < records_num; i++){
+	std_ary[i].class_id = (i * 7) % 4 - 2;
+	std_ary[i].student_no = records_num - i;
+	snprintf(std_ary[i].name, NAME_LEN, "st%d", (i * 13) % 17);
+	keys[i] = student_composite_key(store, &std_ary[i]);
+	assert(bpt_insert(tree, keys[i], &std_ary[i]) == true);
+    }
+
+    for (i = 0; i < records_num; i++){
+	assert(bpt_search(tree, keys[i], NULL, (void **) &std) == true);
+	assert(std == &std_ary[i]);
+    }
+    assert((tree->separators != NULL) == bkh_is_ordered_store(store));
+
+    /* The leaves must follow the order of the students */
+    for (leaf = tree->root; !leaf->is_leaf;
+	 leaf = ll_ref_index_data(leaf->children, 0))
+	;
+
+    /*
+     * Most leaves have one class_id and the names sharing "st". The
+     * abbreviations skip such common prefixes
+     */
+    if (tree->key_abbrev != NULL)
+	assert(leaf->abbrevs != NULL && leaf->abbrevs->offset > INT_SIZE &&
+	       leaf->abbrevs->prefixes == (uint64_t *) (leaf->abbrevs + 1));
+
+    for (; leaf != NULL; leaf = leaf->next){
+	for (i = 0; i < ll_get_length(leaf->children); i++){
+	    std = ll_ref_index_data(leaf->children, i);
+	    if (prev != NULL)
+		assert(student_order(prev, std) == -1);
+	    prev = std;
+	    walked++;
+	}
+    }
+    assert(walked == records_num);
+
+    /*
+     * Replace the half of the keys. The new keys can be allocated at the
+     * addresses of the freed ones, whose abbreviations must not be used
+     */
+    for (i = 0; i < records_num; i += 2){
+	assert(bpt_delete(tree, keys[i], NULL) == true);
+	free(keys[i]);
+	std_ary[i].student_no += records_num;
+	keys[i] = student_composite_key(store, &std_ary[i]);
+	assert(bpt_insert(tree, keys[i], &std_ary[i]) == true);
+    }
+
+    for (i = 0; i < records_num; i++){
+	assert(bpt_search(tree, keys[i], NULL, (void **) &std) == true);
+	assert(std == &std_ary[i]);
+    }
+
+    for (i = 0; i < records_num; i++){
+	assert(bpt_delete(tree, keys[i], (void **) &std) == true);
+	assert(std == &std_ary[i]);
+    }
+
+    bpt_destroy(tree);
+
+    for (i = 0; i < records_num; i++)
+	free(keys[i]);
+    free(keys);
+    free(std_ary);
+    bpt_free_key_store(store);
+}
+
 int
 main(int argc, char **argv){
 
@@ -80,6 +344,19 @@ main(int argc, char **argv){
 
     records_bpt_test();
 
+    printf("Perform the tests for records stored inline in leaves...\n");
+
+    inline_records_test(3);
+    inline_records_test(16);
+    inline_records_off_test();
+
+    printf("Perform the tests for the built-in comparison of composite keys...\n");
+
+    builtin_compare_test(BPT_NATIVE, BPT_NATIVE);
+    builtin_compare_test(BPT_ORDERED, BPT_ORDERED);
+    builtin_compare_test(BPT_NATIVE, BPT_LENGTH_PREFIXED);
+    builtin_compare_test(BPT_ORDERED, BPT_FIXED_WIDTH);
+
     printf("All tests are done gracefully\n");
 
     return 0;
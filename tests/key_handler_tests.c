@@ -1,4 +1,7 @@
 #include <assert.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -171,6 +174,355 @@ test_combinatition_keys_handlers_v2(){
     free(cks);
 }
 
+/*
+ * Check that the ordered handlers read back the written values and that
+ * memcmp() of the written bytes follows the order of the values.
+ */
+static void
+test_ordered_handlers(void){
+    int ints[] = { INT_MIN, -100, -1, 0, 1, 100, INT_MAX }, iread;
+    double doubles[] = { -INFINITY, -1e300, -1.5, -DBL_MIN, 0.0,
+			 DBL_MIN, 1.5, 1e300, INFINITY }, dread;
+    char *strs[] = { "", "a", "ab", "abc", "b" }, sread[8];
+    unsigned char prev[8], curr[8];
+    bool bools[] = { false, true }, bread;
+    double negative_zero = -0.0;
+    int i;
+
+    for (i = 0; i < sizeof(ints) / sizeof(ints[0]); i++){
+	assert(bkh_int_ordered_write(curr, &ints[i]) == curr + INT_SIZE);
+	assert(bkh_int_ordered_read(curr, &iread) == curr + INT_SIZE);
+	assert(iread == ints[i]);
+	if (i > 0)
+	    assert(memcmp(prev, curr, INT_SIZE) < 0);
+	memcpy(prev, curr, INT_SIZE);
+    }
+
+    for (i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++){
+	assert(bkh_double_ordered_write(curr, &doubles[i]) == curr + DOUBLE_SIZE);
+	assert(bkh_double_ordered_read(curr, &dread) == curr + DOUBLE_SIZE);
+	assert(dread == doubles[i]);
+	if (i > 0)
+	    assert(memcmp(prev, curr, DOUBLE_SIZE) < 0);
+	memcpy(prev, curr, DOUBLE_SIZE);
+    }
+
+    /* -0.0 is equal to 0.0 */
+    bkh_double_ordered_write(prev, &negative_zero);
+    bkh_double_ordered_write(curr, &doubles[4]);
+    assert(memcmp(prev, curr, DOUBLE_SIZE) == 0);
+
+    for (i = 0; i < sizeof(bools) / sizeof(bools[0]); i++){
+	assert(bkh_bool_ordered_write(curr, &bools[i]) == curr + 1);
+	assert(bkh_bool_ordered_read(curr, &bread) == curr + 1);
+	assert(bread == bools[i]);
+	if (i > 0)
+	    assert(memcmp(prev, curr, 1) < 0);
+	memcpy(prev, curr, 1);
+    }
+
+    for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++){
+	memset(curr, 0, sizeof(curr));
+	assert(bkh_str_ordered_write(curr, strs[i]) ==
+	       curr + strlen(strs[i]) + 1);
+	assert(bkh_str_ordered_read(curr, sread) ==
+	       curr + strlen(strs[i]) + 1);
+	assert(strcmp(sread, strs[i]) == 0);
+	if (i > 0)
+	    assert(memcmp(prev, curr, sizeof(curr)) < 0);
+	memcpy(prev, curr, sizeof(curr));
+    }
+}
+
+/*
+ * Compare composite keys of (string, int, double) by memcmp().
+ *
+ * The string is followed by the integer without the unused space, so the
+ * shorter string must still come first regardless of the integer.
+ */
+static void
+test_ordered_composite_keys(void){
+    composite_key_store *store;
+    bpt_key *metadata[3];
+    char *strs[] = { "ab", "ab", "ab", "abc", "b" };
+    int ints[] = { -5, 7, 7, INT_MIN, -1 };
+    double doubles[] = { 0.5, -2.0, 3.0, 0.0, 0.0 };
+    void *keys[5], *buf;
+    char sread[8];
+    uintptr_t offset;
+    int i, iread;
+    double dread;
+
+    metadata[0] = bpt_create_encoded_key_metadata(BPT_STRING, 8, BPT_ORDERED);
+    metadata[1] = bpt_create_encoded_key_metadata(BPT_INT, 0, BPT_ORDERED);
+    metadata[2] = bpt_create_encoded_key_metadata(BPT_DOUBLE, 0, BPT_ORDERED);
+    store = bpt_create_key_store(metadata, 3);
+    assert(store->full_key_size == 8 + INT_SIZE + DOUBLE_SIZE);
+    assert(bkh_is_ordered_store(store) == true);
+
+    for (i = 0; i < 5; i++){
+	keys[i] = calloc(1, store->full_key_size);
+	buf = store->keys_metadata[0]->key_writer(keys[i], strs[i]);
+	buf = store->keys_metadata[1]->key_writer(buf, &ints[i]);
+	buf = store->keys_metadata[2]->key_writer(buf, &doubles[i]);
+    }
+
+    for (i = 0; i < 5; i++){
+	assert(bkh_ordered_key_compare(keys[i], keys[i], store) == 0);
+	if (i > 0){
+	    assert(bkh_ordered_key_compare(keys[i - 1], keys[i], store) == -1);
+	    assert(bkh_ordered_key_compare(keys[i], keys[i - 1], store) == 1);
+
+	    /* The abbreviations from the first different byte are ordered */
+	    offset = bkh_ordered_key_prefix(keys[i - 1], keys[i], store);
+	    assert(offset < store->full_key_size);
+	    assert(bkh_ordered_key_abbrev(keys[i - 1], offset, store) <
+		   bkh_ordered_key_abbrev(keys[i], offset, store));
+
+	    /* The separator is between the two keys */
+	    if ((buf = bkh_ordered_key_separator(keys[i - 1], keys[i],
+						 store)) != NULL){
+		assert(bkh_ordered_key_compare(keys[i - 1], buf, store) == -1);
+		assert(bkh_ordered_key_compare(buf, keys[i], store) != 1);
+		bkh_free(buf);
+	    }
+	}
+	assert(bkh_ordered_key_prefix(keys[i], keys[i],
+				      store) == store->full_key_size);
+
+	buf = store->keys_metadata[0]->key_reader(keys[i], sread);
+	buf = store->keys_metadata[1]->key_reader(buf, &iread);
+	buf = store->keys_metadata[2]->key_reader(buf, &dread);
+	assert(strcmp(sread, strs[i]) == 0);
+	assert(iread == ints[i]);
+	assert(dread == doubles[i]);
+    }
+
+    for (i = 0; i < 5; i++)
+	free(keys[i]);
+    bpt_free_key_store(store);
+
+    /* A native key makes the store incomparable by memcmp() */
+    metadata[0] = bpt_create_encoded_key_metadata(BPT_INT, 0, BPT_ORDERED);
+    metadata[1] = bpt_create_key_metadata(BPT_INT, 0);
+    store = bpt_create_key_store(metadata, 2);
+    assert(metadata[1]->encoding == BPT_NATIVE);
+    assert(bkh_is_ordered_store(store) == false);
+    bpt_free_key_store(store);
+}
+
+/*
+ * Compare keys of mixed encodings by the built-in comparison. The two
+ * leading ordered integers share one memcmp() step.
+ */
+static void
+test_builtin_compare(void){
+    composite_key_store *store;
+    bpt_key *metadata[5];
+    int i1[] = { -1, -1, 0, 0, 0, 0 }, i2[] = { 5, 9, -3, -3, -3, -3 },
+	i3[] = { 0, 0, 0, 0, 0, 1 };
+    double d[] = { 0.0, 0.0, -1.5, 2.5, 2.5, 2.5 };
+    char *strs[] = { "z", "z", "z", "a", "b", "b" };
+    void *keys[6], *buf;
+    int i;
+
+    metadata[0] = bpt_create_encoded_key_metadata(BPT_INT, 0, BPT_ORDERED);
+    metadata[1] = bpt_create_encoded_key_metadata(BPT_INT, 0, BPT_ORDERED);
+    metadata[2] = bpt_create_key_metadata(BPT_DOUBLE, 0);
+    metadata[3] = bpt_create_encoded_key_metadata(BPT_STRING, 4, BPT_ORDERED);
+    metadata[4] = bpt_create_key_metadata(BPT_INT, 0);
+    store = bpt_create_key_store(metadata, 5);
+
+    assert(bkh_prepare_compare(store) == true);
+    assert(store->compare_steps_num == 4);
+    assert(store->compare_steps[0].size == INT_SIZE * 2);
+
+    for (i = 0; i < 6; i++){
+	keys[i] = calloc(1, store->full_key_size);
+	buf = metadata[0]->key_writer(keys[i], &i1[i]);
+	buf = metadata[1]->key_writer(buf, &i2[i]);
+	buf = metadata[2]->key_writer(buf, &d[i]);
+	buf = metadata[3]->key_writer(buf, strs[i]);
+	buf = metadata[4]->key_writer(buf, &i3[i]);
+    }
+
+    for (i = 0; i < 6; i++){
+	assert(bkh_composite_key_compare(keys[i], keys[i], store) == 0);
+	if (i > 0){
+	    assert(bkh_composite_key_compare(keys[i - 1], keys[i], store) == -1);
+	    assert(bkh_composite_key_compare(keys[i], keys[i - 1], store) == 1);
+	}
+    }
+
+    for (i = 0; i < 6; i++)
+	free(keys[i]);
+    bpt_free_key_store(store);
+}
+
+/*
+ * Access each key of composite keys directly by bkh_field_ref().
+ *
+ * The native layout of (string, bool, int) has fixed offsets only. The
+ * ordered layout of (int, string, double, string, int) places the keys
+ * after each string by its length.
+ */
+static void
+test_field_ref(void){
+    composite_key_store *store;
+    bpt_key *metadata[5];
+    void *key1, *key2, *buf;
+    char *str = "Hello";
+    bool bval = true;
+    int ival = -100, ival2 = 7;
+    double dval = 2.5;
+
+    metadata[0] = bpt_create_key_metadata(BPT_STRING, 20);
+    metadata[1] = bpt_create_key_metadata(BPT_BOOLEAN, 0);
+    metadata[2] = bpt_create_key_metadata(BPT_INT, 0);
+    store = bpt_create_key_store(metadata, 3);
+    assert(store->field_positions[2].anchor == -1);
+    assert(store->field_positions[2].offset == 20 + BOOLEAN_SIZE);
+
+    key1 = calloc(1, store->full_key_size);
+    metadata[0]->key_writer(key1, str);
+    metadata[1]->key_writer(key1 + 20, &bval);
+    metadata[2]->key_writer(key1 + 20 + BOOLEAN_SIZE, &ival);
+
+    assert(strcmp(bkh_field_ref(store, key1, 0), str) == 0);
+    assert(*((bool *) bkh_field_ref(store, key1, 1)) == bval);
+    assert(memcmp(bkh_field_ref(store, key1, 2), &ival, INT_SIZE) == 0);
+
+    free(key1);
+    bpt_free_key_store(store);
+
+    metadata[0] = bpt_create_encoded_key_metadata(BPT_INT, 0, BPT_ORDERED);
+    metadata[1] = bpt_create_encoded_key_metadata(BPT_STRING, 8, BPT_ORDERED);
+    metadata[2] = bpt_create_encoded_key_metadata(BPT_DOUBLE, 0, BPT_ORDERED);
+    metadata[3] = bpt_create_encoded_key_metadata(BPT_STRING, 8, BPT_ORDERED);
+    metadata[4] = bpt_create_encoded_key_metadata(BPT_INT, 0, BPT_ORDERED);
+    store = bpt_create_key_store(metadata, 5);
+    assert(store->field_positions[1].anchor == -1);
+    assert(store->field_positions[2].anchor == 1);
+    assert(store->field_positions[4].anchor == 3);
+
+    key1 = calloc(1, store->full_key_size);
+    key2 = calloc(1, store->full_key_size);
+    buf = metadata[0]->key_writer(key1, &ival);
+    buf = metadata[1]->key_writer(buf, str);
+    buf = metadata[2]->key_writer(buf, &dval);
+    buf = metadata[3]->key_writer(buf, "");
+    buf = metadata[4]->key_writer(buf, &ival);
+
+    buf = metadata[0]->key_writer(key2, &ival2);
+    buf = metadata[1]->key_writer(buf, "Hi");
+    buf = metadata[2]->key_writer(buf, &dval);
+    buf = metadata[3]->key_writer(buf, "abc");
+    buf = metadata[4]->key_writer(buf, &ival2);
+
+    assert(bkh_field_ref(store, key1, 0) == key1);
+    assert(bkh_field_ref(store, key1, 2) == key1 + INT_SIZE + strlen(str) + 1);
+    assert(bkh_field_ref(store, key1, 4) ==
+	   key1 + INT_SIZE + strlen(str) + 1 + DOUBLE_SIZE + 1);
+    assert(strcmp(bkh_field_ref(store, key2, 3), "abc") == 0);
+
+    assert(bkh_field_compare(store, key1, key2, 0) == -1);
+    assert(bkh_field_compare(store, key1, key2, 1) == -1);
+    assert(bkh_field_compare(store, key1, key2, 2) == 0);
+    assert(bkh_field_compare(store, key1, key2, 3) == -1);
+    assert(bkh_field_compare(store, key2, key1, 4) == 1);
+
+    free(key1);
+    free(key2);
+    bpt_free_key_store(store);
+}
+
+/*
+ * Write strings in the length-prefixed and the fixed-width encodings and
+ * compare them by the built-in comparison.
+ */
+static void
+test_string_encodings(void){
+    composite_key_store *store;
+    bpt_key *metadata[3];
+    char *strs[] = { "", "a", "ab", "abc", "b" }, sread[8];
+    int ints[] = { 3, 2, 1, 0, -1 }, iread;
+    void *keys[5], *buf;
+    int i;
+
+    /* Length-prefixed string followed by a native integer */
+    metadata[0] = bpt_create_encoded_key_metadata(BPT_STRING, 8,
+						  BPT_LENGTH_PREFIXED);
+    metadata[1] = bpt_create_key_metadata(BPT_INT, 0);
+    assert(metadata[0]->key_size == STR_LEN_SIZE + 7);
+    store = bpt_create_key_store(metadata, 2);
+    assert(bkh_prepare_compare(store) == true);
+    assert(store->field_positions[1].anchor == 0);
+
+    for (i = 0; i < 5; i++){
+	keys[i] = calloc(1, store->full_key_size);
+	buf = bkh_write_key(metadata[0], keys[i], strs[i]);
+	assert(buf == keys[i] + STR_LEN_SIZE + strlen(strs[i]));
+	buf = bkh_write_key(metadata[1], buf, &ints[i]);
+
+	buf = bkh_read_key(metadata[0], keys[i], sread);
+	buf = bkh_read_key(metadata[1], buf, &iread);
+	assert(strcmp(sread, strs[i]) == 0);
+	assert(iread == ints[i]);
+	assert(memcmp(bkh_field_ref(store, keys[i], 1), &ints[i], INT_SIZE) == 0);
+    }
+
+    for (i = 1; i < 5; i++){
+	assert(bkh_composite_key_compare(keys[i - 1], keys[i], store) == -1);
+	assert(bkh_composite_key_compare(keys[i], keys[i - 1], store) == 1);
+	assert(bkh_composite_key_compare(keys[i], keys[i], store) == 0);
+    }
+
+    for (i = 0; i < 5; i++)
+	free(keys[i]);
+    bpt_free_key_store(store);
+
+    /*
+     * Fixed-width string between ordered integers. All the keys share one
+     * memcmp(), even when the buffers aren't zero-filled.
+     */
+    metadata[0] = bpt_create_encoded_key_metadata(BPT_INT, 0, BPT_ORDERED);
+    metadata[1] = bpt_create_encoded_key_metadata(BPT_STRING, 4,
+						  BPT_FIXED_WIDTH);
+    metadata[2] = bpt_create_encoded_key_metadata(BPT_INT, 0, BPT_ORDERED);
+    store = bpt_create_key_store(metadata, 3);
+    assert(bkh_is_ordered_store(store) == true);
+    assert(bkh_prepare_compare(store) == true);
+    assert(store->compare_steps_num == 1);
+
+    for (i = 0; i < 5; i++){
+	keys[i] = malloc(store->full_key_size);
+	memset(keys[i], 0xff, store->full_key_size);
+	buf = bkh_write_key(metadata[0], keys[i], &ints[0]);
+	buf = bkh_write_key(metadata[1], buf, strs[i]);
+	assert(buf == keys[i] + INT_SIZE + 4);
+	buf = bkh_write_key(metadata[2], buf, &ints[i]);
+
+	buf = bkh_read_key(metadata[0], keys[i], &iread);
+	buf = bkh_read_key(metadata[1], buf, sread);
+	assert(strcmp(sread, strs[i]) == 0);
+    }
+
+    for (i = 1; i < 5; i++){
+	assert(bkh_composite_key_compare(keys[i - 1], keys[i], store) == -1);
+	assert(bkh_ordered_key_compare(keys[i - 1], keys[i], store) == -1);
+    }
+
+    for (i = 0; i < 5; i++)
+	free(keys[i]);
+    bpt_free_key_store(store);
+
+    /* The string encodings are invalid for the other types */
+    assert(bpt_create_encoded_key_metadata(BPT_INT, 0,
+					   BPT_FIXED_WIDTH) == NULL);
+    assert(bpt_create_encoded_key_metadata(BPT_DOUBLE, 0,
+					   BPT_LENGTH_PREFIXED) == NULL);
+}
+
 static void
 test_basic_key_handlers(void){
     printf("> Test integer handler\n");
@@ -193,6 +545,21 @@ test_advanced_key_handlers(void){
 
     printf("> Test keys combination (string & bool & integer)\n");
     test_combinatition_keys_handlers_v2();
+
+    printf("> Test order-preserving handlers\n");
+    test_ordered_handlers();
+
+    printf("> Test order-preserving composite keys\n");
+    test_ordered_composite_keys();
+
+    printf("> Test built-in comparison of composite keys\n");
+    test_builtin_compare();
+
+    printf("> Test direct access to each key of composite keys\n");
+    test_field_ref();
+
+    printf("> Test length-prefixed and fixed-width strings\n");
+    test_string_encodings();
 }
 
 int
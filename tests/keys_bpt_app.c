@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "../b_plus_tree.h"
 
@@ -16,12 +18,18 @@ typedef struct employee {
 
 /*
  * Compare two (originally) integer values. Ignore metadata.
+ *
+ * Count the calls for the tests of the features which save comparisons.
  */
+static uintptr_t compare_calls;
+
 static int
 employee_key_compare(void *key1, void *key2, void *metadata){
     uintptr_t k1 = (uintptr_t) key1,
         k2 = (uintptr_t) key2;
 
+    compare_calls++;
+
     if (k1 < k2){
         return -1;
     }else if (k1 == k2){
@@ -863,6 +871,994 @@ keys_test_more_data(uint16_t max_keys){
     bpt_destroy(tree);
 }
 
+static void
+remove_key_range_test(uint16_t max_keys){
+    bpt_tree *tree;
+    bpt_node *node;
+    uintptr_t i, max = 1024, answers[1024], reversed[1024], answers_num;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+
+    for (i = 1; i <= max; i++)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+
+    /* Inner range that frees whole subtrees */
+    assert(bpt_delete_range(tree, (void *) 10, (void *) 1000, false) == 991);
+
+    answers_num = 0;
+    for (i = 1; i < 10; i++)
+	answers[answers_num++] = i;
+    for (i = 1001; i <= max; i++)
+	answers[answers_num++] = i;
+
+    node = NULL;
+    assert(bpt_search(tree, (void *) 1, &node, NULL) == true);
+    full_keys_comparison_test(node, answers);
+    for (i = 0; i < answers_num; i++)
+	reversed[i] = answers[answers_num - 1 - i];
+    assert(bpt_search(tree, (void *) max, &node, NULL) == true);
+    reverse_full_keys_comparison_test(node, reversed);
+    app_loop_bpt_search(tree, answers_num, answers);
+
+    for (i = 10; i <= 1000; i++)
+	assert(bpt_search(tree, (void *) i, NULL, NULL) == false);
+
+    /* No key in the range */
+    assert(bpt_delete_range(tree, (void *) 10, (void *) 1000, false) == 0);
+
+    /* The rebalanced tree accepts normal insert and delete */
+    for (i = 10; i <= 1000; i++)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+    for (i = 500; i <= 600; i++)
+	assert(bpt_delete(tree, (void *) i, NULL) == true);
+
+    /* Delete everything */
+    assert(bpt_delete_range(tree, (void *) 1, (void *) max, false) == max - 101);
+    assert(ll_get_length(tree->root->keys) == 0);
+    assert(tree->root->is_leaf == true);
+    assert(tree->root->is_root == true);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+static void
+split_and_concat_test(uint16_t max_keys){
+    bpt_tree *tree, *right;
+    bpt_node *node;
+    uintptr_t i, max = 1024, answers[1024];
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+
+    for (i = 1; i <= max; i++)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+
+    /* Split the tree at the key 300 */
+    assert(bpt_split_at(tree, (void *) 300, &right) == true);
+
+    for (i = 1; i <= max; i++){
+	assert(bpt_search(tree, (void *) i, NULL, NULL) == (i < 300));
+	assert(bpt_search(right, (void *) i, NULL, NULL) == (i >= 300));
+    }
+
+    /* Both trees have correct links at the leaf level */
+    for (i = 0; i < max; i++)
+	answers[i] = i + 1;
+    node = NULL;
+    assert(bpt_search(tree, (void *) 1, &node, NULL) == true);
+    full_keys_comparison_test(node, answers);
+    assert(node->prev == NULL);
+    node = NULL;
+    assert(bpt_search(right, (void *) 300, &node, NULL) == true);
+    full_keys_comparison_test(node, &answers[299]);
+    assert(node->prev == NULL);
+
+    /* Unordered trees can't be concatenated, and stay as they were */
+    bpt_set_lazy_delete(tree, true);
+    assert(bpt_delete(tree, (void *) 1, NULL) == true);
+    assert(tree->lazy_pending == 1 && right->lazy_pending == 0);
+    assert(bpt_concat(right, tree) == false);
+    assert(tree->lazy_pending == 1 && right->lazy_pending == 0);
+    assert(bpt_insert(tree, (void *) 1, (void *) &emp) == true);
+    bpt_set_lazy_delete(tree, false);
+
+    /* Concatenate the two trees again */
+    assert(bpt_concat(tree, right) == true);
+    app_loop_bpt_search(tree, max, answers);
+    node = NULL;
+    assert(bpt_search(tree, (void *) 1, &node, NULL) == true);
+    full_keys_comparison_test(node, answers);
+
+    /* Concatenate a lower tree on the left side */
+    assert(bpt_split_at(tree, (void *) 4, &right) == true);
+    assert(bpt_concat(tree, right) == true);
+    app_loop_bpt_search(tree, max, answers);
+
+    /* The result accepts normal insert and delete */
+    assert(bpt_insert(tree, (void *) (max + 1), (void *) &emp) == true);
+    for (i = 1; i <= max + 1; i++)
+	assert(bpt_delete(tree, (void *) i, NULL) == true);
+    assert(ll_get_length(tree->root->keys) == 0);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+static void
+lazy_delete_and_compact_test(uint16_t max_keys){
+    bpt_tree *tree;
+    bpt_node *node;
+    uintptr_t i, max = 1024, answers[1024], answers_num;
+    int calls = 0;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+
+    for (i = 1; i <= max; i++)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+
+    /* Leave every tenth key only, without any borrow or merge */
+    bpt_set_lazy_delete(tree, true);
+    answers_num = 0;
+    for (i = 1; i <= max; i++){
+	if (i % 10 == 0)
+	    answers[answers_num++] = i;
+	else
+	    assert(bpt_delete(tree, (void *) i, NULL) == true);
+    }
+    assert(bpt_delete(tree, (void *) 1, NULL) == false);
+    app_loop_bpt_search(tree, answers_num, answers);
+
+    /* Restore the tree with a small budget per call */
+    while(!bpt_lazy_compact(tree, 4))
+	calls++;
+    assert(calls > 1);
+    assert(bpt_lazy_compact(tree, 4) == true);
+
+    node = NULL;
+    assert(bpt_search(tree, (void *) 10, &node, NULL) == true);
+    full_keys_comparison_test(node, answers);
+    app_loop_bpt_search(tree, answers_num, answers);
+
+    /* The eager deletion works on the compacted tree */
+    bpt_set_lazy_delete(tree, false);
+    for (i = 0; i < answers_num; i++)
+	assert(bpt_delete(tree, (void *) answers[i], NULL) == true);
+    assert(ll_get_length(tree->root->keys) == 0);
+    assert(tree->root->is_leaf == true);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+static void
+compact_leaves_test(uint16_t max_keys){
+    bpt_tree *tree;
+    bpt_node *leaf;
+    uintptr_t i, max = 1024, answers[1024], reclaimable;
+    int calls = 0, leaves = 0;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+
+    /* The ascending insertion leaves the split leaves half full */
+    for (i = 1; i <= max; i++){
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+	answers[i - 1] = i;
+    }
+    reclaimable = bpt_compact_reclaimable(tree, 1.0);
+    assert(reclaimable > 0);
+    assert(bpt_compact_reclaimable(tree, 0.0) == 0);
+
+    /* Pack the leaves with a small budget per call */
+    while(!bpt_compact(tree, 1.0, 4))
+	calls++;
+    assert(calls > 1);
+    assert(bpt_compact_reclaimable(tree, 1.0) == 0);
+
+    /* Only the last two leaves may have free slots */
+    leaf = NULL;
+    assert(bpt_search(tree, (void *) 1, &leaf, NULL) == true);
+    for (; leaf != NULL; leaf = leaf->next){
+	if (leaf->next != NULL && leaf->next->next != NULL)
+	    assert(ll_get_length(leaf->keys) == max_keys);
+	leaves++;
+    }
+    assert(leaves == (max + max_keys - 1) / max_keys);
+    app_loop_bpt_search(tree, max, answers);
+
+    /* The packed tree accepts the insertion and the deletion */
+    for (i = 1; i <= max; i += 2)
+	assert(bpt_delete(tree, (void *) i, NULL) == true);
+    for (i = 1; i <= max; i += 2)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+    app_loop_bpt_search(tree, max, answers);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+/*
+ * Compare the counters with the statistics by the tree walk.
+ */
+static void
+stats_consistency_test(bpt_tree *tree, uintptr_t keys){
+    bpt_tree_stats full, fast;
+    uintptr_t i, histogram_sum = 0;
+
+    assert(bpt_stats(tree, &full) == true);
+    assert(bpt_stats_fast(tree, &fast) == true);
+
+    assert(full.keys == keys);
+    assert(fast.keys == keys);
+    assert(full.nodes == fast.nodes);
+    assert(full.bytes == fast.bytes);
+    assert(full.nodes == full.leaf_nodes + full.internal_nodes);
+    assert(full.bytes == full.node_bytes + full.list_bytes + full.key_bytes);
+
+    for (i = 0; i < BPT_FILL_BUCKETS; i++)
+	histogram_sum += full.fill_histogram[i];
+    assert(histogram_sum == full.nodes);
+}
+
+static void
+tree_stats_test(uint16_t max_keys){
+    bpt_tree *tree, *right;
+    bpt_tree_stats stats;
+    uintptr_t i, max = 512;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+
+    /* Empty tree */
+    stats_consistency_test(tree, 0);
+    assert(bpt_stats(tree, &stats) == true);
+    assert(stats.height == 1 && stats.leaf_nodes == 1);
+    assert(stats.internal_nodes == 0 && stats.leaf_fill == 0.0);
+    assert(stats.fill_histogram[0] == 1);
+
+    for (i = 1; i <= max; i++)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+    assert(bpt_insert(tree, (void *) 1, (void *) &emp) == false);
+    stats_consistency_test(tree, max);
+    assert(bpt_stats(tree, &stats) == true);
+    assert(stats.height > 2);
+    assert(stats.leaf_fill > 0.0 && stats.leaf_fill <= 1.0);
+
+    /* Shrink the tree */
+    for (i = 1; i <= max / 2; i++)
+	assert(bpt_delete(tree, (void *) i, NULL) == true);
+    stats_consistency_test(tree, max / 2);
+    assert(bpt_delete_range(tree, (void *) 300, (void *) 399, false) == 100);
+    stats_consistency_test(tree, max / 2 - 100);
+
+    /* Split and concatenate */
+    assert(bpt_split_at(tree, (void *) 450, &right) == true);
+    stats_consistency_test(tree, 93);
+    stats_consistency_test(right, 63);
+    assert(bpt_concat(tree, right) == true);
+    stats_consistency_test(tree, max / 2 - 100);
+
+    /* Update both trees before their counters are settled */
+    assert(bpt_split_at(tree, (void *) 450, &right) == true);
+    assert(tree->counts_stale && right->counts_stale);
+    assert(bpt_insert(tree, (void *) 1, (void *) &emp) == true);
+    assert(bpt_delete(right, (void *) 450, NULL) == true);
+    assert(bpt_concat(tree, right) == true);
+    assert(tree->counts_stale);
+    stats_consistency_test(tree, max / 2 - 100);
+    assert(tree->counts_stale == false);
+    assert(bpt_delete(tree, (void *) 1, NULL) == true);
+    assert(bpt_insert(tree, (void *) 450, (void *) &emp) == true);
+    stats_consistency_test(tree, max / 2 - 100);
+
+    /* Pack the leaves */
+    while(!bpt_compact(tree, 1.0, 8))
+	;
+    stats_consistency_test(tree, max / 2 - 100);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+static void
+op_counters_test(uint16_t max_keys){
+    bpt_tree *tree;
+    bpt_tree_stats stats;
+    bpt_counters counters;
+    uintptr_t i, max = 256;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+
+    /* Built without -DBPT_COUNTERS */
+    if (!bpt_counters_snapshot(tree, &counters)){
+	assert(counters.comparisons == 0 && counters.splits == 0);
+	bpt_destroy(tree);
+	return;
+    }
+
+    for (i = 1; i <= max; i++)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+    assert(bpt_stats(tree, &stats) == true);
+    assert(bpt_counters_snapshot(tree, &counters) == true);
+    assert(counters.root_splits == stats.height - 1);
+    assert(1 + counters.splits + counters.root_splits == stats.nodes);
+    assert(counters.merges == 0 && counters.borrows == 0);
+
+    /* One search visits one node per level */
+    bpt_counters_reset(tree);
+    assert(bpt_search(tree, (void *) max, NULL, NULL) == true);
+    assert(bpt_counters_snapshot(tree, &counters) == true);
+    assert(counters.nodes_visited == stats.height);
+    assert(counters.comparisons >= stats.height);
+    assert(counters.splits == 0);
+
+    /* Shrink the tree to the root */
+    for (i = 1; i <= max; i++)
+	assert(bpt_delete(tree, (void *) i, NULL) == true);
+    assert(bpt_counters_snapshot(tree, &counters) == true);
+    assert(counters.merges > 0 && counters.borrows > 0);
+    assert(counters.root_promotions > 0);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+static void
+latency_histogram_test(void){
+    bpt_tree *tree;
+    bpt_histogram h1, h2;
+    uint64_t v, p50, p99;
+    uintptr_t i;
+
+    /* Small values are exact. Larger ones are within 1/16 */
+    bpt_histogram_reset(&h1);
+    for (v = 1; v <= 1000; v++)
+	bpt_histogram_record(&h1, v);
+    assert(h1.count == 1000 && h1.max == 1000 && h1.sum == 500500);
+    assert(bpt_histogram_percentile(&h1, 1.0) == 10);
+    p50 = bpt_histogram_percentile(&h1, 50.0);
+    p99 = bpt_histogram_percentile(&h1, 99.0);
+    assert(p50 >= 500 && p50 <= 500 + 500 / 16);
+    assert(p99 >= 990 && p99 <= 1000);
+    assert(bpt_histogram_percentile(&h1, 100.0) == 1000);
+
+    /* Merge a tail */
+    bpt_histogram_reset(&h2);
+    for (v = 0; v < 1000; v++)
+	bpt_histogram_record(&h2, 1000000);
+    bpt_histogram_merge(&h1, &h2);
+    assert(h1.count == 2000 && h1.max == 1000000);
+    assert(bpt_histogram_percentile(&h1, 25.0) <= 500 + 500 / 16);
+    assert(bpt_histogram_percentile(&h1, 99.9) == 1000000);
+
+    /* The rank is rounded up, so the median of three is the middle one */
+    bpt_histogram_reset(&h1);
+    bpt_histogram_record(&h1, 10);
+    bpt_histogram_record(&h1, 1000);
+    bpt_histogram_record(&h1, 100000);
+    p50 = bpt_histogram_percentile(&h1, 50.0);
+    assert(p50 >= 1000 && p50 <= 1000 + 1000 / 16);
+    assert(bpt_histogram_percentile(&h1, 33.0) == 10);
+
+    bpt_histogram_reset(&h1);
+    assert(h1.count == 0 && bpt_histogram_percentile(&h1, 50.0) == 0);
+
+    /* The latency of tree operations */
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    4, NULL);
+    if (!bpt_latency_snapshot(tree, BPT_OP_INSERT, BPT_PHASE_TOTAL, &h1)){
+	/* Built without -DBPT_LATENCY */
+	assert(h1.count == 0);
+	bpt_destroy(tree);
+	return;
+    }
+
+    for (i = 1; i <= 128; i++)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+    assert(bpt_insert(tree, (void *) 1, (void *) &emp) == false);
+    for (i = 1; i <= 64; i++)
+	assert(bpt_search(tree, (void *) i, NULL, NULL) == true);
+    for (i = 1; i <= 32; i++)
+	assert(bpt_delete(tree, (void *) i, NULL) == true);
+
+    assert(bpt_latency_snapshot(tree, BPT_OP_INSERT, BPT_PHASE_TOTAL, &h1));
+    assert(h1.count == 129);
+    assert(bpt_latency_snapshot(tree, BPT_OP_INSERT, BPT_PHASE_DESCENT, &h1));
+    assert(h1.count == 129);
+    assert(bpt_latency_snapshot(tree, BPT_OP_INSERT, BPT_PHASE_RESTRUCTURE, &h1));
+    assert(h1.count == 128);
+    assert(bpt_latency_snapshot(tree, BPT_OP_SEARCH, BPT_PHASE_TOTAL, &h1));
+    assert(h1.count == 64);
+    assert(bpt_latency_snapshot(tree, BPT_OP_SEARCH, BPT_PHASE_RESTRUCTURE, &h1));
+    assert(h1.count == 0);
+    assert(bpt_latency_snapshot(tree, BPT_OP_DELETE, BPT_PHASE_TOTAL, &h1));
+    assert(h1.count == 32);
+
+    bpt_latency_reset(tree);
+    assert(bpt_latency_snapshot(tree, BPT_OP_INSERT, BPT_PHASE_TOTAL, &h1));
+    assert(h1.count == 0);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+/*
+ * Insert and delete 'ops' pseudo-random keys of 1 to 'keys_num' - 1
+ * times 'stride', two inserts for one delete. 'inserted' has 'keys_num'
+ * flags of the keys in the tree. Call 'step' after each operation
+ * unless it's NULL.
+ */
+static void
+random_updates(bpt_tree *tree, bool *inserted, uintptr_t keys_num,
+	       uintptr_t stride, uintptr_t ops, uintptr_t seed,
+	       void (*step)(bpt_tree *)){
+    uintptr_t i, key;
+
+    memset(inserted, 0, sizeof(bool) * keys_num);
+    for (i = 0; i < ops; i++){
+	seed = seed * 1103515245 + 12345;
+	key = (seed >> 16) % (keys_num - 1) + 1;
+	if ((seed >> 8) % 3 != 0){
+	    assert(bpt_insert(tree, (void *) (key * stride),
+			      (void *) &emp) == !inserted[key]);
+	    inserted[key] = true;
+	}else{
+	    assert(bpt_delete(tree, (void *) (key * stride),
+			      NULL) == inserted[key]);
+	    inserted[key] = false;
+	}
+	if (step != NULL)
+	    step(tree);
+    }
+}
+
+/*
+ * Interleave insertions and deletions in a pseudo-random order, which
+ * runs into the root promotion next to a full sibling.
+ */
+static void
+interleaved_insert_and_delete_test(uint16_t max_keys){
+    bpt_tree *tree;
+    bool inserted[256];
+    uintptr_t key;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+
+    random_updates(tree, inserted, 256, 1, 20000, 12345, NULL);
+
+    for (key = 1; key < 256; key++)
+	assert(bpt_search(tree, (void *) key, NULL, NULL) == inserted[key]);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+/*
+ * Read the integer keys as eight big-endian bytes. Keep only the top
+ * 'abbrev_bits' bits of the abbreviations. With a few bits, the
+ * neighboring keys tie and fall back to the comparison callback.
+ */
+static uintptr_t abbrev_calls;
+static int abbrev_bits;
+
+static uint64_t
+employee_key_abbrev(void *key, uintptr_t offset, void *metadata){
+    abbrev_calls++;
+
+    if (offset >= sizeof(uint64_t))
+	return 0;
+
+    return ((uint64_t) (uintptr_t) key << (offset * 8)) &
+	(UINT64_MAX << (64 - abbrev_bits));
+}
+
+static uintptr_t
+employee_key_prefix(void *key1, void *key2, void *metadata){
+    uint64_t diff = (uintptr_t) key1 ^ (uintptr_t) key2;
+    uintptr_t bytes = 0;
+
+    while(bytes < sizeof(uint64_t) && (diff >> (56 - bytes * 8)) == 0)
+	bytes++;
+
+    return bytes;
+}
+
+/*
+ * The keys are spread by 'stride' so that some nodes share the longer
+ * prefixes than others. The abbreviations of 'bits' bits save some
+ * comparisons after the common prefixes, and most of them with 64 bits.
+ */
+static void
+abbreviated_keys_test(uint16_t max_keys, bpt_key_prefix_cb key_prefix,
+		      int bits){
+    bpt_tree *tree, *right;
+    bool inserted[256];
+    uintptr_t key, stride = 37, with_abbrev, without_abbrev;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+    assert(tree->key_abbrev == NULL);
+    bpt_set_key_abbrev(tree, employee_key_abbrev, key_prefix);
+
+    abbrev_bits = bits;
+    abbrev_calls = 0;
+    random_updates(tree, inserted, 256, stride, 20000, 54321, NULL);
+    assert(abbrev_calls > 0);
+
+    /* Include the keys between the inserted ones */
+    for (key = 1; key < 256 * stride; key++)
+	assert(bpt_search(tree, (void *) key, NULL, NULL) ==
+	       (key % stride == 0 && inserted[key / stride]));
+
+    /* The cached abbreviations survive moving nodes between trees */
+    assert(bpt_split_at(tree, (void *) (128 * stride), &right) == true);
+    for (key = 1; key < 256; key++){
+	assert(bpt_search(tree, (void *) (key * stride), NULL, NULL) ==
+	       (inserted[key] && key < 128));
+	assert(bpt_search(right, (void *) (key * stride), NULL, NULL) ==
+	       (inserted[key] && key >= 128));
+    }
+    assert(bpt_concat(tree, right) == true);
+
+    /* Search twice, since the first search of each node fills its cache */
+    for (key = 1; key < 256; key++)
+	(void) bpt_search(tree, (void *) (key * stride), NULL, NULL);
+    compare_calls = 0;
+    for (key = 1; key < 256; key++)
+	(void) bpt_search(tree, (void *) (key * stride), NULL, NULL);
+    with_abbrev = compare_calls;
+
+    /*
+     * The search without the abbreviation gives the same answers, with
+     * more calls of the comparison callback
+     */
+    bpt_set_key_abbrev(tree, NULL, NULL);
+    abbrev_calls = compare_calls = 0;
+    for (key = 1; key < 256; key++)
+	assert(bpt_search(tree, (void *) (key * stride), NULL,
+			  NULL) == inserted[key]);
+    assert(abbrev_calls == 0);
+    without_abbrev = compare_calls;
+    printf("comparison calls with and without abbreviation : %lu, %lu\n",
+	   with_abbrev, without_abbrev);
+    if (bits == 64)
+	assert(with_abbrev * 2 < without_abbrev);
+    else if (key_prefix != NULL)
+	assert(with_abbrev < without_abbrev);
+    else
+	assert(with_abbrev <= without_abbrev);
+
+    /* Clean up */
+    bpt_destroy(tree);
+}
+
+/*
+ * Clear the low bits of the right key while it stays bigger than the
+ * left key. The keys aren't allocated, so count the separators instead.
+ */
+static uintptr_t separators_made, separators_freed;
+
+static void *
+employee_key_separator(void *left, void *right, void *metadata){
+    uintptr_t l = (uintptr_t) left, r = (uintptr_t) right,
+	mask = UINTPTR_MAX;
+
+    while((r & (mask << 1)) > l)
+	mask <<= 1;
+
+    if ((r & mask) == r)
+	return NULL;
+
+    separators_made++;
+
+    return (void *) (r & mask);
+}
+
+static void
+employee_separator_free(void *separator){
+    separators_freed++;
+}
+
+/*
+ * The unused separators are collected along the updates.
+ */
+static void
+check_separators_bound(bpt_tree *tree){
+    assert(tree->separators == NULL ||
+	   tree->separators->separators_num <= 4 * tree->leaf_count + 32);
+}
+
+static void
+truncated_separators_test(uint16_t max_keys){
+    bpt_tree *tree, *right;
+    bool inserted[256];
+    uintptr_t key, stride = 37, freed, round;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+    assert(bpt_set_key_separator(tree, employee_key_separator,
+				 employee_separator_free) == true);
+
+    separators_made = separators_freed = 0;
+    random_updates(tree, inserted, 256, stride, 20000, 98765,
+		   check_separators_bound);
+    assert(separators_made > 0);
+
+    for (key = 1; key < 256 * stride; key++)
+	assert(bpt_search(tree, (void *) key, NULL, NULL) ==
+	       (key % stride == 0 && inserted[key / stride]));
+
+    /* The separators in use can't be switched */
+    assert(bpt_set_key_separator(tree, NULL, NULL) == false);
+
+    /* The separators move with their nodes, and both trees share them */
+    assert(bpt_split_at(tree, (void *) (128 * stride), &right) == true);
+    assert(right->separators == tree->separators);
+    assert(tree->separators->trees_num == 2);
+    for (key = 1; key < 256; key++){
+	assert(bpt_search(tree, (void *) (key * stride), NULL, NULL) ==
+	       (inserted[key] && key < 128));
+	assert(bpt_search(right, (void *) (key * stride), NULL, NULL) ==
+	       (inserted[key] && key >= 128));
+    }
+
+    /* Either tree frees only the separators unused by both */
+    freed = separators_freed;
+    for (round = 0; round < 10; round++){
+	for (key = 1; key < 256; key++)
+	    if (inserted[key])
+		assert(bpt_delete(key < 128 ? tree : right,
+				  (void *) (key * stride), NULL) == true);
+	for (key = 1; key < 256; key++)
+	    if (inserted[key])
+		assert(bpt_insert(key < 128 ? tree : right,
+				  (void *) (key * stride),
+				  (void *) &emp) == true);
+    }
+    assert(separators_freed > freed);
+    for (key = 1; key < 256; key++){
+	assert(bpt_search(tree, (void *) (key * stride), NULL, NULL) ==
+	       (inserted[key] && key < 128));
+	assert(bpt_search(right, (void *) (key * stride), NULL, NULL) ==
+	       (inserted[key] && key >= 128));
+    }
+    assert(bpt_concat(tree, right) == true);
+    for (key = 1; key < 256; key++)
+	assert(bpt_search(tree, (void *) (key * stride), NULL,
+			  NULL) == inserted[key]);
+
+    /* Clean up. All the separators are freed */
+    bpt_destroy(tree);
+    assert(separators_freed == separators_made);
+}
+
+static uint64_t
+employee_key_integer(void *key, void *metadata){
+    return (uintptr_t) key;
+}
+
+/*
+ * The packed keys of every leaf must match its keys. Return the widest
+ * delta in bytes.
+ */
+static uint8_t
+check_packed_keys(bpt_tree *tree){
+    bpt_node *leaf = tree->root;
+    bpt_packed_keys *packed;
+    uint64_t delta;
+    uint8_t widest = 0;
+    int i;
+
+    while(!leaf->is_leaf)
+	leaf = (bpt_node *) ll_ref_index_data(leaf->children, 0);
+
+    for (; leaf != NULL; leaf = leaf->next){
+	packed = leaf->packed;
+	assert(packed != NULL && packed->keys_num == ll_get_length(leaf->keys));
+	for (i = 0; i < packed->keys_num; i++){
+	    switch(packed->width){
+		case 1:
+		    delta = ((uint8_t *) (packed + 1))[i];
+		    break;
+		case 2:
+		    delta = ((uint16_t *) (packed + 1))[i];
+		    break;
+		case 4:
+		    delta = ((uint32_t *) (packed + 1))[i];
+		    break;
+		default:
+		    delta = ((uint64_t *) (packed + 1))[i];
+		    break;
+	    }
+	    assert(packed->base + delta ==
+		   (uintptr_t) ll_ref_index_data(leaf->keys, i));
+	}
+	if (packed->width > widest)
+	    widest = packed->width;
+    }
+
+    return widest;
+}
+
+/*
+ * Search the keys by the packed deltas of 'stride' apart. The stride
+ * decides the width of the deltas.
+ */
+static void
+packed_keys_test(uint16_t max_keys, uintptr_t stride, uint8_t width){
+    bpt_tree *tree, *right;
+    bpt_tree_stats packed_stats, stats;
+    bpt_packed_keys *packed;
+    bpt_node *leaf;
+    bool inserted[512];
+    uintptr_t key, keys_num = 0;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+    assert(bpt_set_key_packing(tree, employee_key_integer) == true);
+
+    random_updates(tree, inserted, 512, stride, 6000, 4242, NULL);
+    assert(check_packed_keys(tree) == width);
+
+    /* One update of a leaf rewrites its deltas in place */
+    for (leaf = tree->root; !leaf->is_leaf;
+	 leaf = ll_ref_index_data(leaf->children, 0))
+	;
+    while (ll_get_length(leaf->keys) < max_keys / 2 + 2)
+	leaf = leaf->next;
+    packed = leaf->packed;
+    key = (uintptr_t) ll_ref_index_data(leaf->keys, 1);
+    assert(bpt_delete(tree, (void *) key, NULL) == true);
+    assert(leaf->packed == packed);
+    assert(bpt_insert(tree, (void *) key, (void *) &emp) == true);
+    assert(leaf->packed == packed);
+    (void) check_packed_keys(tree);
+
+    /* The keys between and beyond the packed ones are not found */
+    for (key = 0; key < 513; key++){
+	assert(bpt_search(tree, (void *) (key * stride), NULL, NULL) ==
+	       (key > 0 && key < 512 && inserted[key]));
+	if (stride > 1)
+	    assert(bpt_search(tree, (void *) (key * stride + 1), NULL,
+			      NULL) == false);
+    }
+
+    assert(bpt_delete_range(tree, (void *) (100 * stride),
+			    (void *) (199 * stride), false) > 0);
+    memset(&inserted[100], 0, sizeof(bool) * 100);
+    assert(bpt_split_at(tree, (void *) (300 * stride), &right) == true);
+    (void) check_packed_keys(tree);
+    (void) check_packed_keys(right);
+    assert(bpt_concat(tree, right) == true);
+    (void) check_packed_keys(tree);
+
+    /* The packed keys are counted as allocated, beside the keys */
+    for (key = 1; key < 512; key++)
+	keys_num += inserted[key];
+    stats_consistency_test(tree, keys_num);
+    assert(bpt_stats(tree, &packed_stats) == true);
+
+    /* Switch it off and on with the keys */
+    assert(bpt_set_key_packing(tree, NULL) == true);
+    assert(tree->root->packed == NULL);
+    stats_consistency_test(tree, keys_num);
+    assert(bpt_stats(tree, &stats) == true);
+    assert(packed_stats.node_bytes - stats.node_bytes >=
+	   stats.leaf_nodes * BPT_CACHE_LINE_SIZE);
+    assert(bpt_set_key_packing(tree, employee_key_integer) == true);
+    (void) check_packed_keys(tree);
+    for (key = 1; key < 512; key++)
+	assert(bpt_search(tree, (void *) (key * stride), NULL, NULL) ==
+	       inserted[key]);
+    stats_consistency_test(tree, keys_num);
+
+    bpt_destroy(tree);
+}
+
+/*
+ * Every node must come from the slabs of the arena at a cache line.
+ * Return the number of nodes.
+ */
+static uintptr_t
+check_arena_nodes(bpt_tree *tree){
+    bpt_node *leftmost = tree->root, *node;
+    uintptr_t i, nodes = 0;
+
+    for (; leftmost != NULL;
+	 leftmost = leftmost->is_leaf ? NULL :
+	     ll_ref_index_data(leftmost->children, 0)){
+	for (node = leftmost; node != NULL; node = node->next){
+	    for (i = 0; i < tree->arena->slabs_num; i++)
+		if (node >= tree->arena->slabs[i] &&
+		    node < tree->arena->slabs[i] + BPT_ARENA_SLAB_NODES)
+		    break;
+	    assert(i < tree->arena->slabs_num);
+	    assert((uintptr_t) node % BPT_CACHE_LINE_SIZE == 0);
+	    nodes++;
+	}
+    }
+
+    return nodes;
+}
+
+static void
+node_arena_test(uint16_t max_keys){
+    bpt_tree *tree, *right;
+    uintptr_t i, used, nodes, records_num = 3000;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+    assert(bpt_set_node_arena(tree, true) == true);
+    assert(tree->root == tree->arena->slabs[0]);
+    assert((uintptr_t) tree->arena->slabs[0] % BPT_SLAB_ALIGN == 0);
+
+    for (i = 1; i <= records_num; i++)
+	assert(bpt_insert(tree, (void *) ((i * 7) % records_num + 1),
+			  (void *) &emp) == true);
+    assert(bpt_set_node_arena(tree, false) == false);
+    assert(check_arena_nodes(tree) ==
+	   tree->leaf_count + tree->internal_count);
+    assert(tree->arena->used > BPT_ARENA_SLAB_NODES || max_keys > 3);
+
+    /* The freed nodes are reused before any new one is handed out */
+    for (i = 1; i <= records_num / 2; i++)
+	assert(bpt_delete(tree, (void *) i, NULL) == true);
+    used = tree->arena->used;
+    assert(used > tree->leaf_count + tree->internal_count);
+    for (i = 1; i <= records_num / 2; i++)
+	assert(bpt_insert(tree, (void *) i, (void *) &emp) == true);
+    nodes = check_arena_nodes(tree);
+    assert(tree->arena->used == (nodes > used ? nodes : used));
+
+    /* The split trees share the arena */
+    assert(bpt_split_at(tree, (void *) (records_num / 2), &right) == true);
+    assert(right->arena == tree->arena && tree->arena->refs == 2);
+    (void) check_arena_nodes(tree);
+    (void) check_arena_nodes(right);
+    assert(bpt_concat(tree, right) == true);
+    assert(tree->arena->refs == 1);
+    (void) check_arena_nodes(tree);
+    for (i = 1; i <= records_num; i++)
+	assert(bpt_search(tree, (void *) i, NULL, NULL) == true);
+
+    /* Go back to one allocation per node once the tree gets empty */
+    for (i = 1; i <= records_num; i++)
+	assert(bpt_delete(tree, (void *) i, NULL) == true);
+    assert(bpt_set_node_arena(tree, false) == true);
+    assert(tree->arena == NULL);
+    assert(bpt_insert(tree, (void *) 1, (void *) &emp) == true);
+
+    bpt_destroy(tree);
+}
+
+/*
+ * Bytes of a full node of 'max_keys' keys. See
+ * bpt_max_keys_for_node_size().
+ */
+static uintptr_t
+full_node_size(uintptr_t max_keys, uintptr_t key_size){
+    return sizeof(bpt_node) + 2 * sizeof(linked_list) +
+	(2 * max_keys + 1) * sizeof(node) + max_keys * key_size;
+}
+
+static void
+node_size_test(uintptr_t node_size, uintptr_t key_size){
+    bpt_tree *tree;
+    bpt_node *leftmost, *curr;
+    uint16_t max_keys;
+    uintptr_t i, records_num = 2000;
+
+    /* The largest max_keys that fits */
+    max_keys = bpt_max_keys_for_node_size(node_size, key_size);
+    assert(max_keys >= 2);
+    assert(full_node_size(max_keys, key_size) <= node_size);
+    assert(full_node_size(max_keys + 1, key_size) > node_size);
+    assert(bpt_max_keys_for_node_size(full_node_size(1, key_size),
+				      key_size) == 0);
+
+    tree = bpt_init_by_node_size(employee_key_compare,
+				 employee_key_free,
+				 employee_record_free,
+				 node_size, key_size, NULL);
+    assert(tree->max_keys == max_keys);
+
+    for (i = 1; i <= records_num; i++)
+	assert(bpt_insert(tree, (void *) ((i * 7) % records_num + 1),
+			  (void *) &emp) == true);
+
+    /* Every node starts at a cache line, which has what the search reads */
+    assert(offsetof(bpt_node, page) + sizeof(void *) <= BPT_CACHE_LINE_SIZE);
+    for (leftmost = tree->root; leftmost != NULL;
+	 leftmost = leftmost->is_leaf ? NULL :
+	     ll_ref_index_data(leftmost->children, 0))
+	for (curr = leftmost; curr != NULL; curr = curr->next)
+	    assert((uintptr_t) curr % BPT_CACHE_LINE_SIZE == 0);
+
+    for (i = 1; i <= records_num; i++)
+	assert(bpt_search(tree, (void *) i, NULL, NULL) == true);
+
+    bpt_destroy(tree);
+
+    assert(bpt_init_by_node_size(employee_key_compare,
+				 employee_key_free,
+				 employee_record_free,
+				 full_node_size(1, key_size), key_size,
+				 NULL) == NULL);
+}
+
+static void
+scan_prefetch_test(uint16_t max_keys){
+    bpt_tree *tree;
+    bpt_leaf_cursor cursor;
+    bpt_node *leaf, *ahead;
+    uintptr_t i, walked, records_num = 1000;
+    uint16_t distances[] = { 0, 1, 2, 3, BPT_SCAN_PREFETCH_DEFAULT,
+			     BPT_SCAN_PREFETCH_MAX };
+    int d, k;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+    assert(tree->scan_prefetch == BPT_SCAN_PREFETCH_DEFAULT);
+    assert(bpt_set_scan_prefetch(tree, BPT_SCAN_PREFETCH_MAX + 1) == false);
+
+    for (i = 1; i <= records_num; i++)
+	assert(bpt_insert(tree, (void *) ((i * 7) % records_num + 1),
+			  (void *) &emp) == true);
+
+    /* Any distance walks the same keys in order */
+    for (d = 0; d < sizeof(distances) / sizeof(distances[0]); d++){
+	assert(bpt_set_scan_prefetch(tree, distances[d]) == true);
+	assert(bpt_search(tree, (void *) 1, &leaf, NULL) == true);
+	leaf = bpt_begin_leaf_walk(tree, &cursor, leaf);
+	for (walked = 0; leaf != NULL; leaf = bpt_next_leaf(&cursor)){
+	    /* The prefetch stays the distance ahead to the end */
+	    for (ahead = leaf, i = 0; ahead != NULL && i < cursor.distance;
+		 i++)
+		ahead = ahead->next;
+	    if (cursor.distance > 0)
+		assert(cursor.nodes == ahead);
+	    for (k = 0; k < ll_get_length(leaf->keys); k++)
+		assert((uintptr_t) ll_ref_index_data(leaf->keys, k) ==
+		       ++walked);
+	}
+	assert(walked == records_num);
+	assert(bpt_next_leaf(&cursor) == NULL);
+    }
+
+    bpt_destroy(tree);
+}
+
 static void
 keys_test_bpt_search(void){
     printf("<Search key test from single node>\n");
@@ -897,6 +1893,76 @@ keys_test_bpt_remove(void){
 
     printf("<Remove key from depth 3 tree>\n");
     remove_from_three_depth_tree();
+
+    printf("<Remove key range>\n");
+    remove_key_range_test(3);
+    remove_key_range_test(8);
+
+    printf("<Relaxed deletion and compaction>\n");
+    lazy_delete_and_compact_test(3);
+    lazy_delete_and_compact_test(7);
+
+    printf("<Interleave insert and delete>\n");
+    interleaved_insert_and_delete_test(3);
+    interleaved_insert_and_delete_test(4);
+    interleaved_insert_and_delete_test(7);
+
+    printf("<Pack the leaves to the target fill factor>\n");
+    compact_leaves_test(4);
+    compact_leaves_test(9);
+}
+
+static void
+keys_test_bpt_split_and_concat(void){
+    printf("<Split and concatenate trees>\n");
+    split_and_concat_test(3);
+    split_and_concat_test(6);
+
+    printf("<Abbreviated keys>\n");
+    abbreviated_keys_test(3, NULL, 5);
+    abbreviated_keys_test(8, NULL, 5);
+    abbreviated_keys_test(8, NULL, 64);
+
+    printf("<Abbreviated keys after the common prefix>\n");
+    abbreviated_keys_test(3, employee_key_prefix, 5);
+    abbreviated_keys_test(8, employee_key_prefix, 5);
+
+    printf("<Truncated separators>\n");
+    truncated_separators_test(3);
+    truncated_separators_test(8);
+
+    printf("<Node arena>\n");
+    node_arena_test(3);
+    node_arena_test(8);
+
+    printf("<Max keys by the node size>\n");
+    node_size_test(1024, 8);
+    node_size_test(4096, 0);
+
+    printf("<Leaf walk with prefetch>\n");
+    scan_prefetch_test(3);
+    scan_prefetch_test(16);
+
+    printf("<Packed keys>\n");
+    packed_keys_test(3, 1, 1);
+    packed_keys_test(8, 7, 1);
+    packed_keys_test(8, 1000, 2);
+    packed_keys_test(16, (uintptr_t) 1 << 20, 4);
+    packed_keys_test(16, (uintptr_t) 1 << 40, 8);
+}
+
+static void
+keys_test_bpt_stats(void){
+    printf("<Tree statistics and counters>\n");
+    tree_stats_test(3);
+    tree_stats_test(8);
+
+    printf("<Operation counters>\n");
+    op_counters_test(3);
+    op_counters_test(6);
+
+    printf("<Latency histograms>\n");
+    latency_histogram_test();
 }
 
 static void
@@ -919,6 +1985,8 @@ main(int argc, char **argv){
     keys_test_bpt_search();
     keys_test_bpt_insert();
     keys_test_bpt_remove();
+    keys_test_bpt_split_and_concat();
+    keys_test_bpt_stats();
 
     printf("Perform more advanced tests...\n");
 
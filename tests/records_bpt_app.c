@@ -73,6 +73,227 @@ records_bpt_test(){
     bpt_destroy(tree);
 }
 
+/*
+ * Sum, min and max of employee ids over key ranges.
+ */
+typedef struct id_stats {
+    uintptr_t sum;
+    uintptr_t min;
+    uintptr_t max;
+} id_stats;
+
+static void
+id_stats_identity(void *agg){
+    id_stats *s = (id_stats *) agg;
+
+    s->sum = s->max = 0;
+    s->min = UINTPTR_MAX;
+}
+
+static void
+id_stats_record(void *agg, void *record){
+    id_stats *s = (id_stats *) agg;
+    employee *e = (employee *) record;
+
+    s->sum += e->id;
+    if (e->id < s->min)
+	s->min = e->id;
+    if (e->id > s->max)
+	s->max = e->id;
+}
+
+static void
+id_stats_combine(void *agg, void *other){
+    id_stats *s = (id_stats *) agg, *o = (id_stats *) other;
+
+    s->sum += o->sum;
+    if (o->min < s->min)
+	s->min = o->min;
+    if (o->max > s->max)
+	s->max = o->max;
+}
+
+static void
+records_aggregate_test(){
+    bpt_tree *tree;
+    uintptr_t i, records_num = 512;
+    employee *emp, *emp_ary;
+    id_stats stats;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    4, NULL);
+
+    assert(bpt_set_aggregate(tree, sizeof(id_stats), id_stats_identity,
+			     id_stats_record, id_stats_combine) == true);
+
+    emp_ary = (employee *) malloc(sizeof(employee) * (records_num + 1));
+
+    /* Insert in descending order so that records don't come in order */
+    for (i = records_num; i >= 1; i--){
+	emp_ary[i].id = i;
+	assert(bpt_insert(tree, (void *) i, &emp_ary[i]) == true);
+    }
+
+    assert(bpt_aggregate_range(tree, (void *) 1, (void *) records_num,
+			       &stats) == true);
+    assert(stats.sum == records_num * (records_num + 1) / 2);
+    assert(stats.min == 1 && stats.max == records_num);
+
+    assert(bpt_aggregate_range(tree, (void *) 100, (void *) 199,
+			       &stats) == true);
+    assert(stats.sum == (100 + 199) * 100 / 2);
+    assert(stats.min == 100 && stats.max == 199);
+
+    /* Out of the range of all keys */
+    assert(bpt_aggregate_range(tree, (void *) 1000, (void *) 2000,
+			       &stats) == true);
+    assert(stats.sum == 0 && stats.min == UINTPTR_MAX);
+
+    /* Delete the first half. The aggregates must follow merges */
+    for (i = 1; i <= records_num / 2; i++){
+	assert(bpt_delete(tree, (void *) i, (void **) &emp) == true);
+	assert(emp->id == i);
+    }
+
+    assert(bpt_aggregate_range(tree, (void *) 1, (void *) records_num,
+			       &stats) == true);
+    assert(stats.sum == (records_num / 2 + 1 + records_num) * (records_num / 2) / 2);
+    assert(stats.min == records_num / 2 + 1 && stats.max == records_num);
+
+    assert(bpt_aggregate_range(tree, (void *) 200, (void *) 300,
+			       &stats) == true);
+    assert(stats.sum == (257 + 300) * 44 / 2);
+    assert(stats.min == 257 && stats.max == 300);
+
+    /* Clean up resources */
+    free(emp_ary);
+
+    bpt_destroy(tree);
+}
+
+/*
+ * Variable-length records for the leaf pages. The id followed by a name
+ * of 'id % 97' letters, null-terminated.
+ */
+static void
+employee_line(uintptr_t id, char *line){
+    int len = sprintf(line, "%lu:", id);
+
+    memset(line + len, 'a' + id % 26, id % 97);
+    line[len + id % 97] = '\0';
+}
+
+static uintptr_t
+employee_line_length(void *record){
+    return strlen((char *) record) + 1;
+}
+
+/*
+ * Every slot of the leaf pages must refer to the record of the leaf.
+ */
+static void
+check_leaf_pages(bpt_tree *tree){
+    bpt_node *leaf = tree->root;
+    bpt_page_header *header;
+    uintptr_t length;
+    char *record;
+    int i;
+
+    while(!leaf->is_leaf)
+	leaf = (bpt_node *) ll_ref_index_data(leaf->children, 0);
+
+    for (; leaf != NULL; leaf = leaf->next){
+	header = (bpt_page_header *) leaf->page;
+	assert(header != NULL);
+	assert(header->slots_num == ll_get_length(leaf->children));
+	for (i = 0; i < header->slots_num; i++){
+	    record = bpt_page_ref_record(header, i, &length);
+	    assert(record == ll_ref_index_data(leaf->children, i));
+	    assert(length == strlen(record) + 1);
+	    assert(strtoul(record, NULL, 10) ==
+		   (uintptr_t) ll_ref_index_data(leaf->keys, i));
+	    if (length <= tree->inline_limit)
+		assert(record >= (char *) header + header->heap_offset &&
+		       record + length <= (char *) header + tree->page_size);
+	}
+	assert(bpt_page_ref_record(header, i, NULL) == NULL);
+    }
+}
+
+static void
+records_page_test(uint16_t max_keys, uintptr_t page_size){
+    bpt_tree *tree, *right;
+    bpt_tree_stats stats;
+    uintptr_t i, id, records_num = 600;
+    char line[128], expected[128], *record;
+
+    tree = bpt_init(employee_key_compare,
+		    employee_key_free,
+		    employee_record_free,
+		    max_keys, NULL);
+
+    /* Invalid page configurations */
+    assert(bpt_set_leaf_pages(tree, page_size, NULL) == false);
+    assert(bpt_set_leaf_pages(tree, page_size + 4,
+			      employee_line_length) == false);
+    assert(bpt_set_leaf_pages(tree, 32, employee_line_length) == false);
+
+    assert(bpt_set_leaf_pages(tree, page_size,
+			      employee_line_length) == true);
+    assert(tree->inline_limit >= sizeof(bpt_page_overflow));
+
+    /* The records are copied. Reuse one buffer for all of them */
+    for (i = 1; i <= records_num; i++){
+	id = i * 37 % (records_num + 1);
+	employee_line(id, line);
+	assert(bpt_insert(tree, (void *) id, line) == true);
+    }
+    memset(line, '\0', sizeof(line));
+    assert(bpt_set_leaf_pages(tree, page_size, employee_line_length) == false);
+
+    check_leaf_pages(tree);
+    for (i = 1; i <= records_num; i++){
+	assert(bpt_search(tree, (void *) i, NULL, (void **) &record) == true);
+	employee_line(i, expected);
+	assert(strcmp(record, expected) == 0);
+    }
+
+    assert(bpt_stats(tree, &stats) == true);
+    assert(stats.node_bytes >= stats.leaf_nodes * page_size);
+
+    /* The deleted record is readable until the next update */
+    for (i = 3; i <= records_num; i += 3){
+	assert(bpt_delete(tree, (void *) i, (void **) &record) == true);
+	employee_line(i, expected);
+	assert(strcmp(record, expected) == 0);
+    }
+    check_leaf_pages(tree);
+
+    assert(bpt_delete_range(tree, (void *) 100, (void *) 199, false) == 67);
+    check_leaf_pages(tree);
+
+    assert(bpt_split_at(tree, (void *) 400, &right) == true);
+    check_leaf_pages(tree);
+    check_leaf_pages(right);
+    assert(bpt_concat(tree, right) == true);
+    check_leaf_pages(tree);
+
+    for (i = 1; i <= records_num; i++){
+	if (i % 3 == 0 || (i >= 100 && i <= 199)){
+	    assert(bpt_search(tree, (void *) i, NULL, NULL) == false);
+	    continue;
+	}
+	assert(bpt_search(tree, (void *) i, NULL, (void **) &record) == true);
+	employee_line(i, expected);
+	assert(strcmp(record, expected) == 0);
+    }
+
+    /* The out-of-line records are freed with the tree */
+    bpt_destroy(tree);
+}
+
 int
 main(int argc, char **argv){
 
@@ -80,6 +301,16 @@ main(int argc, char **argv){
 
     records_bpt_test();
 
+    printf("Perform the tests for range aggregates of records...\n");
+
+    records_aggregate_test();
+
+    printf("Perform the tests for records in leaf pages...\n");
+
+    records_page_test(4, 256);
+    records_page_test(8, 512);
+    records_page_test(16, 4096);
+
     printf("All tests are done gracefully\n");
 
     return 0;